@@ -0,0 +1,185 @@
+/**
+ * EventLoop.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "EventLoop.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define EVENTS_PER_WAIT 256
+
+namespace scanner::async {
+
+    EventLoop::EventLoop(int cpu) : started(clock::now()), cpu(cpu) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (epoll_fd < 0 || wakeup_fd < 0) {
+            if (epoll_fd >= 0) close(epoll_fd);
+            if (wakeup_fd >= 0) close(wakeup_fd);
+            throw std::runtime_error("ERROR: Cannot create event loop");
+        }
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr; // the only event without a waiter
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &ev);
+
+        is_running = true;
+        thread = std::thread(&EventLoop::loop, this);
+    }
+
+    EventLoop::~EventLoop() {
+        uint64_t one = 1;
+
+        is_running = false;
+        (void) !write(wakeup_fd, &one, sizeof(one));
+        thread.join();
+
+        close(wakeup_fd);
+        close(epoll_fd);
+    }
+
+    void EventLoop::post(std::coroutine_handle<> h) {
+        uint64_t one = 1;
+        bool was_empty = false;
+
+        {
+            std::lock_guard<std::mutex> lock(posted_mutex);
+            was_empty = posted.empty();
+            posted.push_back(h);
+        }
+
+        if (was_empty) // otherwise the loop is going to wake up anyway
+            (void) !write(wakeup_fd, &one, sizeof(one));
+    }
+
+    EventLoop::ioAwaiter EventLoop::readable(int fd, clock::duration timeout) {
+        return ioAwaiter{*this, EPOLLIN, timeout, waiter{nullptr, fd}};
+    }
+
+    EventLoop::ioAwaiter EventLoop::writable(int fd, clock::duration timeout) {
+        return ioAwaiter{*this, EPOLLOUT, timeout, waiter{nullptr, fd}};
+    }
+
+    EventLoop::ioAwaiter EventLoop::sleep(clock::duration duration) {
+        return ioAwaiter{*this, 0, duration, waiter{}};
+    }
+
+    uint64_t EventLoop::tick(clock::time_point t, bool round_up) const {
+        auto since = t - started;
+        auto ms = round_up ? std::chrono::ceil<std::chrono::milliseconds>(since)
+                           : std::chrono::floor<std::chrono::milliseconds>(since);
+
+        return ms.count() > 0 ? static_cast<uint64_t>(ms.count()) : 0;
+    }
+
+    bool EventLoop::suspend(waiter& w, uint32_t events, clock::duration timeout) {
+        if (w.fd >= 0) {
+            epoll_event ev{};
+            ev.events = events | EPOLLONESHOT;
+            ev.data.ptr = &w;
+
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, w.fd, &ev) != 0
+                && epoll_ctl(epoll_fd, EPOLL_CTL_MOD, w.fd, &ev) != 0) {
+                w.timed_out = true;
+                return false; // not a pollable socket - don't wait for nothing
+            }
+        }
+
+        // rounded up - a timeout never comes early
+        w.timer.data = &w;
+        timers.arm(w.timer, tick(clock::now() + timeout, true));
+        return true;
+    }
+
+    void EventLoop::wake(waiter& w) {
+        if (w.fd >= 0) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w.fd, nullptr);
+        }
+        timers.cancel(w.timer);
+        w.handle.resume();
+    }
+
+    void EventLoop::expireTimers() {
+        timers.advance(tick(clock::now(), false), [this](TimerWheel::timer& t) {
+            waiter* w = static_cast<waiter*>(t.data);
+
+            if (w->fd >= 0) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->fd, nullptr);
+            }
+            w->timed_out = true;
+            w->handle.resume();
+        });
+    }
+
+    void EventLoop::resumePosted() {
+        std::vector<std::coroutine_handle<>> ready;
+        uint64_t counter = 0;
+
+        (void) !read(wakeup_fd, &counter, sizeof(counter));
+        {
+            std::lock_guard<std::mutex> lock(posted_mutex);
+            ready.swap(posted);
+        }
+
+        for (auto h : ready) {
+            h.resume();
+        }
+    }
+
+    void EventLoop::loop() {
+        epoll_event events[EVENTS_PER_WAIT];
+
+        if (cpu >= 0) {
+            cpu_set_t set;
+
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            // not fatal - the loop just floats like a pool thread
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+
+        while (is_running) {
+            int wait_ms = -1;
+
+            uint64_t next = timers.nextTick();
+            if (next != UINT64_MAX) {
+                uint64_t now = tick(clock::now(), false);
+                wait_ms = next > now ? static_cast<int>(std::min<uint64_t>(next - now, INT32_MAX)) : 0;
+            }
+
+            int n = epoll_wait(epoll_fd, events, EVENTS_PER_WAIT, wait_ms);
+            bool has_posted = false;
+
+            // every socket has one waiter and appears in the batch once,
+            // so resuming one coroutine can't invalidate the rest of the batch
+            for (int i = 0; i < n; i++) {
+                if (events[i].data.ptr == nullptr) {
+                    has_posted = true;
+                } else {
+                    wake(*static_cast<waiter*>(events[i].data.ptr));
+                }
+            }
+
+            expireTimers();
+
+            if (has_posted) {
+                resumePosted();
+            }
+        }
+    }
+}
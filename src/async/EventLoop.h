@@ -0,0 +1,97 @@
+/**
+ * EventLoop.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * One thread, one epoll instance and a timer wheel (millisecond ticks).
+ * Coroutines suspend on socket readiness (with a timeout) or on a timer,
+ * and the loop resumes them - always on the loop's own thread,
+ * so the state of a single loop is never shared between threads.
+ * The only way in from other threads is post().
+*/
+
+#ifndef PORTSCAN_EVENTLOOP_H
+#define PORTSCAN_EVENTLOOP_H
+
+#include "TimerWheel.h"
+
+#include <coroutine>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+namespace scanner::async {
+    class EventLoop {
+    public:
+        typedef std::chrono::steady_clock clock;
+    private:
+        struct waiter {
+            std::coroutine_handle<> handle;
+            int fd = -1; // -1 for plain timers
+            bool timed_out = false;
+            TimerWheel::timer timer{};
+        };
+
+        int epoll_fd = -1;
+        int wakeup_fd = -1; // eventfd - wakes the loop up, when something was posted
+
+        clock::time_point started; // tick 0 of the wheel
+        TimerWheel timers;
+
+        std::vector<std::coroutine_handle<>> posted;
+        std::mutex posted_mutex;
+
+        std::thread thread;
+        std::atomic<bool> is_running{false};
+        int cpu = -1; // the loop's thread is pinned to it, -1 = floats
+
+        void loop();
+        void resumePosted();
+        void expireTimers();
+        uint64_t tick(clock::time_point t, bool round_up) const;
+        bool suspend(waiter& w, uint32_t events, clock::duration timeout);
+        void wake(waiter& w);
+    public:
+        /**
+         * @param cpu pin the loop's thread to the CPU (-1 = let it float)
+        */
+        explicit EventLoop(int cpu = -1);
+        ~EventLoop();
+
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+
+        /**
+         * Resume the coroutine on this loop. Thread safe.
+        */
+        void post(std::coroutine_handle<> h);
+
+        /**
+         * Awaitable readiness of the socket.
+         * co_await returns false, if the timeout has passed first.
+        */
+        struct ioAwaiter {
+            EventLoop& loop;
+            uint32_t events;
+            clock::duration timeout;
+            waiter w{};
+
+            bool await_ready() const noexcept { return false; }
+            bool await_suspend(std::coroutine_handle<> h) { w.handle = h; return loop.suspend(w, events, timeout); }
+            bool await_resume() const noexcept { return !w.timed_out; }
+        };
+
+        ioAwaiter readable(int fd, clock::duration timeout);
+        ioAwaiter writable(int fd, clock::duration timeout);
+        ioAwaiter sleep(clock::duration duration);
+
+        int getCpu() const { return cpu; }
+    };
+}
+
+#endif //PORTSCAN_EVENTLOOP_H
@@ -0,0 +1,265 @@
+/**
+ * Executor.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "Executor.h"
+
+#include <thread>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <cctype>
+
+#include <sched.h>
+#include <dirent.h>
+#include <sys/resource.h>
+
+#define RESERVED_FILES 64 // for the scanner itself - dictionaries, output, raw sockets
+
+namespace scanner::async {
+
+    Job::promise_type::~promise_type() {
+        if (executor != nullptr)
+            executor->finished(group);
+    }
+
+    Executor::Executor(int threads, size_t max_concurrency, const std::vector<int>& cpus)
+            : max_jobs(max_concurrency > 0 ? max_concurrency : 1) {
+        for (int i = 0; i < (threads > 0 ? threads : 1); i++) {
+            loops.push_back(std::make_unique<EventLoop>(cpus.empty() ? -1 : cpus[i % cpus.size()]));
+        }
+    }
+
+    Executor::~Executor() {
+        wait(); // nobody may be left on the loops
+        loops.clear();
+    }
+
+    Job Executor::run(std::function<Task<>(EventLoop&)> factory, EventLoop& loop) {
+        co_await factory(loop);
+    }
+
+    void Executor::spawn(std::function<Task<>(EventLoop&)> factory, JobGroup* group) {
+        size_t index;
+
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            index = next_loop;
+            next_loop = (next_loop + 1) % loops.size();
+        }
+
+        spawnOn(index, std::move(factory), group);
+    }
+
+    void Executor::spawnOn(size_t index, std::function<Task<>(EventLoop&)> factory, JobGroup* group) {
+        EventLoop* loop = loops[index % loops.size()].get();
+
+        {
+            std::unique_lock<std::mutex> lock(jobs_mutex);
+
+            slot_free.wait(lock, [this, group]() {
+                return in_flight < max_jobs && (group == nullptr || (group->in_flight < share(*group) && !group->paused
+                                                                     && (group->parent == nullptr || !group->parent->paused)));
+            });
+            in_flight++;
+            if (group != nullptr)
+                group->in_flight++;
+        }
+
+        pacer.wait();
+
+        Job job = run(std::move(factory), *loop);
+        job.handle.promise().executor = this;
+        job.handle.promise().group = group;
+        loop->post(job.handle);
+    }
+
+    void Executor::finished(JobGroup* group) {
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            in_flight--;
+            if (group != nullptr)
+                group->in_flight--;
+        }
+        // spawners of different groups wait for different things
+        slot_free.notify_all();
+        all_done.notify_all();
+    }
+
+    void Executor::wait() {
+        std::unique_lock<std::mutex> lock(jobs_mutex);
+
+        all_done.wait(lock, [this]() {
+            return in_flight == 0;
+        });
+    }
+
+    void Executor::wait(JobGroup& group) {
+        std::unique_lock<std::mutex> lock(jobs_mutex);
+
+        all_done.wait(lock, [&group]() {
+            return group.in_flight == 0;
+        });
+    }
+
+    size_t Executor::share(const JobGroup& group) const {
+        const JobGroup& scan = group.parent != nullptr ? *group.parent : group;
+
+        if (groups <= 1 && scan.parts <= 1) {
+            return max_jobs;
+        }
+        // fair share of the limit, but at least one coroutine
+        return std::max<size_t>(max_jobs / std::max<size_t>(groups, 1) / scan.parts, 1);
+    }
+
+    void Executor::join(JobGroup& group) {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+
+        if (!group.joined) {
+            group.joined = true;
+            groups++;
+        }
+    }
+
+    void Executor::join(JobGroup& group, JobGroup& parent) {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+
+        if (!group.joined) {
+            group.joined = true;
+            group.parent = &parent;
+            parent.parts++; // one more part of the same share
+        }
+    }
+
+    void Executor::leave(JobGroup& group) {
+        wait(group);
+
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+
+            if (group.joined && group.parent != nullptr) {
+                group.parent->parts--;
+                group.parent = nullptr;
+                group.joined = false;
+            } else if (group.joined) {
+                group.joined = false;
+                groups--;
+            }
+        }
+        slot_free.notify_all(); // shares of the others have grown
+    }
+
+    void Executor::pause(JobGroup& group, bool paused) {
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            group.paused = paused;
+        }
+        if (!paused)
+            slot_free.notify_all();
+    }
+
+    size_t Executor::maxSockets() {
+        rlimit limit{};
+
+        if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            return 1024 - RESERVED_FILES;
+        }
+
+        if (limit.rlim_cur < limit.rlim_max) {
+            rlimit raised = limit;
+
+            raised.rlim_cur = limit.rlim_max == RLIM_INFINITY ? 1 << 20 : limit.rlim_max;
+            if (setrlimit(RLIMIT_NOFILE, &raised) == 0)
+                limit = raised;
+        }
+
+        return limit.rlim_cur > RESERVED_FILES * 2 ? limit.rlim_cur - RESERVED_FILES : RESERVED_FILES;
+    }
+
+    // "0-3,8-11" -> 0 1 2 3 8 9 10 11
+    static std::vector<int> parse_cpu_list(const std::string& list) {
+        std::vector<int> cpus;
+        size_t pos = 0;
+
+        while (pos < list.size()) {
+            size_t comma = list.find(',', pos);
+            std::string range = list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+            size_t dash = range.find('-');
+            int from = std::atoi(range.c_str());
+            int to = dash != std::string::npos ? std::atoi(range.c_str() + dash + 1) : from;
+
+            for (int c = from; c <= to; c++)
+                cpus.push_back(c);
+
+            if (comma == std::string::npos)
+                break;
+            pos = comma + 1;
+        }
+        return cpus;
+    }
+
+    std::vector<int> Executor::cpus(bool numa) {
+        std::vector<std::vector<int>> nodes;
+        std::vector<int> result;
+        cpu_set_t allowed;
+
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return result;
+        }
+
+        if (numa) {
+            DIR* dir = opendir("/sys/devices/system/node");
+
+            if (dir != nullptr) {
+                for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+                    std::string name = entry->d_name;
+
+                    if (name.compare(0, 4, "node") != 0 || name.size() == 4 || !std::isdigit(name[4]))
+                        continue;
+
+                    std::ifstream f("/sys/devices/system/node/" + name + "/cpulist");
+                    std::string list;
+                    std::vector<int> node;
+
+                    std::getline(f, list);
+                    for (int c : parse_cpu_list(list)) {
+                        if (c < CPU_SETSIZE && CPU_ISSET(c, &allowed))
+                            node.push_back(c);
+                    }
+                    if (!node.empty())
+                        nodes.push_back(node);
+                }
+                closedir(dir);
+            }
+        }
+
+        if (nodes.size() <= 1) {
+            // one node (or no NUMA at all) - CPUs in order
+            for (int c = 0; c < CPU_SETSIZE; c++) {
+                if (CPU_ISSET(c, &allowed))
+                    result.push_back(c);
+            }
+            return result;
+        }
+
+        size_t largest = 0;
+        for (auto& node : nodes)
+            largest = std::max(largest, node.size());
+
+        std::sort(nodes.begin(), nodes.end());
+        for (size_t i = 0; i < largest; i++) {
+            for (auto& node : nodes) {
+                if (i < node.size())
+                    result.push_back(node[i]);
+            }
+        }
+        return result;
+    }
+}
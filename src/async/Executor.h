@@ -0,0 +1,153 @@
+/**
+ * Executor.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Small, fixed set of event loops running a huge number of coroutines.
+ * Every probe is a coroutine, which costs a few hundred bytes
+ * instead of a whole thread with its own stack, so 100k probes
+ * can wait for their sockets at the same time.
+ *
+ * The number of coroutines alive at once is limited - spawn() blocks
+ * at the limit, the same way as the thread pool queue would grow.
+ *
+ * Many scans can share one executor (daemon mode). Each of them spawns
+ * its coroutines in its own JobGroup, and a group may keep only
+ * its fair share of the limit (limit / groups), so a big scan
+ * can't starve small ones. Pipelines of one scan (TCP and UDP of -ALL)
+ * join as parts of its group - they split its share, not take one each.
+ * The optional rate limit is shared as well - spawning threads take
+ * turns in reserving the next send time.
+*/
+
+#ifndef PORTSCAN_EXECUTOR_H
+#define PORTSCAN_EXECUTOR_H
+
+#include "EventLoop.h"
+#include "Task.h"
+#include "Pacer.h"
+
+#include <memory>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace scanner::async {
+    /**
+     * Coroutines of one scan, see Executor::join().
+    */
+    class JobGroup {
+        friend class Executor;
+        size_t in_flight = 0;
+        bool joined = false;
+        JobGroup* parent = nullptr; // the scan, whose share this pipeline uses
+        size_t parts = 1; // pipelines in the share (this group and the joined ones)
+        bool paused = false; // no new coroutines, see Executor::pause()
+    };
+
+    class Executor {
+    private:
+        std::vector<std::unique_ptr<EventLoop>> loops;
+        size_t next_loop = 0;
+
+        size_t max_jobs;
+        size_t in_flight = 0;
+        size_t groups = 0;
+        std::mutex jobs_mutex;
+        std::condition_variable slot_free;
+        std::condition_variable all_done;
+
+        Pacer pacer; // of the spawns
+
+        size_t share(const JobGroup& group) const;
+
+        static Job run(std::function<Task<>(EventLoop&)> factory, EventLoop& loop);
+
+        friend struct Job::promise_type;
+        void finished(JobGroup* group);
+    public:
+        /**
+         * @param threads number of event loops (threads)
+         * @param max_concurrency coroutines alive at once
+         * @param cpus pin i-th loop to cpus[i % size], empty = don't pin
+        */
+        Executor(int threads, size_t max_concurrency, const std::vector<int>& cpus = {});
+        ~Executor();
+
+        /**
+         * Start the coroutine made by the factory on one of the loops.
+         * Blocks while the concurrency limit (or the group's share of it)
+         * is reached, and to keep the rate limit.
+        */
+        void spawn(std::function<Task<>(EventLoop&)> factory, JobGroup* group = nullptr);
+
+        /**
+         * The same as spawn(), but on the given loop.
+        */
+        void spawnOn(size_t loop, std::function<Task<>(EventLoop&)> factory, JobGroup* group = nullptr);
+
+        size_t size() const { return loops.size(); }
+
+        /**
+         * Wait until all spawned coroutines are finished.
+        */
+        void wait();
+
+        /**
+         * Wait until the coroutines of the group are finished.
+        */
+        void wait(JobGroup& group);
+
+        /**
+         * Start sharing the limit with the group.
+        */
+        void join(JobGroup& group);
+
+        /**
+         * Join another pipeline of the scan, which joined as parent -
+         * the parent's share is split between them.
+        */
+        void join(JobGroup& group, JobGroup& parent);
+
+        /**
+         * Waits for the group and gives its share back to the others.
+        */
+        void leave(JobGroup& group);
+
+        /**
+         * Hold back spawns of the group and of its parts, coroutines
+         * in flight go on. Other groups are not affected.
+        */
+        void pause(JobGroup& group, bool paused);
+
+        /**
+         * @param per_second coroutines started per second at most, 0 = no limit
+        */
+        void setRate(size_t per_second) { pacer.setRate(per_second); }
+
+        /**
+         * The same as setRate(), for intervals longer than a second.
+        */
+        void setInterval(std::chrono::nanoseconds interval) { pacer.setInterval(interval); }
+
+        /**
+         * Raise the limit of open files as high as allowed
+         * and tell, how many sockets can be open at once.
+        */
+        static size_t maxSockets();
+
+        /**
+         * CPUs the process may run on, in the order to pin loops to them.
+         * @param numa take them from NUMA nodes in turns, so a few loops
+         *             are spread over all nodes (and their memory controllers)
+        */
+        static std::vector<int> cpus(bool numa);
+    };
+}
+
+#endif //PORTSCAN_EXECUTOR_H
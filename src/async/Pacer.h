@@ -0,0 +1,63 @@
+/**
+ * Pacer.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Keeps a minimal interval between the starts of probes. Threads take
+ * turns in reserving the next start time and sleep until it comes,
+ * so the rate holds for any number of them.
+*/
+
+#ifndef PORTSCAN_PACER_H
+#define PORTSCAN_PACER_H
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace scanner::async {
+    class Pacer {
+        std::chrono::nanoseconds interval{0}; // 0 = no limit
+        std::chrono::steady_clock::time_point next{};
+        std::mutex mutex;
+    public:
+        void setInterval(std::chrono::nanoseconds i) {
+            std::lock_guard<std::mutex> lock(mutex);
+            interval = i;
+        }
+
+        /**
+         * @param per_second 0 = no limit
+        */
+        void setRate(size_t per_second) {
+            setInterval(std::chrono::nanoseconds(per_second > 0 ? 1000000000 / per_second : 0));
+        }
+
+        /**
+         * Blocks until it's the caller's turn.
+        */
+        void wait() {
+            std::chrono::steady_clock::time_point at;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (interval.count() == 0)
+                    return;
+
+                auto now = std::chrono::steady_clock::now();
+                if (next < now)
+                    next = now; // no credit for the idle time
+                at = next;
+                next += interval;
+            }
+
+            std::this_thread::sleep_until(at);
+        }
+    };
+}
+
+#endif //PORTSCAN_PACER_H
@@ -0,0 +1,70 @@
+/**
+ * PerThread.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * One T for every thread, which has asked for it (shards of Metrics,
+ * Journal and Capture). local() is a thread_local compare only, the lock
+ * is taken just for threads seen for the first time and by forEach().
+ * Items live as long as the PerThread - threads may come and go.
+*/
+
+#ifndef PORTSCAN_PERTHREAD_H
+#define PORTSCAN_PERTHREAD_H
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <functional>
+
+namespace scanner::async {
+    template<typename T>
+    class PerThread {
+    private:
+        static inline std::atomic<uint64_t> next_id{1};
+
+        uint64_t id; // tells apart instances in the thread_local cache
+        std::vector<std::unique_ptr<T>> items;
+        std::mutex items_mutex;
+        std::function<void(T&)> init;
+    public:
+        /**
+         * @param init called for every new item, before the thread gets it
+        */
+        explicit PerThread(std::function<void(T&)> init = nullptr) : id(next_id.fetch_add(1)), init(std::move(init)) {}
+
+        T& local() {
+            thread_local uint64_t cached_id = 0;
+            thread_local T* cached = nullptr;
+
+            if (cached_id != id) {
+                std::lock_guard<std::mutex> lock(items_mutex);
+
+                items.push_back(std::make_unique<T>());
+                cached = items.back().get();
+                if (init)
+                    init(*cached);
+                cached_id = id;
+            }
+            return *cached;
+        }
+
+        /**
+         * Calls f with the item of every thread seen so far, under the lock.
+        */
+        template<typename F>
+        void forEach(F f) {
+            std::lock_guard<std::mutex> lock(items_mutex);
+
+            for (auto& item : items)
+                f(*item);
+        }
+    };
+}
+
+#endif //PORTSCAN_PERTHREAD_H
@@ -0,0 +1,124 @@
+/**
+ * Task.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Coroutine types of the event loop executor.
+ *
+ * Task<T> is lazy - it starts, when it is awaited, and resumes
+ * the awaiting coroutine directly when it finishes (symmetric transfer),
+ * so a chain of probes never grows the thread stack.
+ *
+ * Job is the root of such chain - it is started by the Executor
+ * on one of its loops and tells the Executor, when it's gone.
+*/
+
+#ifndef PORTSCAN_TASK_H
+#define PORTSCAN_TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <type_traits>
+
+namespace scanner::async {
+    class Executor;
+    class JobGroup;
+
+    template<typename T>
+    class Task;
+
+    namespace detail {
+        template<typename T>
+        struct promiseBase {
+            std::coroutine_handle<> continuation;
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            struct finalAwaiter {
+                bool await_ready() noexcept { return false; }
+                template<typename P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+                    return h.promise().continuation;
+                }
+                void await_resume() noexcept {}
+            };
+            finalAwaiter final_suspend() noexcept { return {}; }
+
+            // probes don't throw - an exception here is a bug
+            void unhandled_exception() { std::terminate(); }
+        };
+
+        template<typename T>
+        struct promise : promiseBase<T> {
+            T value{};
+
+            Task<T> get_return_object();
+            void return_value(T v) { value = std::move(v); }
+        };
+
+        template<>
+        struct promise<void> : promiseBase<void> {
+            Task<void> get_return_object();
+            void return_void() {}
+        };
+    }
+
+    template<typename T = void>
+    class Task {
+    public:
+        typedef detail::promise<T> promise_type;
+    private:
+        std::coroutine_handle<promise_type> handle;
+    public:
+        explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+        Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+        ~Task() { if (handle) handle.destroy(); }
+
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+        T await_resume() {
+            if constexpr (!std::is_void_v<T>)
+                return std::move(handle.promise().value);
+        }
+    };
+
+    template<typename T>
+    Task<T> detail::promise<T>::get_return_object() {
+        return Task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+    }
+
+    inline Task<void> detail::promise<void>::get_return_object() {
+        return Task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+    }
+
+    class Job {
+    public:
+        struct promise_type {
+            Executor* executor = nullptr;
+            JobGroup* group = nullptr;
+
+            Job get_return_object() { return Job(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; } // frees itself
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+
+            ~promise_type(); // reports the end of the job to the executor
+        };
+
+        std::coroutine_handle<promise_type> handle;
+
+        explicit Job(std::coroutine_handle<promise_type> h) : handle(h) {}
+    };
+}
+
+#endif //PORTSCAN_TASK_H
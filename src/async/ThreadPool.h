@@ -21,6 +21,7 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 
 #include <iostream>
 
@@ -33,8 +34,9 @@ namespace scanner::async {
         std::mutex tasks_mutex;
         std::condition_variable task_available;
         std::condition_variable task_done;
-        bool is_running = false;
-        bool is_waiting = false;
+        std::atomic<bool> is_running{false};
+        std::atomic<bool> is_waiting{false};
+        int active = 0; // tasks taken from the queue, but not finished yet
 
         void threadLoop() {
             while(is_running) {
@@ -46,16 +48,26 @@ namespace scanner::async {
                         return !is_running || !tasks.empty();
                     });
 
+                    if (tasks.empty()) {
+                        return; // pool is being destroyed
+                    }
+
                     task = tasks.front();
                     tasks.pop();
+                    active++;
                 }
 
                 if (is_running) {
                     task();
+                }
 
-                    if (is_waiting) {
-                        task_done.notify_one();
-                    }
+                {
+                    std::lock_guard<std::mutex> lock(tasks_mutex);
+                    active--;
+                }
+
+                if (is_waiting) {
+                    task_done.notify_one();
                 }
             }
         }
@@ -95,16 +107,22 @@ namespace scanner::async {
             is_waiting = true;
             std::unique_lock<std::mutex> lock(tasks_mutex);
 
+            // queue may be empty while the last tasks are still running,
+            // so wait for them as well - otherwise results of one host
+            // would be printed under the header of the next one
             task_done.wait(lock, [this] {
-                return tasks.size() == 0;
+                return tasks.empty() && active == 0;
             });
 
             is_waiting = false;
         }
 
         void push(const std::function<void()>& func) {
-            std::lock_guard<std::mutex> lock(tasks_mutex);
-            tasks.push(func);
+            {
+                std::lock_guard<std::mutex> lock(tasks_mutex);
+                tasks.push(func);
+            }
+            task_available.notify_one();
         }
     };
 }
@@ -0,0 +1,154 @@
+/**
+ * TimerWheel.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "TimerWheel.h"
+
+#include <cstdint>
+
+namespace scanner::async {
+
+    TimerWheel::TimerWheel(uint64_t now) : current(now) {
+        for (auto& level : slots) {
+            for (auto& slot : level) {
+                slot.prev = slot.next = &slot;
+            }
+        }
+    }
+
+    void TimerWheel::unlink(timer& t) {
+        t.prev->next = t.next;
+        t.next->prev = t.prev;
+        t.prev = t.next = nullptr;
+    }
+
+    void TimerWheel::append(timer& list, timer& t) {
+        t.prev = list.prev;
+        t.next = &list;
+        list.prev->next = &t;
+        list.prev = &t;
+    }
+
+    void TimerWheel::splice(timer& from, timer& to) {
+        if (isEmpty(from))
+            return;
+
+        from.next->prev = to.prev;
+        to.prev->next = from.next;
+        from.prev->next = &to;
+        to.prev = from.prev;
+        from.prev = from.next = &from;
+    }
+
+    bool TimerWheel::isLevelEmpty(int level) const {
+        for (uint64_t word : occupied[level]) {
+            if (word != 0)
+                return false;
+        }
+        return true;
+    }
+
+    void TimerWheel::clearIfEmpty(uint16_t slot) {
+        int level = slot >> WHEEL_BITS;
+        size_t index = slot & (WHEEL_SLOTS - 1);
+
+        if (isEmpty(slots[level][index]))
+            occupied[level][index / 64] &= ~(1ULL << (index % 64));
+    }
+
+    void TimerWheel::insert(timer& t) {
+        uint64_t distance = t.expires - current; // expires >= current
+        int level = 0;
+
+        while (level < WHEEL_LEVELS - 1 && distance >= (1ULL << (WHEEL_BITS * (level + 1))))
+            level++;
+
+        if (distance >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1) {
+            t.expires = current + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1; // 49 days is the limit
+        }
+
+        size_t index = (t.expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+
+        t.slot = static_cast<uint16_t>((level << WHEEL_BITS) | index);
+        append(slots[level][index], t);
+        occupied[level][index / 64] |= 1ULL << (index % 64);
+    }
+
+    void TimerWheel::cascade(int level, size_t index) {
+        timer batch;
+
+        batch.prev = batch.next = &batch;
+        splice(slots[level][index], batch);
+        occupied[level][index / 64] &= ~(1ULL << (index % 64));
+
+        while (!isEmpty(batch)) {
+            timer& t = *batch.next;
+
+            unlink(t);
+            insert(t); // closer now - goes to a lower level
+        }
+    }
+
+    void TimerWheel::arm(timer& t, uint64_t expires) {
+        if (t.isArmed()) {
+            cancel(t);
+        }
+
+        // the slot of the current tick is processed already
+        t.expires = expires > current ? expires : current + 1;
+        insert(t);
+        count++;
+    }
+
+    void TimerWheel::cancel(timer& t) {
+        if (!t.isArmed()) {
+            return;
+        }
+
+        unlink(t);
+        clearIfEmpty(t.slot);
+        count--;
+    }
+
+    uint64_t TimerWheel::nextTick() const {
+        if (count == 0) {
+            return UINT64_MAX;
+        }
+
+        // upper levels cascade at the end of this round of level 0 -
+        // slots before start, found below, are after that
+        uint64_t cascade = UINT64_MAX;
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+            if (!isLevelEmpty(level)) {
+                cascade = (current | (WHEEL_SLOTS - 1)) + 1;
+                break;
+            }
+        }
+
+        // the first non-empty slot of level 0 after the current one
+        size_t start = (current + 1) & (WHEEL_SLOTS - 1);
+        for (size_t i = 0; i < WHEEL_SLOTS / 64 + 1; i++) {
+            size_t word = ((start / 64) + i) % (WHEEL_SLOTS / 64);
+            uint64_t bits = occupied[0][word];
+
+            if (i == 0)
+                bits &= ~0ULL << (start % 64); // slots before start are from the next round
+            if (i == WHEEL_SLOTS / 64)
+                bits &= (start % 64) != 0 ? ~(~0ULL << (start % 64)) : 0;
+
+            if (bits != 0) {
+                size_t index = word * 64 + __builtin_ctzll(bits);
+                uint64_t tick = current + 1 + ((index - start) & (WHEEL_SLOTS - 1));
+                return tick < cascade ? tick : cascade;
+            }
+        }
+
+        // only upper levels - the next cascade
+        return cascade;
+    }
+}
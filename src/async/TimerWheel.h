@@ -0,0 +1,139 @@
+/**
+ * TimerWheel.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Hierarchical timing wheel with millisecond ticks - deadlines of probes
+ * in flight. Arm and cancel are O(1) (timers are nodes of intrusive lists,
+ * embedded in their owners, so nothing is allocated either), expiry is O(1)
+ * per timer plus a cascade every 256 ticks.
+ *
+ * 4 levels of 256 slots cover 2^32 ms (49 days). A timer goes to the level
+ * by its distance from now and to the slot by its own bits, so when
+ * the lower level wraps around, the next slot of the upper one is
+ * spread over it again.
+ *
+ * Not thread safe - every event loop has its own wheel.
+*/
+
+#ifndef PORTSCAN_TIMERWHEEL_H
+#define PORTSCAN_TIMERWHEEL_H
+
+#include <cstdint>
+#include <cstddef>
+
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+
+namespace scanner::async {
+    class TimerWheel {
+    public:
+        struct timer {
+            timer* prev = nullptr;
+            timer* next = nullptr;
+            uint64_t expires = 0; // tick
+            uint16_t slot = 0; // level << WHEEL_BITS | index
+            void* data = nullptr; // owner of the timer
+
+            bool isArmed() const { return next != nullptr; }
+        };
+    private:
+        // circular lists with a sentinel - a timer can unlink itself
+        // from whatever list it is in (a slot or the batch being expired)
+        timer slots[WHEEL_LEVELS][WHEEL_SLOTS];
+        uint64_t occupied[WHEEL_LEVELS][WHEEL_SLOTS / 64] = {}; // bitmaps of non-empty slots
+
+        uint64_t current = 0; // the last tick processed
+        size_t count = 0;
+
+        static void unlink(timer& t);
+        static void append(timer& list, timer& t);
+        static void splice(timer& from, timer& to);
+        static bool isEmpty(const timer& list) { return list.next == &list; }
+
+        void insert(timer& t);
+        void cascade(int level, size_t index);
+        void clearIfEmpty(uint16_t slot);
+        bool isLevelEmpty(int level) const;
+    public:
+        explicit TimerWheel(uint64_t now = 0);
+
+        TimerWheel(const TimerWheel&) = delete;
+        TimerWheel& operator=(const TimerWheel&) = delete;
+
+        /**
+         * Expire the timer at the tick (at least one tick from now).
+         * Re-arms it, if it is armed already.
+        */
+        void arm(timer& t, uint64_t expires);
+
+        void cancel(timer& t);
+
+        /**
+         * Process all ticks up to now and call expired(timer&) for every
+         * expired timer - it is unlinked already, so the callback may
+         * arm or cancel any timers, including this one.
+        */
+        template<typename F>
+        void advance(uint64_t now, F&& expired) {
+            while (current < now) {
+                if (count == 0) {
+                    current = now;
+                    break;
+                }
+
+                if (isLevelEmpty(0)) {
+                    // nothing to expire until the next cascade
+                    uint64_t last = current | (WHEEL_SLOTS - 1);
+                    current = last < now ? last : now;
+                    if (current == now)
+                        break;
+                }
+
+                current++;
+                if ((current & (WHEEL_SLOTS - 1)) == 0) {
+                    for (int level = 1; level < WHEEL_LEVELS; level++) {
+                        if (((current >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)) != 0 || level == WHEEL_LEVELS - 1) {
+                            // lower levels are filled from the upper ones
+                            for (int l = level; l >= 1; l--)
+                                cascade(l, (current >> (WHEEL_BITS * l)) & (WHEEL_SLOTS - 1));
+                            break;
+                        }
+                    }
+                }
+
+                size_t index = current & (WHEEL_SLOTS - 1);
+                if (isEmpty(slots[0][index]))
+                    continue;
+
+                timer batch;
+                batch.prev = batch.next = &batch;
+                splice(slots[0][index], batch);
+                clearIfEmpty(static_cast<uint16_t>(index));
+
+                while (!isEmpty(batch)) {
+                    timer& t = *batch.next;
+
+                    unlink(t);
+                    count--;
+                    expired(t);
+                }
+            }
+        }
+
+        /**
+         * The tick, when the wheel has something to do next
+         * (expire a timer or cascade), UINT64_MAX if it is empty.
+        */
+        uint64_t nextTick() const;
+
+        uint64_t now() const { return current; }
+        size_t size() const { return count; }
+    };
+}
+
+#endif //PORTSCAN_TIMERWHEEL_H
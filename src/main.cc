@@ -13,13 +13,32 @@
 #include <string>
 #include <iomanip>
 #include <locale>
+#include <csignal>
 
 #include "scanner/PortScanner.h"
+#ifdef __linux__
+#   include "scanner/Daemon.h"
+#endif
 
 using std::cout;
 using std::string;
 using scanner::flags;
 
+// the scan in progress, for the Ctrl+C handler
+static scanner::PortScanner* running_scan = nullptr;
+#ifdef __linux__
+static scanner::Daemon* running_daemon = nullptr;
+#endif
+
+extern "C" void on_interrupt(int) {
+    if (running_scan != nullptr)
+        running_scan->cancel(); // finishes probes in flight and saves the checkpoint
+#ifdef __linux__
+    if (running_daemon != nullptr)
+        running_daemon->stop(); // cancels the jobs
+#endif
+}
+
 bool is_number(const std::string& s) {
     for (auto c : s)
         if (!std::isdigit(c)) return false;
@@ -40,11 +59,93 @@ void print_help() {
         << std::setw(56) << "usage: portscan <Ip address> <Ip mask> [-t <timeout in ms>]" << std::endl
         << std::setw(46) << "[-f | --fast] [-p <from> <to>]" << std::endl
         << std::setw(50) << "[-TCP] [-UDP] [-ALL] [-h | --help]" << std::endl
-        << std::setw(46) << "[-th <threads>] [--no-threads]" << std::endl
-        << std::setw(25) << "[--crazy]" << std::endl << std::endl
-        << "--crazy\n\tFor every request create a new thread.\n"
-        << "\tNot recommended, but it's really fast.\n" 
-        << "\tAnyway, you should probably set timeout to 5-10s,\n\t because the function is to fast"
+        << std::setw(66) << "[-th <threads>] [--udp-threads <n>] [--no-threads]" << std::endl
+        << std::setw(48) << "[-T<0-5>] [--timing-file <file>]" << std::endl
+        << std::setw(46) << "[--max-duration <s>] [--stdin]" << std::endl
+        << std::setw(64) << "[--source <ip[-ip],...>] [--filtered-cutoff <n>]" << std::endl
+        << std::setw(57) << "[--crazy] [--max-probes <n>] [--rate <n>]" << std::endl
+        << std::setw(37) << "[--per-core] [--numa]" << std::endl
+        << std::setw(65) << "[--checkpoint <file>] [--checkpoint-interval <s>]" << std::endl
+        << std::setw(26) << "[--resume]" << std::endl
+        << std::setw(62) << "[--shard <i/N>] [--shard-seed <n>] [-o <file>]" << std::endl
+        << std::setw(34) << "[--journal <file>]" << std::endl
+        << std::setw(51) << "[--banners] [--banner-timeout <ms>]" << std::endl
+        << std::setw(58) << "[--banner-concurrency <n>] [--no-payloads]" << std::endl
+        << std::setw(46) << "[--batch] [--ring <interface>]" << std::endl
+        << std::setw(58) << "[--metrics <file>] [--metrics-port <port>]" << std::endl
+        << std::setw(54) << "[--progress] [--progress-interval <s>]" << std::endl
+        << std::setw(32) << "[--trace <file>]" << std::endl
+        << std::setw(58) << "[--capture <file>] [--capture-snaplen <n>]" << std::endl
+        << std::setw(38) << "[--capture-sample <n>]" << std::endl
+        << std::setw(70) << "[--baseline <file>] [--sample <%>] [--sample-seed <n>]" << std::endl
+        << std::setw(35) << "[--daemon <socket>]" << std::endl << std::endl
+        << "-T<0-5>\n\tTiming template: 0 paranoid, 1 sneaky, 2 polite, 3 normal (default),\n"
+        << "\t4 aggressive, 5 insane. Sets probes in flight, timeouts, UDP retries,\n"
+        << "\tdelay between probes and rate at once - options given explicitly win.\n"
+        << "\tThe timeout adapts to round trips, except normal: fixed 500ms for TCP\n"
+        << "\tand 1s for each UDP try (-t <ms> makes the TCP one fixed).\n"
+        << "--timing-file <file>\n\tThe same from `<key> <value>` lines: concurrency, timeout, min-timeout,\n"
+        << "\tmax-timeout, retries, udp-timeout, delay and rate (times in ms, normal ones\n"
+        << "\tby default, udp-timeout 0 = starts from the TCP timeout).\n"
+        << "--max-duration <s>\n\tFinish within s seconds: hosts are scanned in passes, every pass probes\n"
+        << "\tthe next most common ports (as many as the measured rate allows) on all\n"
+        << "\thosts, those with answers first. Stops at the deadline and reports coverage.\n"
+        << "--stdin\n\tProbe `<ip>:<port>[/tcp|udp]` lines (or -o lines) of stdin instead of\n"
+        << "\tthe range, pairs without the protocol as -TCP, -UDP or -ALL says. Every\n"
+        << "\tresult goes to stdout as the -o line at once (closed ones as well).\n"
+        << "\tReading waits, while " << TARGET_QUEUE_SIZE << " pairs are queued, so it's a stage of a pipeline.\n"
+        << "--source <ip[-ip],...>\n\tSend TCP probes from these local addresses in turns - each one has\n"
+        << "\tits own range of ephemeral ports, so big scans don't run out of them.\n"
+        << "--filtered-cutoff <n>\n\tSkip the rest of a host, once n of its probes timed out\n"
+        << "\twithout a single open or closed port (firewalled or down hosts).\n"
+        << "--udp-threads <n>\n\tWith -ALL, UDP probes run next to TCP ones in a pool of their own\n"
+        << "\t(as big as -th by default), so a host takes as long as the slower protocol.\n"
+        << "--crazy\n\tProbe all ports at once - every probe is a coroutine\n"
+        << "\ton one of -th event loops (Linux only). Really fast.\n"
+        << "\tAnyway, you should probably set timeout to 5-10s,\n\t because the function is to fast\n"
+        << "--max-probes <n>\n\tProbes in flight in --crazy mode\n"
+        << "\t(as many as the limit of open files allows by default).\n"
+        << "--rate <n>\n\tStart at most n probes per second (--crazy, --per-core and --daemon).\n"
+        << "--per-core\n\tThe same probes as --crazy, but every one of -th engines (one per core\n"
+        << "\tby default) is pinned to its core and probes its own part of the ports.\n"
+        << "--numa\n\t--per-core with engines spread over NUMA nodes in turns.\n"
+        << "--checkpoint <file>\n\tSave progress and results of the scan to the file\n"
+        << "\tevery few seconds (5s by default).\n"
+        << "--resume\n\tContinue the scan saved in the checkpoint file\n"
+        << "\t(`portscan.state` if --checkpoint wasn't given).\n"
+        << "\tIp, mask, ports and protocols have to be the same.\n"
+        << "--shard <i/N>\n\tScan only i-th of N parts of the (host, port) pairs.\n"
+        << "\tNodes with the same range, N and seed never scan the same pair.\n"
+        << "-o <file>\n\tWrite open ports as `<ip> <port>/<proto> <status> <service>` lines,\n"
+        << "\tlists from all shards can be merged with `sort -u`.\n"
+        << "--journal <file>\n\tAppend every probe (open, closed and filtered ports, round trip, time)\n"
+        << "\tto the binary journal. Query journals of many runs with `portscan-query`.\n"
+        << "--banners\n\tRead the first bytes sent by open TCP ports to report\n"
+        << "\tthe real service and its version (2s, 256 ports at once by default).\n"
+        << "--no-payloads\n\tSend empty UDP datagrams instead of requests from `payloads` file.\n"
+        << "--batch\n\tScan UDP ports of a host all at once, many packets per system call.\n"
+        << "\tMuch faster for big port ranges (requires raw sockets).\n"
+        << "--ring <interface>\n\tThe same as --batch, but packets go through memory mapped\n"
+        << "\tAF_PACKET rings of the interface (Linux only, eg. eth0 or a veth,\n"
+        << "\tlo with net.ipv4.conf.lo.accept_local=1 and route_localnet=1).\n"
+        << "--metrics <file>\n\tWrite probe counters and latency histograms in Prometheus\n"
+        << "\ttext format to the file every 5s.\n"
+        << "--metrics-port <port>\n\tServe the same metrics over HTTP on 127.0.0.1:<port>.\n"
+        << "--progress\n\tPrint completion, probe rate and ETA to stderr (every 2s by default).\n"
+        << "--trace <file>\n\tRecord timeline of every probe (last 65536 events of each thread)\n"
+        << "\tto the binary file. Convert it with `trace2json <file> <json>`.\n"
+        << "--capture <file>\n\tWrite raw UDP probes and the replies matched with them to the pcap file\n"
+        << "\t(thread pool, --no-threads and --batch). --capture-snaplen keeps n bytes of\n"
+        << "\tevery packet (" << CAPTURE_DEFAULT_SNAPLEN << " by default), --capture-sample only 1 of n probes.\n"
+        << "--baseline <file>\n\tRescan against the -o list of the previous run: its open ports are probed\n"
+        << "\tfirst and only changes are reported (+ new, - closed, ~ other status).\n"
+        << "--sample <%>\n\tProbe only a part of the ports, which weren't open in the baseline.\n"
+        << "\tThe sample changes every day (unless --sample-seed is given).\n"
+        << "--daemon <socket>\n\tStay running and take scans over the UNIX socket, one per line\n"
+        << "\t(`<ip> <mask> [-p <from> <to>] [-TCP|-UDP|-ALL] [-T<0-5>] [-t <ms>] [--banners]\n"
+        << "\t[--filtered-cutoff <n>]`).\n"
+        << "\tResults come back as -o lines. Jobs run at once and share -th, --max-probes\n"
+        << "\tand --rate fairly (Linux only)."
         << std::endl;
 }
 
@@ -97,16 +198,41 @@ void get_timeout(char** argv, int i, timeval& timeout) {
 int main(int argc, char** argv) {
     scanner::flags f{};
 
-    string s_ip{}, s_mask{};
+    string s_ip{}, s_mask{}, s_daemon_socket{};
     std::locale loc{};
 
     auto* str_tmp = new string;
 
     scanner::PortScanner* portScanner = nullptr;
 
-    print_version();
+    // the timing profile first, so the options given explicitly override it
+    // (and --stdin, before anything is printed)
+    for (int i = 1; i < argc; i++) {
+        *str_tmp = argv[i];
+        for (auto& c : *str_tmp)
+            c = std::tolower(c, loc);
+
+        try {
+            if (str_tmp->size() == 3 && (*str_tmp)[0] == '-' && (*str_tmp)[1] == 't'
+                && (*str_tmp)[2] >= '0' && (*str_tmp)[2] <= '5') {
+                scanner::set_timing(f, scanner::Timing::get((*str_tmp)[2] - '0'));
+            } else if (*str_tmp == "--timing-file" && i + 1 < argc) {
+                scanner::set_timing(f, scanner::Timing::load(argv[++i]));
+            } else if (*str_tmp == "--stdin") {
+                f.b_stdin = true;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            delete str_tmp;
+            return 1;
+        }
+    }
+
+    if (!f.b_stdin) { // stdout of --stdin is for the results only
+        print_version();
 
-    cout << "Reading args...\n";
+        cout << "Reading args...\n";
+    }
 
     bool help_flag = false;
     for(int i = 1; i < argc; i++) {
@@ -147,6 +273,7 @@ int main(int argc, char** argv) {
                 if (i + 1 < argc) {
                     if (is_number(*(argv + i + 1))) {
                         get_timeout(argv, i, f.t_timeout);
+                        f.t_min_timeout = f.t_max_timeout = f.t_timeout; // fixed
                     }
                 }
             } else if (*str_tmp == "th") {
@@ -156,11 +283,186 @@ int main(int argc, char** argv) {
 
                         if (l_tmp > 0) {
                             f.i_thread_count = l_tmp;
+                            f.i_concurrency = 0;
                         }
                     }
                 }
+            } else if (str_tmp->size() == 2 && (*str_tmp)[0] == 't' && (*str_tmp)[1] >= '0' && (*str_tmp)[1] <= '5') {
+                // -T<n>, applied already
+            } else if (*str_tmp == "-timing-file") {
+                i++; // applied already
+            } else if (*str_tmp == "-stdin") {
+                // applied already
+            } else if (*str_tmp == "-source") {
+                if (i + 1 < argc) {
+                    f.s_source_addresses = argv[++i];
+                }
+            } else if (*str_tmp == "-max-duration") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    f.i_max_duration = static_cast<int>(std::strtol(argv[++i], nullptr, 10));
+                }
+            } else if (*str_tmp == "-filtered-cutoff") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    f.i_filtered_cutoff = static_cast<int>(std::strtol(argv[++i], nullptr, 10));
+                }
+            } else if (*str_tmp == "-udp-threads") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    long l_tmp = std::strtol(argv[++i], nullptr, 10);
+
+                    if (l_tmp > 0) {
+                        f.i_udp_thread_count = static_cast<int>(l_tmp);
+                    }
+                }
             } else if (*str_tmp == "-crazy") {
-                f.b_each_in_new_thread = true;
+                f.b_coroutines = true;
+            } else if (*str_tmp == "-max-probes") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    long l_tmp = std::strtol(argv[++i], nullptr, 10);
+
+                    if (l_tmp > 0) {
+                        f.i_max_probes = static_cast<int>(l_tmp);
+                    }
+                }
+            } else if (*str_tmp == "-per-core") {
+                f.b_per_core = true;
+            } else if (*str_tmp == "-numa") {
+                f.b_per_core = true;
+                f.b_numa = true;
+            } else if (*str_tmp == "-rate") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    long l_tmp = std::strtol(argv[++i], nullptr, 10);
+
+                    if (l_tmp > 0) {
+                        f.i_rate = static_cast<int>(l_tmp);
+                    }
+                }
+            } else if (*str_tmp == "-daemon") {
+                if (i + 1 < argc) {
+                    s_daemon_socket = argv[++i];
+                }
+            } else if (*str_tmp == "-checkpoint") {
+                if (i + 1 < argc) {
+                    f.s_checkpoint_file = argv[++i];
+                }
+            } else if (*str_tmp == "-checkpoint-interval") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    long l_tmp = std::strtol(argv[++i], nullptr, 10);
+
+                    if (l_tmp > 0) {
+                        f.i_checkpoint_interval = static_cast<int>(l_tmp);
+                    }
+                }
+            } else if (*str_tmp == "-resume") {
+                f.b_resume = true;
+            } else if (*str_tmp == "-shard") {
+                if (i + 1 < argc) {
+                    uint64_t seed = f.sh_shard.getSeed();
+
+                    if (!scanner::Shard::parse(argv[i + 1], f.sh_shard)) {
+                        std::cerr << "WARNING: Invalid shard `" << argv[i + 1] << "`, expected i/N\n";
+                    }
+                    f.sh_shard.setSeed(seed);
+                    i++;
+                }
+            } else if (*str_tmp == "-shard-seed") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    f.sh_shard.setSeed(std::strtoull(argv[++i], nullptr, 10));
+                }
+            } else if (*str_tmp == "-banners") {
+                f.b_banners = true;
+            } else if (*str_tmp == "-banner-timeout") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    get_timeout(argv, i, f.t_banner_timeout);
+                    i++;
+                }
+            } else if (*str_tmp == "-banner-concurrency") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    long l_tmp = std::strtol(argv[++i], nullptr, 10);
+
+                    if (l_tmp > 0) {
+                        f.i_banner_concurrency = static_cast<int>(l_tmp);
+                    }
+                }
+            } else if (*str_tmp == "-batch") {
+                f.b_batch = true;
+            } else if (*str_tmp == "-ring") {
+                if (i + 1 < argc) {
+                    f.s_ring_interface = argv[++i];
+                    f.b_batch = true;
+                }
+            } else if (*str_tmp == "-metrics") {
+                if (i + 1 < argc) {
+                    f.s_metrics_file = argv[++i];
+                }
+            } else if (*str_tmp == "-metrics-port") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    long l_tmp = std::strtol(argv[++i], nullptr, 10);
+
+                    if (l_tmp > 0 && l_tmp <= 65535) {
+                        f.i_metrics_port = static_cast<uint16_t>(l_tmp);
+                    }
+                }
+            } else if (*str_tmp == "-progress") {
+                f.b_progress = true;
+            } else if (*str_tmp == "-progress-interval") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    long l_tmp = std::strtol(argv[++i], nullptr, 10);
+
+                    if (l_tmp > 0) {
+                        f.i_progress_interval = static_cast<int>(l_tmp);
+                        f.b_progress = true;
+                    }
+                }
+            } else if (*str_tmp == "-trace") {
+                if (i + 1 < argc) {
+                    f.s_trace_file = argv[++i];
+                }
+            } else if (*str_tmp == "-capture") {
+                if (i + 1 < argc) {
+                    f.s_capture_file = argv[++i];
+                }
+            } else if (*str_tmp == "-capture-snaplen") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    long l_tmp = std::strtol(argv[++i], nullptr, 10);
+
+                    if (l_tmp > 0 && l_tmp <= CAPTURE_MAX_SNAPLEN) {
+                        f.i_capture_snaplen = static_cast<int>(l_tmp);
+                    }
+                }
+            } else if (*str_tmp == "-capture-sample") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    long l_tmp = std::strtol(argv[++i], nullptr, 10);
+
+                    if (l_tmp > 0) {
+                        f.i_capture_sample = static_cast<int>(l_tmp);
+                    }
+                }
+            } else if (*str_tmp == "-baseline") {
+                if (i + 1 < argc) {
+                    f.s_baseline_file = argv[++i];
+                }
+            } else if (*str_tmp == "-sample") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    long l_tmp = std::strtol(argv[++i], nullptr, 10);
+
+                    if (l_tmp >= 0 && l_tmp <= 100) {
+                        f.i_sample_percent = static_cast<int>(l_tmp);
+                    }
+                }
+            } else if (*str_tmp == "-sample-seed") {
+                if (i + 1 < argc && is_number(argv[i + 1])) {
+                    f.i_sample_seed = std::strtoull(argv[++i], nullptr, 10);
+                }
+            } else if (*str_tmp == "-no-payloads") {
+                f.b_udp_payloads = false;
+            } else if (*str_tmp == "o") {
+                if (i + 1 < argc) {
+                    f.s_output_file = argv[++i];
+                }
+            } else if (*str_tmp == "-journal") {
+                if (i + 1 < argc) {
+                    f.s_journal_file = argv[++i];
+                }
             } else {
                 std::cerr << "WARNING: Useless argument `" << argv[i] << "`\n";
             }
@@ -169,20 +471,53 @@ int main(int argc, char** argv) {
 
     delete str_tmp;
 
+    if (f.b_resume && f.s_checkpoint_file.empty()) {
+        f.s_checkpoint_file = "portscan.state";
+    }
+
     if (help_flag) {
         return 0;
     }
 
-    if(!s_ip.empty() && !s_mask.empty()) {
+    if (!s_daemon_socket.empty()) {
+#ifdef __linux__
+        try {
+            scanner::Daemon daemon(s_daemon_socket, f);
+
+            running_daemon = &daemon;
+            std::signal(SIGINT, on_interrupt);
+            std::signal(SIGTERM, on_interrupt);
+
+            daemon.run();
+
+            std::signal(SIGINT, SIG_DFL);
+            std::signal(SIGTERM, SIG_DFL);
+            running_daemon = nullptr;
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+#else
+        std::cerr << "ERROR: --daemon is supported only on Linux..\n";
+#endif
+    } else if((!s_ip.empty() && !s_mask.empty()) || f.b_stdin) {
+        if (f.b_stdin) {
+            // hosts come with the pairs, the range isn't used
+            s_ip = "0.0.0.0";
+            s_mask = "/32";
+        }
+
         try {
             portScanner = new scanner::PortScanner(s_ip, s_mask, f);
-            if (f.b_threads) {
-                portScanner->scan();
-            } else if (f.b_threads) {
-                portScanner->no_threads_scan();
-            } else {
-                portScanner->crazy_scan();
-            }
+
+            running_scan = portScanner;
+            std::signal(SIGINT, on_interrupt);
+            std::signal(SIGTERM, on_interrupt);
+
+            portScanner->scan(); // picks the right mode from flags
+
+            std::signal(SIGINT, SIG_DFL);
+            std::signal(SIGTERM, SIG_DFL);
+            running_scan = nullptr;
         } catch (const std::exception& e) {
             std::cerr << e.what() << std::endl;
         }
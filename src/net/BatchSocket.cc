@@ -0,0 +1,163 @@
+/**
+ * BatchSocket.cc
+ * 
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ * 
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "BatchSocket.h"
+
+#include <cstring>
+#include <cerrno>
+
+#ifdef __linux__
+#   include <sys/uio.h>
+#   define HAS_MMSG
+#endif
+
+#define SOCKET_BUFFER (4 * 1024 * 1024) // replies of a whole batch have to fit
+
+namespace scanner::net {
+
+    BatchSocket::BatchSocket(int protocol, bool header_included)
+            : tx_buffers(BATCH_SIZE * BATCH_SLOT_SIZE), tx_addresses(BATCH_SIZE), tx_sizes(BATCH_SIZE),
+              rx_buffers(BATCH_SIZE * BATCH_SLOT_SIZE) {
+        int on = 1;
+        int buffer_size = SOCKET_BUFFER;
+
+        fd = socket(AF_INET, SOCK_RAW, protocol);
+        if (fd < 0)
+            return;
+
+        if (header_included)
+            setsockopt(fd, IPPROTO_IP, IP_HDRINCL, &on, sizeof(on));
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    BatchSocket::~BatchSocket() {
+        if (fd >= 0) {
+            flush();
+            close(fd);
+        }
+    }
+
+    uint8_t* BatchSocket::next() {
+        if (tx_count == BATCH_SIZE)
+            flush();
+        return &tx_buffers[tx_count * BATCH_SLOT_SIZE];
+    }
+
+    void BatchSocket::commit(size_t size, uint32_t destination) {
+        sockaddr_in& addr = tx_addresses[tx_count];
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = destination;
+
+        tx_sizes[tx_count] = size;
+        tx_count++;
+
+        if (tx_count == BATCH_SIZE)
+            flush();
+    }
+
+    void BatchSocket::send(const uint8_t* packet, size_t size, uint32_t destination) {
+        if (size > BATCH_SLOT_SIZE)
+            return;
+
+        memcpy(next(), packet, size);
+        commit(size, destination);
+    }
+
+    size_t BatchSocket::flush() {
+        size_t done = 0;
+
+#ifdef HAS_MMSG
+        mmsghdr msgs[BATCH_SIZE];
+        iovec iovs[BATCH_SIZE];
+
+        memset(msgs, 0, sizeof(msgs));
+        for (size_t i = 0; i < tx_count; i++) {
+            iovs[i].iov_base = &tx_buffers[i * BATCH_SLOT_SIZE];
+            iovs[i].iov_len = tx_sizes[i];
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &tx_addresses[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        }
+
+        while (done < tx_count) {
+            int res = sendmmsg(fd, msgs + done, tx_count - done, 0);
+            send_calls++;
+
+            if (res < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                    // socket buffer is full - wait until it drains
+                    fd_set fds;
+                    FD_ZERO(&fds);
+                    FD_SET(fd, &fds);
+                    select(fd + 1, nullptr, &fds, nullptr, nullptr);
+                    continue;
+                }
+                break; // packets are lost, the port will be retried
+            }
+            done += res;
+        }
+#else
+        for (; done < tx_count; done++) {
+            sendto(fd, &tx_buffers[done * BATCH_SLOT_SIZE], tx_sizes[done], 0,
+                   reinterpret_cast<sockaddr*>(&tx_addresses[done]), sizeof(sockaddr_in));
+            send_calls++;
+        }
+#endif
+
+        sent += done;
+        tx_count = 0;
+        return done;
+    }
+
+    size_t BatchSocket::receive(const receiver& on_packet, size_t max) {
+        size_t total = 0;
+
+#ifdef HAS_MMSG
+        mmsghdr msgs[BATCH_SIZE];
+        iovec iovs[BATCH_SIZE];
+
+        while (total < max) {
+            memset(msgs, 0, sizeof(msgs));
+            for (size_t i = 0; i < BATCH_SIZE; i++) {
+                iovs[i].iov_base = &rx_buffers[i * BATCH_SLOT_SIZE];
+                iovs[i].iov_len = BATCH_SLOT_SIZE;
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            int res = recvmmsg(fd, msgs, BATCH_SIZE, MSG_DONTWAIT, nullptr);
+            if (res <= 0)
+                break;
+
+            for (int i = 0; i < res; i++)
+                on_packet(&rx_buffers[i * BATCH_SLOT_SIZE], msgs[i].msg_len);
+            total += res;
+
+            if (res < BATCH_SIZE)
+                break; // nothing more waiting
+        }
+#else
+        while (total < max) {
+            ssize_t res = recv(fd, rx_buffers.data(), BATCH_SLOT_SIZE, MSG_DONTWAIT);
+            if (res <= 0)
+                break;
+            on_packet(rx_buffers.data(), res);
+            total++;
+        }
+#endif
+
+        return total;
+    }
+}
@@ -0,0 +1,86 @@
+/**
+ * BatchSocket.h
+ * 
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ * 
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Raw socket, which sends and receives many packets per system call
+ * (sendmmsg / recvmmsg on Linux). Packets are queued in a fixed array
+ * of slots and sent together, when the array is full or on flush().
+ * On systems without these calls, it falls back to sendto / recvfrom.
+*/
+
+#ifndef PORTSCAN_BATCHSOCKET_H
+#define PORTSCAN_BATCHSOCKET_H
+
+#include "IpAddress.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <functional>
+
+#define BATCH_SIZE 64 // packets per system call
+#define BATCH_SLOT_SIZE 2048 // max size of one packet
+
+namespace scanner::net {
+
+    class BatchSocket {
+    public:
+        typedef std::function<void(const uint8_t* packet, size_t size)> receiver;
+    private:
+        int fd = -1;
+
+        // outgoing packets
+        std::vector<uint8_t> tx_buffers;
+        std::vector<sockaddr_in> tx_addresses;
+        std::vector<size_t> tx_sizes;
+        size_t tx_count = 0;
+
+        // incoming packets
+        std::vector<uint8_t> rx_buffers;
+
+        size_t sent = 0, send_calls = 0;
+    public:
+        /**
+         * @param protocol IPPROTO_UDP, IPPROTO_ICMP, ...
+         * @param header_included packets given to send() start with IP header
+        */
+        BatchSocket(int protocol, bool header_included);
+        ~BatchSocket();
+
+        BatchSocket(const BatchSocket&) = delete;
+        BatchSocket& operator=(const BatchSocket&) = delete;
+
+        bool isOpen() const { return fd >= 0; }
+        int getFd() const { return fd; }
+
+        /**
+         * Slot for the next packet - write it there and call commit().
+         * Queue is flushed first, if it's full.
+        */
+        uint8_t* next();
+        void commit(size_t size, uint32_t destination);
+
+        void send(const uint8_t* packet, size_t size, uint32_t destination);
+
+        /**
+         * Send all queued packets.
+         * @return number of packets sent
+        */
+        size_t flush();
+
+        /**
+         * Read waiting packets without blocking.
+         * @return number of packets read (at most max)
+        */
+        size_t receive(const receiver& on_packet, size_t max = BATCH_SIZE * 16);
+
+        size_t getSent() const { return sent; }
+        size_t getSendCalls() const { return send_calls; }
+    };
+}
+
+#endif //PORTSCAN_BATCHSOCKET_H
@@ -0,0 +1,113 @@
+/**
+ * Checksum.cc
+ * 
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ * 
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "Checksum.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <immintrin.h>
+#   define PORTSCAN_X86
+#endif
+
+// below this size vector setup costs more, than it gives
+#define SIMD_THRESHOLD 64
+
+namespace scanner::net {
+
+    static uint64_t sum_scalar(const uint8_t* p, size_t len, uint64_t sum) {
+        uint16_t word = 0;
+
+        for (; len >= 2; len -= 2, p += 2) {
+            memcpy(&word, p, 2); // unaligned access
+            sum += word;
+        }
+
+        if (len) { // odd byte is padded with zero
+            word = 0;
+            memcpy(&word, p, 1);
+            sum += word;
+        }
+        return sum;
+    }
+
+#ifdef PORTSCAN_X86
+    // 16-bit words are widened to 32-bit lanes, so every lane can take
+    // 65537 additions before it overflows - the buffer is cut into chunks
+    // small enough, that it never happens.
+    static uint64_t sum_sse2(const uint8_t* p, size_t len, uint64_t sum) {
+        const __m128i zero = _mm_setzero_si128();
+
+        while (len >= 16) {
+            size_t blocks = len / 16 > 32768 ? 32768 : len / 16;
+            __m128i acc = zero;
+
+            for (size_t i = 0; i < blocks; i++, p += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+                acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+            }
+            len -= blocks * 16;
+
+            uint32_t lanes[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+            sum += static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+        }
+        return sum_scalar(p, len, sum);
+    }
+
+    __attribute__((target("avx2")))
+    static uint64_t sum_avx2(const uint8_t* p, size_t len, uint64_t sum) {
+        const __m256i zero = _mm256_setzero_si256();
+
+        while (len >= 32) {
+            size_t blocks = len / 32 > 32768 ? 32768 : len / 32;
+            __m256i acc = zero;
+
+            for (size_t i = 0; i < blocks; i++, p += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+                acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+                acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+            }
+            len -= blocks * 32;
+
+            uint32_t lanes[8];
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+            for (auto lane : lanes)
+                sum += lane;
+        }
+        return sum_sse2(p, len, sum);
+    }
+
+    static bool has_avx2() {
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        return avx2;
+    }
+#endif
+
+    uint32_t checksumAdd(const void* data, size_t len, uint32_t sum) {
+        auto* p = static_cast<const uint8_t*>(data);
+        uint64_t sum64 = sum;
+
+#ifdef PORTSCAN_X86
+        if (len >= SIMD_THRESHOLD) {
+            sum64 = has_avx2() ? sum_avx2(p, len, sum64) : sum_sse2(p, len, sum64);
+        } else {
+            sum64 = sum_scalar(p, len, sum64);
+        }
+#else
+        sum64 = sum_scalar(p, len, sum64);
+#endif
+
+        // fold 64 -> 32 bits, carries go back to the lowest bits
+        while (sum64 >> 32)
+            sum64 = (sum64 & 0xffffffff) + (sum64 >> 32);
+        return static_cast<uint32_t>(sum64);
+    }
+}
@@ -0,0 +1,63 @@
+/**
+ * Checksum.h
+ * 
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ * 
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Internet checksum (RFC 1071) - ones' complement sum of 16-bit words.
+ *
+ * The sum doesn't depend on the byte order of the machine, as long as
+ * words are read and written in the same (native) order, so no
+ * conversions are needed. Long buffers are summed with SSE2/AVX2.
+*/
+
+#ifndef PORTSCAN_CHECKSUM_H
+#define PORTSCAN_CHECKSUM_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace scanner::net {
+
+    /**
+     * Partial (not complemented) sum of the buffer, added to sum.
+     * Buffer length should be even, except for the last part of the packet.
+    */
+    uint32_t checksumAdd(const void* data, size_t len, uint32_t sum = 0);
+
+    /**
+     * Fold the partial sum to 16 bits and complement it.
+    */
+    inline uint16_t checksumFinish(uint32_t sum) {
+        sum = (sum >> 16) + (sum & 0xffff);
+        sum += (sum >> 16);
+        return static_cast<uint16_t>(~sum);
+    }
+
+    inline uint16_t checksum(const void* data, size_t len) {
+        return checksumFinish(checksumAdd(data, len));
+    }
+
+    /**
+     * RFC 1624 (eqn. 3) incremental update: HC' = ~(~HC + ~m + m')
+     * for one 16-bit word changed from old_word to new_word.
+    */
+    inline uint16_t checksumUpdate16(uint16_t check, uint16_t old_word, uint16_t new_word) {
+        uint32_t sum = static_cast<uint16_t>(~check) + static_cast<uint32_t>(static_cast<uint16_t>(~old_word)) + new_word;
+        sum = (sum >> 16) + (sum & 0xffff);
+        sum += (sum >> 16);
+        return static_cast<uint16_t>(~sum);
+    }
+
+    /**
+     * The same as above, for a 32-bit field (eg. IP address).
+    */
+    inline uint16_t checksumUpdate32(uint16_t check, uint32_t old_value, uint32_t new_value) {
+        check = checksumUpdate16(check, static_cast<uint16_t>(old_value >> 16), static_cast<uint16_t>(new_value >> 16));
+        return checksumUpdate16(check, static_cast<uint16_t>(old_value), static_cast<uint16_t>(new_value));
+    }
+}
+
+#endif //PORTSCAN_CHECKSUM_H
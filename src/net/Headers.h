@@ -0,0 +1,74 @@
+/**
+ * Headers.h
+ * 
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ * 
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Headers of raw packets sent and received by the scanner.
+*/
+
+#ifndef PORTSCAN_HEADERS_H
+#define PORTSCAN_HEADERS_H
+
+#include <cstdint>
+
+#include "IpAddress.h"
+
+namespace scanner::net {
+
+    struct ethHeader {
+        uint8_t destination[6];
+        uint8_t source[6];
+        uint16_t type; // 0x0800 for IPv4 (network byte order)
+    } __attribute__((packed));
+
+    struct ipHeader {
+        // there is possility of default initialization of bit fields, but it requires C++20 standard,
+        // so we have to remember to initialize the bit fields manually (with zeros)
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+        uint8_t ihl:4;
+        uint8_t version:4;
+#elif __BYTE_ORDER == __BIG_ENDIAN
+        uint8_t version:4;
+        uint8_t ihl:4;
+#endif
+        uint8_t tos = 16; // small delay
+        uint16_t len = 0; // pkg size
+        uint16_t id = htons(54321);
+        uint16_t flag_off = 0;
+        uint8_t ttl = 64; // time to live
+        uint8_t protocol = 17; // UDP (diagram protocol)
+        uint16_t checksum = 0;
+        uint32_t sourceIp = 0;
+        uint32_t destination = 0;
+    };
+
+    struct udpHeader {
+        uint16_t sourcePort = 0;
+        uint16_t destinationPort = 0;
+        uint16_t len = 0;
+        uint16_t checksum = 0;
+    };
+
+    struct icmpHeader {
+        uint8_t type; // msg type
+        uint8_t code;
+        uint16_t checksum;
+        // based on linux kernel implementation:
+        union {
+            struct {
+                uint16_t id;
+                uint16_t sequence;
+            } echo;
+            uint32_t gateway;
+            struct {
+                uint16_t unused;
+                uint16_t mtu;
+            } frag;
+        } unused;
+    };
+}
+
+#endif //PORTSCAN_HEADERS_H
@@ -114,8 +114,9 @@ namespace scanner::net {
 
         bool operator!=(const IpAddress& B) const { return this->addrIpv4.num != B.addrIpv4.num; }
         bool operator==(const IpAddress& B) const { return this->addrIpv4.num == B.addrIpv4.num; }
-        bool operator>=(const IpAddress& B) const { return this->addrIpv4.num >= B.addrIpv4.num; }
-        bool operator<=(const IpAddress& B) const { return this->addrIpv4.num <= B.addrIpv4.num; }
+        // ordering has to be checked in host byte order, otherwise 10.0.1.0 < 10.0.0.255
+        bool operator>=(const IpAddress& B) const { return this->getAsNetNumber() >= B.getAsNetNumber(); }
+        bool operator<=(const IpAddress& B) const { return this->getAsNetNumber() <= B.getAsNetNumber(); }
     };
 
 }
@@ -0,0 +1,359 @@
+/**
+ * PacketRing.cc
+ * 
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ * 
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "PacketRing.h"
+#include "Headers.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <thread>
+#include <chrono>
+
+#include <sys/mman.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#define TX_BLOCK_SIZE (1 << 18)
+#define TX_BLOCK_COUNT 16
+#define TX_FRAME_SIZE 2048 // BATCH_SLOT_SIZE fits, with Ethernet and ring headers
+
+#define RX_BLOCK_SIZE (1 << 20)
+#define RX_BLOCK_COUNT 16
+#define RX_FRAME_SIZE 2048
+#define RX_BLOCK_TIMEOUT 10 // ms, after which a block is given to us, even if not full
+
+namespace scanner::net {
+
+    // data of TX frame starts right after the ring header
+    static const size_t TX_DATA_OFFSET = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+
+    static bool interface_info(const std::string& interface, int& index, uint8_t* mac, bool& loopback) {
+        struct ifreq ifr{};
+        int s = socket(AF_INET, SOCK_DGRAM, 0);
+        bool ok = false;
+
+        if (s < 0)
+            return false;
+
+        strncpy(ifr.ifr_name, interface.c_str(), IFNAMSIZ - 1);
+        if (ioctl(s, SIOCGIFINDEX, &ifr) == 0) {
+            index = ifr.ifr_ifindex;
+            ok = true;
+        }
+        if (ok && ioctl(s, SIOCGIFHWADDR, &ifr) == 0) {
+            memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+        }
+        if (ok && ioctl(s, SIOCGIFFLAGS, &ifr) == 0) {
+            loopback = (ifr.ifr_flags & IFF_LOOPBACK) != 0;
+        }
+
+        close(s);
+        return ok;
+    }
+
+    /**
+     * Gateway from /proc/net/route for the address, or the address itself,
+     * if it's in the local network of the interface.
+    */
+    static uint32_t next_hop_for(const std::string& interface, uint32_t address) {
+        std::ifstream f("/proc/net/route");
+        std::string line, name;
+        uint32_t best = address;
+        int best_bits = -1;
+
+        std::getline(f, line); // header
+        while (std::getline(f, line)) {
+            std::istringstream ss(line);
+            std::string s_dest, s_gateway, s_flags, s_refcnt, s_use, s_metric, s_mask;
+
+            if (!(ss >> name >> s_dest >> s_gateway >> s_flags >> s_refcnt >> s_use >> s_metric >> s_mask) || name != interface)
+                continue;
+
+            // values are printed as they are in memory - like IpAddress stores them
+            auto dest = static_cast<uint32_t>(std::strtoul(s_dest.c_str(), nullptr, 16));
+            auto gateway = static_cast<uint32_t>(std::strtoul(s_gateway.c_str(), nullptr, 16));
+            auto mask = static_cast<uint32_t>(std::strtoul(s_mask.c_str(), nullptr, 16));
+            int bits = __builtin_popcount(mask);
+
+            if ((address & mask) == dest && bits > best_bits) {
+                best_bits = bits;
+                best = gateway != 0 ? gateway : address;
+            }
+        }
+        return best;
+    }
+
+    static bool arp_lookup(const std::string& interface, uint32_t address, uint8_t* mac) {
+        std::ifstream f("/proc/net/arp");
+        std::string line, s_ip, s_type, s_flags, s_mac, s_mask, s_dev;
+        std::string wanted = IpAddress(address).getAsString();
+
+        std::getline(f, line); // header
+        while (f >> s_ip >> s_type >> s_flags >> s_mac >> s_mask >> s_dev) {
+            unsigned int b[6];
+
+            if (s_ip != wanted || s_dev != interface || s_mac == "00:00:00:00:00:00")
+                continue;
+
+            if (sscanf(s_mac.c_str(), "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) == 6) {
+                for (int i = 0; i < 6; i++)
+                    mac[i] = static_cast<uint8_t>(b[i]);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool sysctl_on(const std::string& interface, const std::string& name) {
+        std::ifstream f("/proc/sys/net/ipv4/conf/" + interface + "/" + name);
+        int value = 0;
+
+        return (f >> value) && value != 0;
+    }
+
+    static bool resolve_mac(const std::string& interface, uint32_t address, uint8_t* mac) {
+        for (int tries = 0; tries < 5; tries++) {
+            if (arp_lookup(interface, address, mac))
+                return true;
+
+            // not in the cache yet - let the kernel ask for it
+            struct sockaddr_in addr{0};
+            int s = socket(AF_INET, SOCK_DGRAM, 0);
+
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = address;
+            addr.sin_port = htons(9); // discard
+            sendto(s, "", 0, 0, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+            close(s);
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+        return false;
+    }
+
+    PacketRing::PacketRing(const std::string& interface, uint32_t next_hop) {
+        bool loopback = false;
+
+        if (!interface_info(interface, if_index, source_mac, loopback)) {
+            std::cerr << "ERROR: Unknown interface `" << interface << "`\n";
+            return;
+        }
+
+        // frames written into the TX ring of loopback come in without a route - with
+        // source 127.0.0.1 they are martians, unless the interface accepts them
+        if (loopback && !(sysctl_on(interface, "accept_local")
+                          && (sysctl_on(interface, "route_localnet") || sysctl_on("all", "route_localnet")))) {
+            std::cerr << "ERROR: Packet rings on `" << interface << "` need sysctl -w net.ipv4.conf." << interface
+                      << ".accept_local=1 net.ipv4.conf." << interface << ".route_localnet=1\n";
+            return;
+        }
+
+        // loopback doesn't care about MAC addresses
+        if (!loopback) {
+            uint32_t hop = next_hop_for(interface, next_hop);
+
+            if (!resolve_mac(interface, hop, gateway_mac)) {
+                std::cerr << "ERROR: Cannot find MAC address of " << IpAddress(hop).getAsString()
+                          << " on " << interface << "\n";
+                return;
+            }
+        }
+
+        if (!setupTx() || !setupRx()) {
+            std::cerr << "ERROR: Cannot create packet rings on " << interface << " (root required)\n";
+        }
+    }
+
+    PacketRing::~PacketRing() {
+        if (tx_ring != nullptr) {
+            flush();
+            munmap(tx_ring, tx_ring_size);
+        }
+        if (rx_ring != nullptr)
+            munmap(rx_ring, rx_ring_size);
+        if (tx_fd >= 0)
+            close(tx_fd);
+        if (rx_fd >= 0)
+            close(rx_fd);
+    }
+
+    bool PacketRing::setupTx() {
+        int version = TPACKET_V2;
+        int on = 1;
+        struct tpacket_req req{};
+        struct sockaddr_ll ll{};
+
+        tx_fd = socket(AF_PACKET, SOCK_RAW, 0); // protocol 0 - never receives
+        if (tx_fd < 0)
+            return false;
+
+        if (setsockopt(tx_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0)
+            return false;
+        // our frames don't need traffic shaping
+        setsockopt(tx_fd, SOL_PACKET, PACKET_QDISC_BYPASS, &on, sizeof(on));
+
+        req.tp_block_size = TX_BLOCK_SIZE;
+        req.tp_block_nr = TX_BLOCK_COUNT;
+        req.tp_frame_size = TX_FRAME_SIZE;
+        req.tp_frame_nr = (TX_BLOCK_SIZE / TX_FRAME_SIZE) * TX_BLOCK_COUNT;
+        if (setsockopt(tx_fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) != 0)
+            return false;
+
+        tx_ring_size = static_cast<size_t>(req.tp_block_size) * req.tp_block_nr;
+        tx_frame_size = req.tp_frame_size;
+        tx_frame_count = req.tp_frame_nr;
+
+        void* ring = mmap(nullptr, tx_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, tx_fd, 0);
+        if (ring == MAP_FAILED)
+            return false;
+        tx_ring = static_cast<uint8_t*>(ring);
+
+        ll.sll_family = AF_PACKET;
+        ll.sll_protocol = htons(ETH_P_IP);
+        ll.sll_ifindex = if_index;
+        return bind(tx_fd, reinterpret_cast<sockaddr*>(&ll), sizeof(ll)) == 0;
+    }
+
+    bool PacketRing::setupRx() {
+        int version = TPACKET_V3;
+        struct tpacket_req3 req{};
+        struct sockaddr_ll ll{};
+
+        rx_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+        if (rx_fd < 0)
+            return false;
+
+        if (setsockopt(rx_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0)
+            return false;
+
+        req.tp_block_size = RX_BLOCK_SIZE;
+        req.tp_block_nr = RX_BLOCK_COUNT;
+        req.tp_frame_size = RX_FRAME_SIZE;
+        req.tp_frame_nr = (RX_BLOCK_SIZE / RX_FRAME_SIZE) * RX_BLOCK_COUNT;
+        req.tp_retire_blk_tov = RX_BLOCK_TIMEOUT;
+        if (setsockopt(rx_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0)
+            return false;
+
+        rx_ring_size = static_cast<size_t>(req.tp_block_size) * req.tp_block_nr;
+        rx_block_size = req.tp_block_size;
+        rx_block_count = req.tp_block_nr;
+
+        void* ring = mmap(nullptr, rx_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, rx_fd, 0);
+        if (ring == MAP_FAILED)
+            ring = mmap(nullptr, rx_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, rx_fd, 0);
+        if (ring == MAP_FAILED)
+            return false;
+        rx_ring = static_cast<uint8_t*>(ring);
+
+        ll.sll_family = AF_PACKET;
+        ll.sll_protocol = htons(ETH_P_IP);
+        ll.sll_ifindex = if_index;
+        return bind(rx_fd, reinterpret_cast<sockaddr*>(&ll), sizeof(ll)) == 0;
+    }
+
+    uint8_t* PacketRing::next() {
+        auto* hdr = reinterpret_cast<tpacket2_hdr*>(txFrame(tx_current));
+
+        // the ring is full - the kernel hasn't sent this frame yet
+        while (hdr->tp_status != TP_STATUS_AVAILABLE) {
+            if (hdr->tp_status & TP_STATUS_WRONG_FORMAT) {
+                hdr->tp_status = TP_STATUS_AVAILABLE; // dropped by the kernel
+                break;
+            }
+
+            flush();
+            pollfd fd = {tx_fd, POLLOUT, 0};
+            poll(&fd, 1, 10);
+        }
+
+        return txFrame(tx_current) + TX_DATA_OFFSET + sizeof(ethHeader);
+    }
+
+    void PacketRing::commit(size_t size, uint32_t destination) {
+        uint8_t* frame = txFrame(tx_current);
+        auto* hdr = reinterpret_cast<tpacket2_hdr*>(frame);
+        auto* eth = reinterpret_cast<ethHeader*>(frame + TX_DATA_OFFSET);
+
+        (void) destination; // every destination is behind the same next hop
+        memcpy(eth->destination, gateway_mac, 6);
+        memcpy(eth->source, source_mac, 6);
+        eth->type = htons(ETH_P_IP);
+
+        hdr->tp_len = static_cast<uint32_t>(size + sizeof(ethHeader));
+        __sync_synchronize(); // frame has to be complete, before the kernel sees it
+        hdr->tp_status = TP_STATUS_SEND_REQUEST;
+
+        tx_current = (tx_current + 1) % tx_frame_count;
+        if (++tx_queued >= BATCH_SIZE)
+            flush();
+    }
+
+    void PacketRing::flush() {
+        if (tx_queued == 0)
+            return;
+
+        // one call sends every frame marked with TP_STATUS_SEND_REQUEST
+        send(tx_fd, nullptr, 0, MSG_DONTWAIT);
+        tx_queued = 0;
+    }
+
+    void PacketRing::receive(const receiver& on_packet) {
+        for (size_t blocks = 0; blocks < rx_block_count; blocks++) {
+            uint8_t* block = rx_ring + rx_current * rx_block_size;
+            auto* desc = reinterpret_cast<tpacket_block_desc*>(block);
+
+            if (!(desc->hdr.bh1.block_status & TP_STATUS_USER))
+                break; // kernel is still filling it
+
+            __sync_synchronize();
+
+            auto* ppd = reinterpret_cast<tpacket3_hdr*>(block + desc->hdr.bh1.offset_to_first_pkt);
+            for (uint32_t i = 0; i < desc->hdr.bh1.num_pkts; i++) {
+                auto* ll = reinterpret_cast<sockaddr_ll*>(reinterpret_cast<uint8_t*>(ppd) + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+
+                // copies of our own probes are outgoing
+                if (ll->sll_pkttype != PACKET_OUTGOING && ppd->tp_net >= ppd->tp_mac) {
+                    size_t link_size = ppd->tp_net - ppd->tp_mac;
+
+                    if (ppd->tp_snaplen > link_size)
+                        on_packet(reinterpret_cast<uint8_t*>(ppd) + ppd->tp_net, ppd->tp_snaplen - link_size);
+                }
+                ppd = reinterpret_cast<tpacket3_hdr*>(reinterpret_cast<uint8_t*>(ppd) + ppd->tp_next_offset);
+            }
+
+            __sync_synchronize();
+            desc->hdr.bh1.block_status = TP_STATUS_KERNEL; // give it back
+            rx_current = (rx_current + 1) % rx_block_count;
+        }
+    }
+
+    void PacketRing::getPollFds(std::vector<pollfd>& fds) const {
+        fds.push_back({rx_fd, POLLIN, 0});
+    }
+
+    uint32_t PacketRing::interfaceAddress(const std::string& interface) {
+        struct ifreq ifr{};
+        int s = socket(AF_INET, SOCK_DGRAM, 0);
+        uint32_t address = 0;
+
+        if (s < 0)
+            return 0;
+
+        strncpy(ifr.ifr_name, interface.c_str(), IFNAMSIZ - 1);
+        ifr.ifr_addr.sa_family = AF_INET;
+        if (ioctl(s, SIOCGIFADDR, &ifr) == 0)
+            address = reinterpret_cast<sockaddr_in*>(&ifr.ifr_addr)->sin_addr.s_addr;
+
+        close(s);
+        return address;
+    }
+}
@@ -0,0 +1,88 @@
+/**
+ * PacketRing.h
+ * 
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ * 
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Raw packets through AF_PACKET rings mapped into our memory (PACKET_MMAP).
+ * Probes are written with Ethernet header straight into a PACKET_TX_RING
+ * and the kernel is kicked once per batch. Replies are read in place
+ * from a TPACKET_V3 PACKET_RX_RING - the kernel fills whole blocks
+ * of frames, so there is no system call and no copy per packet.
+ *
+ * Linux only. Works on veth pairs and on loopback - but frames injected
+ * into `lo` have no route attached, so the kernel drops them as martians
+ * (127.0.0.1 source) unless the interface has accept_local and route_localnet
+ * set. Without them every port would look open|filtered, so it's refused.
+ *
+ * Testing without a network, as root (the README has the same steps):
+ *
+ *      ip netns add pstest
+ *      ip link add vpa type veth peer name vpb
+ *      ip link set vpb netns pstest
+ *      ip addr add 10.77.0.1/24 dev vpa && ip link set vpa up
+ *      ip netns exec pstest ip addr add 10.77.0.2/24 dev vpb
+ *      ip netns exec pstest ip link set vpb up
+ *      ip netns exec pstest sysctl -w net.ipv4.icmp_ratelimit=0
+ *      portscan 10.77.0.2 /32 -p 1 1000 -UDP --ring vpa     (the same as --batch)
+ *      ip netns del pstest                                   (removes vpa as well)
+*/
+
+#ifndef PORTSCAN_PACKETRING_H
+#define PORTSCAN_PACKETRING_H
+
+#include "RawTransport.h"
+
+#include <cstdint>
+#include <string>
+
+namespace scanner::net {
+
+    class PacketRing : public RawTransport {
+        int tx_fd = -1, rx_fd = -1;
+        int if_index = 0;
+
+        uint8_t* tx_ring = nullptr;
+        size_t tx_ring_size = 0;
+        size_t tx_frame_size = 0, tx_frame_count = 0;
+        size_t tx_current = 0;
+        size_t tx_queued = 0;
+
+        uint8_t* rx_ring = nullptr;
+        size_t rx_ring_size = 0;
+        size_t rx_block_size = 0, rx_block_count = 0;
+        size_t rx_current = 0;
+
+        uint8_t source_mac[6] = {0};
+        uint8_t gateway_mac[6] = {0}; // next hop for every destination
+
+        bool setupTx();
+        bool setupRx();
+        uint8_t* txFrame(size_t index) const { return tx_ring + index * tx_frame_size; }
+    public:
+        /**
+         * @param interface name of the interface (eg. eth0, veth, lo)
+         * @param next_hop address (as stored in IpAddress) of the first target,
+         *        used to find the MAC address packets are sent to
+        */
+        PacketRing(const std::string& interface, uint32_t next_hop);
+        ~PacketRing() override;
+
+        bool isOpen() const override { return tx_ring != nullptr && rx_ring != nullptr; }
+
+        uint8_t* next() override;
+        void commit(size_t size, uint32_t destination) override;
+        void flush() override;
+        void receive(const receiver& on_packet) override;
+        void getPollFds(std::vector<pollfd>& fds) const override;
+
+        /**
+         * IPv4 address of the interface (as stored in IpAddress), 0 if none.
+        */
+        static uint32_t interfaceAddress(const std::string& interface);
+    };
+}
+
+#endif //PORTSCAN_PACKETRING_H
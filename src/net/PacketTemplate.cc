@@ -0,0 +1,104 @@
+/**
+ * PacketTemplate.cc
+ * 
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ * 
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "PacketTemplate.h"
+#include "Checksum.h"
+
+#include <cstring>
+
+namespace scanner::net {
+
+    PacketTemplate::PacketTemplate(uint32_t source_ip, const uint8_t* payload, size_t payload_size)
+            : packet(sizeof(ipHeader) + sizeof(udpHeader) + payload_size, 0), source_ip(source_ip) {
+        auto* iph = reinterpret_cast<ipHeader*>(packet.data());
+        auto* udh = reinterpret_cast<udpHeader*>(packet.data() + sizeof(ipHeader));
+
+        // destination and ports are zero in the template,
+        // so the checksums are ready to be patched
+        iph->version = 4;
+        iph->ihl = 5;
+        iph->tos = 16; // short interval
+        iph->len = htons(static_cast<uint16_t>(packet.size()));
+        iph->id = htons(54321);
+        iph->flag_off = 0;
+        iph->ttl = 255;
+        iph->protocol = IPPROTO_UDP;
+        iph->sourceIp = source_ip;
+        iph->destination = 0;
+        iph->checksum = 0;
+        iph->checksum = checksum(iph, sizeof(ipHeader));
+
+        udh->sourcePort = 0;
+        udh->destinationPort = 0;
+        udh->len = htons(static_cast<uint16_t>(sizeof(udpHeader) + payload_size));
+        udh->checksum = 0;
+
+        if (payload_size > 0)
+            memcpy(packet.data() + sizeof(ipHeader) + sizeof(udpHeader), payload, payload_size);
+
+        if (source_ip != 0) {
+            // pseudo header: source, destination (0), zero + protocol, UDP length
+            uint16_t pseudo[2] = {htons(IPPROTO_UDP), udh->len};
+            uint32_t sum = checksumAdd(&source_ip, sizeof(source_ip));
+
+            sum = checksumAdd(pseudo, sizeof(pseudo), sum);
+            sum = checksumAdd(udh, sizeof(udpHeader) + payload_size, sum); // SIMD for long payloads
+            udh->checksum = checksumFinish(sum);
+        }
+    }
+
+    size_t PacketTemplate::build(uint8_t* out, uint32_t destination, uint16_t destination_port, uint16_t source_port) const {
+        memcpy(out, packet.data(), packet.size());
+
+        auto* iph = reinterpret_cast<ipHeader*>(out);
+        auto* udh = reinterpret_cast<udpHeader*>(out + sizeof(ipHeader));
+        uint16_t n_dport = htons(destination_port);
+        uint16_t n_sport = htons(source_port);
+
+        iph->destination = destination;
+        iph->checksum = checksumUpdate32(iph->checksum, 0, destination);
+
+        udh->destinationPort = n_dport;
+        udh->sourcePort = n_sport;
+
+        if (source_ip != 0) {
+            uint16_t check = udh->checksum;
+
+            check = checksumUpdate32(check, 0, destination); // pseudo header
+            check = checksumUpdate16(check, 0, n_dport);
+            check = checksumUpdate16(check, 0, n_sport);
+            udh->checksum = check == 0 ? 0xffff : check; // 0 means "no checksum"
+        }
+
+        return packet.size();
+    }
+
+    uint32_t PacketTemplate::sourceFor(uint32_t destination) {
+        struct sockaddr_in addr{0};
+        socklen_t len = sizeof(addr);
+        int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        uint32_t source = 0;
+
+        if (s < 0)
+            return 0;
+
+        // connecting UDP socket sends nothing, but picks the route
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = destination;
+        addr.sin_port = htons(9);
+
+        if (connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0
+            && getsockname(s, reinterpret_cast<sockaddr*>(&addr), &len) == 0) {
+            source = addr.sin_addr.s_addr;
+        }
+
+        close(s);
+        return source;
+    }
+}
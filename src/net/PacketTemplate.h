@@ -0,0 +1,56 @@
+/**
+ * PacketTemplate.h
+ * 
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ * 
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * IP + UDP probe built once per scan. For every probe it is copied
+ * and only destination address and ports are written in, with both
+ * checksums updated incrementally (RFC 1624) - no header is rebuilt
+ * and the payload is never summed again.
+*/
+
+#ifndef PORTSCAN_PACKETTEMPLATE_H
+#define PORTSCAN_PACKETTEMPLATE_H
+
+#include "Headers.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace scanner::net {
+
+    class PacketTemplate {
+        std::vector<uint8_t> packet; // ip header + udp header + payload
+        uint32_t source_ip = 0; // as stored in IpAddress, 0 = filled by the kernel
+    public:
+        /**
+         * @param source_ip without it, UDP checksum can't be computed and is left empty
+        */
+        PacketTemplate(uint32_t source_ip, const uint8_t* payload, size_t payload_size);
+
+        /**
+         * Write the probe to out (at least size() bytes).
+         *
+         * @param destination as stored in IpAddress
+         * @param destination_port in host byte order
+         * @param source_port in host byte order
+         * @return size of the packet
+        */
+        size_t build(uint8_t* out, uint32_t destination, uint16_t destination_port, uint16_t source_port) const;
+
+        size_t size() const { return packet.size(); }
+        uint32_t getSourceIp() const { return source_ip; }
+
+        /**
+         * Local address, which the kernel would use to reach the destination.
+         * @return 0 if there is no route
+        */
+        static uint32_t sourceFor(uint32_t destination);
+    };
+}
+
+#endif //PORTSCAN_PACKETTEMPLATE_H
@@ -0,0 +1,83 @@
+/**
+ * RawTransport.h
+ * 
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ * 
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * The way raw IP packets leave and enter the scanner.
+ * Probes are written straight into the transport (next() + commit())
+ * and replies are given back as IP packets, whatever is below.
+ *
+ *  - SocketTransport: raw sockets with sendmmsg / recvmmsg (BatchSocket)
+ *  - PacketRing: AF_PACKET memory mapped rings (Linux only)
+*/
+
+#ifndef PORTSCAN_RAWTRANSPORT_H
+#define PORTSCAN_RAWTRANSPORT_H
+
+#include "BatchSocket.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <functional>
+
+#include <poll.h>
+
+namespace scanner::net {
+
+    class RawTransport {
+    public:
+        typedef std::function<void(const uint8_t* ip_packet, size_t size)> receiver;
+
+        virtual ~RawTransport() = default;
+
+        virtual bool isOpen() const = 0;
+
+        /**
+         * Space for the next IP packet (at least BATCH_SLOT_SIZE bytes).
+        */
+        virtual uint8_t* next() = 0;
+        virtual void commit(size_t size, uint32_t destination) = 0;
+        virtual void flush() = 0;
+
+        /**
+         * Give all waiting IP packets to on_packet, without blocking.
+        */
+        virtual void receive(const receiver& on_packet) = 0;
+
+        /**
+         * Descriptors to poll() for incoming packets.
+        */
+        virtual void getPollFds(std::vector<pollfd>& fds) const = 0;
+    };
+
+    class SocketTransport : public RawTransport {
+        BatchSocket udp; // sends probes, receives UDP
+        BatchSocket icmp; // receives ICMP errors
+    public:
+        SocketTransport() : udp(IPPROTO_UDP, true), icmp(IPPROTO_ICMP, false) {}
+
+        bool isOpen() const override { return udp.isOpen(); }
+
+        uint8_t* next() override { return udp.next(); }
+        void commit(size_t size, uint32_t destination) override { udp.commit(size, destination); }
+        void flush() override { udp.flush(); }
+
+        void receive(const receiver& on_packet) override {
+            udp.receive(on_packet);
+            if (icmp.isOpen())
+                icmp.receive(on_packet);
+        }
+
+        void getPollFds(std::vector<pollfd>& fds) const override {
+            fds.push_back({udp.getFd(), POLLIN, 0});
+            if (icmp.isOpen())
+                fds.push_back({icmp.getFd(), POLLIN, 0});
+        }
+    };
+}
+
+#endif //PORTSCAN_RAWTRANSPORT_H
@@ -41,7 +41,7 @@ namespace scanner::net {
             counter++;
         }
 
-        std::cout << "Loaded " << counter << " known ports.." << std::endl;
+        this->known = counter; // printed by the scanner (not to stdout of --stdin)
 
         f.close();
     }
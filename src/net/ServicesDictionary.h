@@ -34,6 +34,7 @@ namespace scanner::net {
 
     class ServicesDictionary {
         bsd_leaf* tree = nullptr;
+        size_t known = 0; // ports loaded from the file
     public:
         ServicesDictionary() { this->loadDatabase("services"); }
         explicit ServicesDictionary(const std::string& filename) { this->loadDatabase(filename.c_str()); }
@@ -44,6 +45,7 @@ namespace scanner::net {
     public:
         bsd_leaf* getLeaf(key SEARCHED_KEY);
         std::string getService(key PORT, CONNECTION_TYPE protocol);
+        size_t size() const { return known; }
 
         void writeTree(const std::string& filename);
     private:
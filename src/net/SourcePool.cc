@@ -0,0 +1,98 @@
+/**
+ * SourcePool.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "SourcePool.h"
+
+#include <sstream>
+#include <cerrno>
+
+namespace scanner::net {
+
+    static bool to_address(const std::string& s, ipv4& address) {
+        in_addr a{};
+
+        if (inet_pton(AF_INET, s.c_str(), &a) != 1) {
+            return false;
+        }
+        address = a.s_addr;
+        return true;
+    }
+
+    bool SourcePool::parse(const std::string& list) {
+        std::istringstream ss(list);
+        std::string item;
+
+        while (std::getline(ss, item, ',')) {
+            auto dash = item.find('-');
+            ipv4 from = 0, to = 0;
+
+            if (!to_address(item.substr(0, dash), from)) {
+                return false;
+            }
+            if (dash == std::string::npos) {
+                to = from;
+            } else if (!to_address(item.substr(dash + 1), to)) {
+                return false;
+            }
+
+            // ranges are counted in host order
+            for (uint64_t a = ntohl(from); a <= ntohl(to); a++) {
+                if (addresses.size() >= SOURCE_POOL_MAX)
+                    return false;
+                addresses.push_back(htonl(static_cast<ipv4>(a)));
+            }
+        }
+        return !addresses.empty();
+    }
+
+    ipv4 SourcePool::check() const {
+        for (ipv4 address : addresses) {
+            struct sockaddr_in addr{};
+            auto s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            int res;
+
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = address;
+            res = ::bind(s, (struct sockaddr*)&addr, sizeof(addr));
+#ifdef _WIN32
+            closesocket(s);
+#else
+            close(s);
+#endif
+
+            if (res != 0) {
+                return address;
+            }
+        }
+        return 0;
+    }
+
+    int SourcePool::bind(int socket) {
+        struct sockaddr_in addr{};
+        int on = 1;
+
+        if (addresses.empty()) {
+            return 0;
+        }
+
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = addresses[next.fetch_add(1, std::memory_order_relaxed) % addresses.size()];
+
+#ifdef IP_BIND_ADDRESS_NO_PORT
+        setsockopt(socket, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+#else
+        (void) on; // the port is reserved by bind() - for any target
+#endif
+
+        if (::bind(socket, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            return errno;
+        }
+        return 0;
+    }
+}
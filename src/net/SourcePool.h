@@ -0,0 +1,62 @@
+/**
+ * SourcePool.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Local addresses, which TCP probes are sent from in turns.
+ *
+ * The kernel picks a free ephemeral port for every connect(), and
+ * a connection, which was open, keeps its port in TIME_WAIT for a minute.
+ * From one address a fast scan of big subnets runs out of the ~28k ports
+ * of the default range. A port is unique per (source, target) pair, so
+ * every address added to the pool brings the whole range again.
+ *
+ * Sockets are bound with IP_BIND_ADDRESS_NO_PORT - bind() takes only
+ * the address and the port is picked by connect(), when the target is
+ * known (without it bind() would reserve a port for any target).
+*/
+
+#ifndef PORTSCAN_SOURCEPOOL_H
+#define PORTSCAN_SOURCEPOOL_H
+
+#include "IpAddress.h"
+
+#include <vector>
+#include <string>
+#include <atomic>
+
+#define SOURCE_POOL_MAX 4096 // addresses
+
+namespace scanner::net {
+    class SourcePool {
+        std::vector<ipv4> addresses; // network order
+        std::atomic<size_t> next{0};
+    public:
+        SourcePool() = default;
+
+        /**
+         * @param list addresses and ranges, eg. `10.0.0.1,10.0.0.8-10.0.0.15`
+         * @return false, if any of them is invalid
+        */
+        bool parse(const std::string& list);
+
+        /**
+         * @return the first address, which can't be bound on this machine, 0 = all can
+        */
+        ipv4 check() const;
+
+        /**
+         * Binds the socket to the next address of the pool.
+         * @return 0 or errno of the failure
+        */
+        int bind(int socket);
+
+        size_t size() const { return addresses.size(); }
+        bool empty() const { return addresses.empty(); }
+    };
+}
+
+#endif //PORTSCAN_SOURCEPOOL_H
@@ -0,0 +1,78 @@
+/**
+ * UdpPayloads.cc
+ * 
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ * 
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "UdpPayloads.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+namespace scanner::net {
+
+    static bool hex_to_bytes(const std::string& hex, std::vector<uint8_t>& out) {
+        if (hex.size() % 2 != 0)
+            return false;
+
+        for (size_t i = 0; i < hex.size(); i += 2) {
+            char* end = nullptr;
+            std::string byte = hex.substr(i, 2);
+            long value = std::strtol(byte.c_str(), &end, 16);
+
+            if (*end != '\0')
+                return false;
+            out.push_back(static_cast<uint8_t>(value));
+        }
+        return true;
+    }
+
+    void UdpPayloads::loadDatabase(const std::string& filename) {
+        std::ifstream f(filename, std::ios::in);
+        std::string line, ports, port, hex;
+        int line_number = 0;
+
+        if (!f.is_open()) {
+            std::cerr << "WARNING: Cannot open file with UDP payloads, empty datagrams will be sent...\n";
+            return;
+        }
+
+        while (std::getline(f, line)) {
+            std::istringstream ss(line);
+            udpPayload payload;
+
+            line_number++;
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            if (!(ss >> ports >> payload.name >> hex) || !hex_to_bytes(hex, payload.data)) {
+                std::cerr << "WARNING: Invalid UDP payload in line " << line_number << "\n";
+                continue;
+            }
+
+            payloads.push_back(payload);
+
+            std::istringstream port_list(ports);
+            while (std::getline(port_list, port, ',')) {
+                long p = std::strtol(port.c_str(), nullptr, 10);
+
+                if (p > 0 && p <= 65535)
+                    by_port[static_cast<uint16_t>(p)] = payloads.size() - 1;
+            }
+        }
+
+        f.close();
+    }
+
+    const udpPayload* UdpPayloads::get(uint16_t port) const {
+        auto it = by_port.find(port);
+
+        if (it == by_port.end())
+            return nullptr;
+        return &payloads[it->second];
+    }
+}
@@ -0,0 +1,47 @@
+/**
+ * UdpPayloads.h
+ * 
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ * 
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Library of protocol specific UDP requests, keyed by port.
+ * Loaded from the `payloads` file, the same way as `services`.
+*/
+
+#ifndef PORTSCAN_UDPPAYLOADS_H
+#define PORTSCAN_UDPPAYLOADS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace scanner::net {
+
+    struct udpPayload {
+        std::string name;
+        std::vector<uint8_t> data;
+    };
+
+    class UdpPayloads {
+        std::vector<udpPayload> payloads;
+        std::unordered_map<uint16_t, size_t> by_port; // index in payloads
+    public:
+        UdpPayloads() { this->loadDatabase("payloads"); }
+        explicit UdpPayloads(const std::string& filename) { this->loadDatabase(filename); }
+    protected:
+        void loadDatabase(const std::string& filename);
+    public:
+        /**
+         * @return nullptr if there is no payload for the port
+        */
+        const udpPayload* get(uint16_t port) const;
+
+        const std::vector<udpPayload>& getAll() const { return payloads; }
+        size_t size() const { return payloads.size(); }
+    };
+}
+
+#endif //PORTSCAN_UDPPAYLOADS_H
@@ -0,0 +1,318 @@
+/**
+ * Async.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Probes of the --crazy and --per-core modes. They do the same as TCP.cc
+ * and UDP.cc, but instead of select() they co_await the event loop,
+ * so one thread can keep thousands of them in flight.
+*/
+
+#include "PortScanner.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+
+namespace scanner {
+
+    static EventLoop::clock::duration to_duration(timeval t) {
+        return std::chrono::seconds(t.tv_sec) + std::chrono::microseconds(t.tv_usec);
+    }
+
+    static SOCKET open_socket(int type, int protocol) {
+        return socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+    }
+
+    Task<PORT_STATE> PortScanner::async_tcp_connect(EventLoop& loop, IpAddress ip, port in_port, timeval timeout, SOCKET* keep_open,
+                                                    int* error, SourcePool* sources) {
+        struct sockaddr_in addr{0};
+        SOCKET S_socket = open_socket(SOCK_STREAM, IPPROTO_TCP);
+        int res = 0;
+        int val = 0;
+        socklen_t len = sizeof(val);
+
+        *error = 0;
+
+        if (S_socket == INVALID_SOCKET) {
+            *error = errno;
+            std::cerr << "ERROR: Cannot create socket.." << std::endl;
+            co_return failed_state(*error);
+        }
+
+        Trace::add(Trace::SOCKET_CREATED, ip, in_port, TCP);
+
+        if (sources != nullptr && (*error = sources->bind(S_socket)) != 0) {
+            closesocket(S_socket);
+            co_return failed_state(*error);
+        }
+
+        addr.sin_addr.s_addr = ip.getAsAddr().num;
+        addr.sin_port = htons(in_port);
+        addr.sin_family = AF_INET;
+
+        res = connect(S_socket, (struct sockaddr*)&addr, sizeof(addr));
+        *error = res < 0 ? errno : 0;
+
+        if (res < 0 && errno == EINPROGRESS) {
+            // wait for the handshake without holding the thread
+            if (co_await loop.writable(S_socket, to_duration(timeout))) {
+                res = getsockopt(S_socket, SOL_SOCKET, SO_ERROR, &val, &len) == 0 && val == 0 ? 0 : SOCKET_ERROR;
+                *error = val;
+            } else {
+                res = SOCKET_ERROR;
+                *error = ETIMEDOUT;
+            }
+        }
+
+        Trace::add(Trace::CONNECT, ip, in_port, TCP);
+
+        if (keep_open != nullptr && res == 0) {
+            *keep_open = S_socket;
+            co_return OPEN;
+        }
+
+        if (res == 0) {
+            reset_socket(S_socket);
+        } else {
+            closesocket(S_socket);
+        }
+        co_return res == 0 ? OPEN : failed_state(*error);
+    }
+
+    Task<PORT_STATE> PortScanner::async_udp_connect(EventLoop& loop, IpAddress ip, port in_port, retryPolicy policy,
+                                                    const udpPayload* payload, IcmpRateLimit* limit) {
+        struct sockaddr_in addr{0};
+        SOCKET S_socket = open_socket(SOCK_DGRAM, IPPROTO_UDP);
+        bool reply_flag = false;
+        bool close_flag = false;
+        int close_error = 0; // ECONNREFUSED for port unreachable, the rest come from firewalls
+
+        if (S_socket == INVALID_SOCKET) {
+            std::cerr << "ERROR: Cannot create UDP sockets.." << std::endl;
+            co_return FILTERED;
+        }
+
+        Trace::add(Trace::SOCKET_CREATED, ip, in_port, UDP);
+
+        addr.sin_addr.s_addr = ip.getAsAddr().num;
+        addr.sin_port = htons(in_port);
+        addr.sin_family = AF_INET;
+
+        // connected socket gets only datagrams from the port,
+        // and ICMP unreachable for it comes back as ECONNREFUSED
+        if (connect(S_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            closesocket(S_socket);
+            co_return FILTERED;
+        }
+
+        // the same rules as udp_connect - the wait doubles with every retry
+        for (int i = 0; i <= policy.retries && !reply_flag && !close_flag; i++) {
+            if (limit != nullptr) {
+                auto turn = limit->reserve(); // as fast as the host sends ICMP back
+
+                if (turn > EventLoop::clock::now())
+                    co_await loop.sleep(turn - EventLoop::clock::now());
+            }
+
+            auto deadline = EventLoop::clock::now() + to_duration(policy.wait(i));
+
+            if (send(S_socket, payload != nullptr ? payload->data.data() : nullptr,
+                     payload != nullptr ? payload->data.size() : 0, 0) < 0) {
+                close_error = errno;
+                close_flag = errno == ECONNREFUSED || errno == EHOSTUNREACH || errno == ENETUNREACH; // ICMP for the previous try
+                break;
+            }
+
+            while (!reply_flag && !close_flag
+                   && co_await loop.readable(S_socket, deadline - EventLoop::clock::now())) {
+                char c = 0;
+
+                if (recv(S_socket, &c, 1, MSG_TRUNC) >= 0) {
+                    reply_flag = true; // the service has answered - it's open
+                } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    close_error = errno;
+                    close_flag = true; // I AM CLOSED (or filtered for other ICMP codes)
+                }
+            }
+
+            if (limit != nullptr && close_flag) {
+                limit->unreachable(i > 0);
+            } else if (limit != nullptr && !reply_flag) {
+                limit->silent();
+            }
+        }
+
+        Trace::add(Trace::CONNECT, ip, in_port, UDP);
+        closesocket(S_socket);
+
+        if (reply_flag) {
+            co_return OPEN;
+        }
+        if (close_flag) {
+            co_return close_error == ECONNREFUSED ? CLOSED : FILTERED;
+        }
+        co_return OPEN_FILTERED;
+    }
+
+    Task<> PortScanner::probe_port(EventLoop& loop, IpAddress ip, port port, CONNECTION_TYPE protocol,
+                                   Metrics::clock::time_point queued, std::vector<probeResult>* buffer) {
+        bool waits_for_banner = false;
+
+        Trace::add(Trace::DEQUEUE, ip, port, protocol);
+        count_queue_wait(queued);
+
+        if (is_host_stopped()) {
+            co_return;
+        }
+
+        if (protocol != UDP) {
+            SOCKET s = INVALID_SOCKET;
+            int error = 0;
+            auto backoff = std::chrono::milliseconds(SOURCE_BACKOFF_MS);
+            auto started = Metrics::clock::now();
+            PORT_STATE state = co_await async_tcp_connect(loop, ip, port, timeouts.current(),
+                                                          banner_grabber != nullptr ? &s : nullptr, &error, sources.get());
+
+            // the same as check_tcp - wait for a free local port
+            while (is_source_exhausted(error) && !is_cancelled()) {
+                co_await loop.sleep(backoff);
+                backoff = std::min(backoff * 2, std::chrono::milliseconds(SOURCE_MAX_BACKOFF_MS));
+                started = Metrics::clock::now();
+                state = co_await async_tcp_connect(loop, ip, port, timeouts.current(),
+                                                   banner_grabber != nullptr ? &s : nullptr, &error, sources.get());
+            }
+
+            if (error == EADDRNOTAVAIL || error == EADDRINUSE) {
+                waits_for_banner = true; // cancelled - not probed, not marked as done
+            } else {
+                count_probe(ip, port, TCP, state, error, started);
+
+                if (state == OPEN && banner_grabber != nullptr) {
+                    co_await banner_grabber->slot(loop); // not submit() alone - it would block the loop
+                    banner_grabber->submit(s, ip, port, true); // reported, when the banner is read
+                    waits_for_banner = true;
+                } else if (buffer != nullptr) {
+                    buffer->push_back({port, TCP, state, false});
+                } else {
+                    report(ip, port, state, TCP);
+                }
+            }
+        }
+
+        if (protocol != TCP && udp_batch == nullptr) {
+            auto started = Metrics::clock::now();
+            PORT_STATE state = co_await async_udp_connect(loop, ip, port, udp_policy(),
+                                                          udp_payloads != nullptr ? udp_payloads->get(port) : nullptr,
+                                                          settings.b_stdin ? nullptr : &icmp_limit);
+
+            count_probe(ip, port, UDP, state, udp_error(state), started);
+            if (buffer != nullptr) {
+                buffer->push_back({port, UDP, state, waits_for_banner});
+            } else {
+                report(ip, port, state, UDP);
+            }
+        }
+
+        // the same rules as check_port (buffered ports are marked, when they are reported)
+        if (!waits_for_banner && udp_batch == nullptr && buffer == nullptr) {
+            port_done(port);
+        }
+    }
+
+    void PortScanner::spawn_probes(Executor& executor, JobGroup& group, const IpAddress& ip,
+                                   const std::vector<port>& ports, CONNECTION_TYPE protocol) {
+        for (size_t i = 0; i < ports.size() && !is_host_stopped(); i++) {
+            auto queued = metrics != nullptr ? Metrics::clock::now() : Metrics::clock::time_point{};
+            port p = ports[i];
+
+            Trace::add(Trace::ENQUEUE, ip, p, protocol);
+            executor.spawn(
+                [this, ip, p, protocol, queued](EventLoop& loop) {
+                    return probe_port(loop, ip, p, protocol, queued);
+                }, &group
+            );
+        }
+    }
+
+    size_t probe_limit(const flags& f) {
+        size_t max_probes = f.i_max_probes > 0 ? f.i_max_probes : Executor::maxSockets();
+
+        if (f.i_max_probes <= 0 && f.i_concurrency > 0) {
+            max_probes = std::min<size_t>(max_probes, f.i_concurrency);
+        }
+        if (f.b_banners && f.ct_protocol != UDP) {
+            // sockets waiting for banners are still open
+            max_probes -= std::min<size_t>(max_probes / 2, f.i_banner_concurrency);
+        }
+        return max_probes;
+    }
+
+    Task<> PortScanner::feed_core(EventLoop& loop, CoreEngine& engine, IpAddress ip, const std::vector<port>& pending,
+                                  size_t first, size_t step) {
+        auto next = EventLoop::clock::now();
+
+        for (size_t i = first; i < pending.size() && !is_host_stopped(); i += step) {
+            while (engine.in_flight >= engine.limit) {
+                co_await engine.slot();
+            }
+
+            if (engine.interval.count() > 0) {
+                auto now = EventLoop::clock::now();
+
+                if (next > now) {
+                    co_await loop.sleep(next - now);
+                } else if (next + std::chrono::milliseconds(1) < now) {
+                    next = now; // no credit for the idle time (but for the coarse sleep)
+                }
+                next += engine.interval;
+            }
+
+            engine.in_flight++;
+            Trace::add(Trace::ENQUEUE, ip, pending[i], settings.ct_protocol);
+            core_probe(this, loop, engine, ip, pending[i]).handle.resume(); // runs until its first co_await
+        }
+
+        while (engine.in_flight > 0) {
+            co_await engine.slot();
+        }
+    }
+
+    Job PortScanner::core_probe(PortScanner* scanner, EventLoop& loop, CoreEngine& engine, IpAddress ip, port port) {
+        auto queued = scanner->metrics != nullptr ? Metrics::clock::now() : Metrics::clock::time_point{};
+
+        co_await scanner->probe_port(loop, ip, port, scanner->settings.ct_protocol, queued, &engine.results);
+        engine.release();
+    }
+
+    void PortScanner::flush_core_results(const IpAddress& ip, std::vector<std::unique_ptr<CoreEngine>>& engines) {
+        std::vector<probeResult> results;
+
+        for (auto& engine : engines) {
+            results.insert(results.end(), engine->results.begin(), engine->results.end());
+            engine->results.clear(); // keeps the memory (allocated on the engine's core)
+        }
+
+        // engines took every n-th port - the table is in order again
+        std::sort(results.begin(), results.end(), [](const probeResult& a, const probeResult& b) {
+            return a.port != b.port ? a.port < b.port : a.protocol < b.protocol;
+        });
+
+        for (auto& r : results) {
+            report(ip, r.port, r.state, r.protocol);
+        }
+
+        // results first, the same as in check_port
+        if (checkpoint != nullptr && udp_batch == nullptr) {
+            for (auto& r : results) {
+                if (!r.waits_for_banner)
+                    checkpoint->markDone(r.port);
+            }
+        }
+    }
+}
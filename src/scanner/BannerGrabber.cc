@@ -0,0 +1,304 @@
+/**
+ * BannerGrabber.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "BannerGrabber.h"
+
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <algorithm>
+#include <stdexcept>
+
+#include <poll.h>
+#include <strings.h>
+
+namespace scanner {
+
+    // Nudge for servers, which wait for the client to speak first.
+    // HTTP request is the most common case, and most of other text
+    // protocols answer it with an error - which still tells who they are.
+    static const char NUDGE[] = "HEAD / HTTP/1.0\r\n\r\n";
+
+    BannerGrabber::BannerGrabber(size_t max_concurrency, timeval timeout, callback on_done)
+            : on_done(std::move(on_done)), max_jobs(max_concurrency > 0 ? max_concurrency : 1),
+              timeout(timeout.tv_sec * 1000 + timeout.tv_usec / 1000) {
+        buffers.resize(max_jobs * BANNER_SIZE);
+        for (size_t i = 0; i < max_jobs; i++)
+            free_buffers.push_back(i);
+
+        if (pipe(wakeup_pipe) != 0) {
+            throw std::runtime_error("ERROR: Cannot create pipe for banner grabber");
+        }
+        fcntl(wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+
+        is_running = true;
+        worker = std::thread(&BannerGrabber::pollLoop, this);
+    }
+
+    BannerGrabber::~BannerGrabber() {
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            is_running = false;
+        }
+        wakeup();
+        worker.join(); // finishes all jobs first
+
+        close(wakeup_pipe[0]);
+        close(wakeup_pipe[1]);
+    }
+
+    void BannerGrabber::wakeup() {
+        char c = 1;
+        // pipe full means the thread is going to wake up anyway
+        (void) !write(wakeup_pipe[1], &c, 1);
+    }
+
+    void BannerGrabber::submit(int32_t socket, const IpAddress& ip, uint16_t port, bool reserved) {
+        auto now = clock::now();
+        job j{socket, ip, port, now + timeout / 2, now + timeout};
+
+        {
+            std::unique_lock<std::mutex> lock(jobs_mutex);
+
+            if (!reserved) {
+                slot_free.wait(lock, [this]() {
+                    return in_flight < max_jobs;
+                });
+                in_flight++;
+            }
+
+            // reserved slots are counted in in_flight, so their buffers are still free
+            j.buffer = free_buffers.back();
+            free_buffers.pop_back();
+            incoming.push_back(j);
+        }
+        wakeup();
+    }
+
+#ifdef __linux__
+    bool BannerGrabber::slotAwaiter::await_ready() {
+        std::lock_guard<std::mutex> lock(grabber.jobs_mutex);
+
+        if (grabber.in_flight < grabber.max_jobs && grabber.waiting.empty()) {
+            grabber.in_flight++;
+            return true;
+        }
+        return false;
+    }
+
+    bool BannerGrabber::slotAwaiter::await_suspend(std::coroutine_handle<> h) {
+        std::lock_guard<std::mutex> lock(grabber.jobs_mutex);
+
+        // a slot may have been freed since await_ready()
+        if (grabber.in_flight < grabber.max_jobs && grabber.waiting.empty()) {
+            grabber.in_flight++;
+            return false;
+        }
+        grabber.waiting.emplace_back(&loop, h);
+        return true;
+    }
+#endif
+
+    void BannerGrabber::wait() {
+        std::unique_lock<std::mutex> lock(jobs_mutex);
+
+        all_done.wait(lock, [this]() {
+            return in_flight == 0;
+        });
+    }
+
+    void BannerGrabber::sendNudge(job& j) {
+        j.nudged = true;
+        send(j.socket, NUDGE, sizeof(NUDGE) - 1, MSG_NOSIGNAL);
+    }
+
+    void BannerGrabber::finishJob(job& j) {
+        banner b = identify(&buffers[j.buffer * BANNER_SIZE], j.received);
+        struct linger l = {1, 0};
+
+        // RST - the local port doesn't wait in TIME_WAIT
+        setsockopt(j.socket, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+        close(j.socket);
+        on_done(j.ip, j.port, b);
+
+#ifdef __linux__
+        std::pair<async::EventLoop*, std::coroutine_handle<>> next{};
+#endif
+
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            free_buffers.push_back(j.buffer);
+
+#ifdef __linux__
+            if (!waiting.empty()) {
+                next = waiting.front(); // the slot goes to the coroutine - in_flight stays
+                waiting.pop_front();
+            } else
+#endif
+            in_flight--;
+        }
+
+#ifdef __linux__
+        if (next.first != nullptr) {
+            next.first->post(next.second);
+            return;
+        }
+#endif
+        slot_free.notify_one();
+        all_done.notify_all();
+    }
+
+    void BannerGrabber::pollLoop() {
+        std::vector<pollfd> fds;
+
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(jobs_mutex);
+
+                if (!is_running && incoming.empty() && jobs.empty())
+                    break;
+
+                jobs.insert(jobs.end(), incoming.begin(), incoming.end());
+                incoming.clear();
+            }
+
+            auto now = clock::now();
+            auto next = now + std::chrono::seconds(1);
+
+            fds.clear();
+            fds.push_back({wakeup_pipe[0], POLLIN, 0});
+            for (auto& j : jobs) {
+                fds.push_back({j.socket, POLLIN, 0});
+                next = std::min(next, j.nudged ? j.deadline : j.nudge_at);
+            }
+
+            auto wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+            poll(fds.data(), fds.size(), static_cast<int>(std::max<long long>(wait_ms, 0)));
+
+            if (fds[0].revents & POLLIN) {
+                char drain[64];
+                while (read(wakeup_pipe[0], drain, sizeof(drain)) > 0);
+            }
+
+            now = clock::now();
+            for (size_t i = 0; i < jobs.size();) {
+                job& j = jobs[i];
+                bool done = false;
+
+                if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                    char* buff = &buffers[j.buffer * BANNER_SIZE];
+                    ssize_t n = recv(j.socket, buff + j.received, BANNER_SIZE - j.received, 0);
+
+                    if (n > 0) {
+                        j.received += n;
+                        // first line is enough to tell the service,
+                        // unless we had to ask (then wait for headers)
+                        done = j.received == BANNER_SIZE
+                            || (!j.nudged && memchr(buff, '\n', j.received) != nullptr)
+                            || (j.nudged && std::string(buff, j.received).find("\r\n\r\n") != std::string::npos);
+                    } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                        done = true; // closed by server
+                    }
+                }
+
+                if (!done && now >= j.deadline) {
+                    done = true;
+                } else if (!done && !j.nudged && j.received == 0 && now >= j.nudge_at) {
+                    sendNudge(j);
+                }
+
+                if (done) {
+                    finishJob(j);
+                    jobs[i] = jobs.back();
+                    fds[i + 1] = fds.back();
+                    jobs.pop_back();
+                    fds.pop_back();
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+
+    static std::string first_line(const std::string& s, size_t from = 0) {
+        std::string line;
+
+        for (size_t i = from; i < s.size() && s[i] != '\r' && s[i] != '\n'; i++) {
+            if (std::isprint(static_cast<unsigned char>(s[i])))
+                line += s[i];
+        }
+        return line;
+    }
+
+    static std::string header_value(const std::string& s, const std::string& name) {
+        size_t pos = 0;
+
+        while ((pos = s.find('\n', pos)) != std::string::npos) {
+            pos++;
+            if (strncasecmp(s.c_str() + pos, name.c_str(), name.size()) == 0) {
+                std::string value = first_line(s, pos + name.size());
+                value.erase(0, value.find_first_not_of(' '));
+                return value;
+            }
+        }
+        return "";
+    }
+
+    static bool starts_with(const std::string& s, const char* prefix) {
+        return s.compare(0, strlen(prefix), prefix) == 0;
+    }
+
+    banner BannerGrabber::identify(const char* data, size_t len) {
+        std::string s(data, len);
+        banner b;
+
+        b.raw = first_line(s);
+
+        if (len == 0) {
+            return b;
+        }
+
+        if (starts_with(s, "SSH-")) {
+            b.service = "ssh";
+            // SSH-2.0-OpenSSH_8.9p1 Ubuntu-3
+            size_t dash = b.raw.find('-', 4);
+            b.version = dash != std::string::npos ? b.raw.substr(dash + 1) : "";
+        } else if (starts_with(s, "HTTP/")) {
+            b.service = "http";
+            b.version = header_value(s, "Server:");
+        } else if (starts_with(s, "220")) {
+            std::string lower = b.raw;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+            b.service = lower.find("ftp") != std::string::npos ? "ftp"
+                : lower.find("smtp") != std::string::npos ? "smtp" : "ftp|smtp";
+            b.version = b.raw.size() > 4 ? b.raw.substr(4) : "";
+        } else if (starts_with(s, "+OK")) {
+            b.service = "pop3";
+            b.version = b.raw.size() > 4 ? b.raw.substr(4) : "";
+        } else if (starts_with(s, "* OK")) {
+            b.service = "imap";
+            b.version = b.raw.size() > 5 ? b.raw.substr(5) : "";
+        } else if (starts_with(s, "RFB ")) {
+            b.service = "vnc";
+            b.version = b.raw.substr(4);
+        } else if (starts_with(s, "-ERR") || starts_with(s, "-NOAUTH") || starts_with(s, "-DENIED")) {
+            b.service = "redis";
+        } else if (len > 5 && static_cast<unsigned char>(data[4]) == 0x0a) {
+            // MySQL handshake: 3 bytes length, sequence id, protocol 10, version\0
+            b.service = "mysql";
+            b.version = first_line(std::string(data + 5, strnlen(data + 5, len - 5)));
+        } else if (len > 2 && static_cast<unsigned char>(data[0]) == 0x15 && static_cast<unsigned char>(data[1]) == 0x03) {
+            b.service = "ssl"; // TLS alert - our nudge wasn't a ClientHello
+        }
+
+        return b;
+    }
+}
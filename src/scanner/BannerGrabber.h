@@ -0,0 +1,136 @@
+/**
+ * BannerGrabber.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Second stage of the TCP scan. Sockets, which connected successfully,
+ * are handed over here instead of being closed. One thread waits (poll)
+ * for the first bytes sent by the server on all of them at once.
+ * If the server keeps quiet for half of the timeout, a small nudge
+ * is sent, because many protocols (eg. HTTP) wait for the client.
+ *
+ * The number of sockets in this stage is limited - submit() blocks
+ * when the limit is reached, so the scan slows down instead of
+ * running out of file descriptors. Coroutines of the event loops
+ * co_await slot() first instead, so the loop keeps running meanwhile.
+*/
+
+#ifndef PORTSCAN_BANNERGRABBER_H
+#define PORTSCAN_BANNERGRABBER_H
+
+#include "../net/IpAddress.h"
+#ifdef __linux__
+#   include "../async/EventLoop.h"
+#endif
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <coroutine>
+
+#define BANNER_SIZE 512 // bytes kept from the server response
+
+namespace scanner {
+    using namespace net;
+
+    struct banner {
+        std::string service; // empty if not recognized
+        std::string version;
+        std::string raw; // first line of the response, printable characters only
+    };
+
+    class BannerGrabber {
+    public:
+        typedef std::function<void(const IpAddress&, uint16_t, const banner&)> callback;
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        struct job {
+            int32_t socket;
+            IpAddress ip;
+            uint16_t port;
+            clock::time_point nudge_at;
+            clock::time_point deadline;
+            bool nudged = false;
+            size_t buffer = 0; // index of buffer from the pool
+            size_t received = 0;
+        };
+
+        callback on_done;
+        size_t max_jobs;
+        std::chrono::milliseconds timeout;
+
+        // pool of buffers - one per job, allocated once
+        std::vector<char> buffers;
+        std::vector<size_t> free_buffers;
+
+        std::vector<job> incoming; // submitted, but not polled yet
+        std::vector<job> jobs; // owned by the poll thread
+        size_t in_flight = 0; // jobs and reserved slots
+
+#ifdef __linux__
+        // coroutines waiting for a slot - a finished job hands its slot over
+        std::deque<std::pair<async::EventLoop*, std::coroutine_handle<>>> waiting;
+#endif
+
+        std::mutex jobs_mutex;
+        std::condition_variable slot_free;
+        std::condition_variable all_done;
+
+        std::thread worker;
+        int wakeup_pipe[2] = {-1, -1};
+        bool is_running = false;
+
+        void pollLoop();
+        void wakeup();
+        void finishJob(job& j);
+        static void sendNudge(job& j);
+    public:
+        BannerGrabber(size_t max_concurrency, timeval timeout, callback on_done);
+        ~BannerGrabber();
+
+        /**
+         * Take over a connected (non-blocking) socket.
+         * Blocks while the concurrency limit is reached, unless the slot is reserved already.
+        */
+        void submit(int32_t socket, const IpAddress& ip, uint16_t port, bool reserved = false);
+
+#ifdef __linux__
+        struct slotAwaiter {
+            BannerGrabber& grabber;
+            async::EventLoop& loop;
+
+            bool await_ready();
+            bool await_suspend(std::coroutine_handle<> h);
+            void await_resume() const noexcept {}
+        };
+
+        /**
+         * Reserve a slot without blocking the event loop - the coroutine
+         * is resumed on its loop, when one is free. submit(..., true) follows.
+        */
+        slotAwaiter slot(async::EventLoop& loop) { return {*this, loop}; }
+#endif
+
+        /**
+         * Wait until all submitted sockets are finished.
+        */
+        void wait();
+
+        /**
+         * Recognize the service from the first bytes of the response.
+        */
+        static banner identify(const char* data, size_t len);
+    };
+}
+
+#endif //PORTSCAN_BANNERGRABBER_H
@@ -0,0 +1,130 @@
+/**
+ * Baseline.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "Baseline.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace scanner {
+
+    static IpAddress host_address(uint64_t key) {
+        auto host = static_cast<ipv4>(key >> 24);
+
+        return IpAddress(isBigEndian() ? host : bswap32(host));
+    }
+
+    static std::string describe(char change, uint64_t key, const std::string& status, const std::string& service) {
+        auto port = static_cast<uint16_t>(key >> 8);
+        auto protocol = static_cast<CONNECTION_TYPE>(key & 0xff);
+
+        return std::string(1, change) + " " + host_address(key).getAsString() + " " + std::to_string(port)
+            + (protocol == TCP ? "/tcp " : "/udp ") + status + " " + service;
+    }
+
+    Baseline::Baseline(const std::string& filename) : filename(filename) {
+        std::ifstream f(filename, std::ios::in);
+        std::string line, address, port, status;
+        int line_number = 0;
+
+        if (!f.is_open()) {
+            throw std::runtime_error("ERROR: Cannot open baseline file `" + filename + "`");
+        }
+
+        while (std::getline(f, line)) {
+            std::istringstream ss(line);
+            entry e;
+
+            line_number++;
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            if (!(ss >> address >> port >> e.status)) {
+                std::cerr << "WARNING: Invalid result in line " << line_number << " of the baseline\n";
+                continue;
+            }
+            std::getline(ss >> std::ws, e.service);
+
+            auto slash = port.find('/');
+            long p = std::strtol(port.substr(0, slash).c_str(), nullptr, 10);
+            std::string proto = slash != std::string::npos ? port.substr(slash + 1) : "";
+            ipv4 ip = IpAddress::pton(address); // 0 = invalid
+
+            if (ip == 0 || p <= 0 || p > 65535 || (proto != "tcp" && proto != "udp")) {
+                std::cerr << "WARNING: Invalid result in line " << line_number << " of the baseline\n";
+                continue;
+            }
+
+            previous[key(IpAddress(ip).getAsNetNumber(), static_cast<uint16_t>(p), proto == "tcp" ? TCP : UDP)] = e;
+        }
+    }
+
+    bool Baseline::contains(const IpAddress& ip, uint16_t port) const {
+        return previous.count(key(ip.getAsNetNumber(), port, TCP)) != 0
+            || previous.count(key(ip.getAsNetNumber(), port, UDP)) != 0;
+    }
+
+    std::vector<uint16_t> Baseline::getPorts(const IpAddress& ip) const {
+        std::vector<uint16_t> ports;
+        uint32_t host = ip.getAsNetNumber();
+
+        for (auto it = previous.lower_bound(key(host, 0, TCP));
+             it != previous.end() && (it->first >> 24) == host; ++it) {
+            auto port = static_cast<uint16_t>(it->first >> 8);
+
+            if (ports.empty() || ports.back() != port)
+                ports.push_back(port); // tcp and udp entries of the port are neighbours
+        }
+        return ports;
+    }
+
+    void Baseline::add(const IpAddress& ip, uint16_t port, CONNECTION_TYPE protocol,
+                       const std::string& status, const std::string& service) {
+        std::lock_guard<std::mutex> lock(current_mutex);
+        uint64_t k = key(ip.getAsNetNumber(), port, protocol);
+        auto before = previous.find(k);
+
+        if (!status.empty()) {
+            current[k] = {status, service};
+        } else {
+            current[k] = {before != previous.end() ? before->second.status : "open", service};
+        }
+    }
+
+    std::vector<std::string> Baseline::diff(const std::function<bool(const IpAddress&, uint16_t, CONNECTION_TYPE)>& scanned) {
+        std::lock_guard<std::mutex> lock(current_mutex);
+        std::vector<std::string> changes;
+        auto before = previous.begin();
+        auto now = current.begin();
+
+        // both maps are sorted the same way, so it's a merge
+        while (before != previous.end() || now != current.end()) {
+            if (now == current.end() || (before != previous.end() && before->first < now->first)) {
+                auto port = static_cast<uint16_t>(before->first >> 8);
+                auto protocol = static_cast<CONNECTION_TYPE>(before->first & 0xff);
+
+                if (scanned(host_address(before->first), port, protocol))
+                    changes.push_back(describe('-', before->first, before->second.status, before->second.service));
+                ++before;
+            } else if (before == previous.end() || now->first < before->first) {
+                changes.push_back(describe('+', now->first, now->second.status, now->second.service));
+                ++now;
+            } else {
+                if (before->second.status != now->second.status) {
+                    changes.push_back(describe('~', now->first, before->second.status + " ->", now->second.status + " " + now->second.service));
+                }
+                ++before;
+                ++now;
+            }
+        }
+        return changes;
+    }
+}
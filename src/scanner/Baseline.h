@@ -0,0 +1,87 @@
+/**
+ * Baseline.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Results of the previous run (the -o list), for incremental rescans.
+ *
+ * Most ports of a nightly scan look the same as the night before,
+ * so the scanner probes the previously open ports of every host first,
+ * may probe only a sample of the others, and at the end reports
+ * only what has changed:
+ *
+ *      + <ip> <port>/<proto> <status> <service>    newly open
+ *      - <ip> <port>/<proto> <status> <service>    open before, not now
+ *      ~ <ip> <port>/<proto> <old> -> <status> <service>
+*/
+
+#ifndef PORTSCAN_BASELINE_H
+#define PORTSCAN_BASELINE_H
+
+#include "../net/IpAddress.h"
+#include "../net/ServicesDictionary.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+
+namespace scanner {
+    using namespace net;
+
+    class Baseline {
+    public:
+        struct entry {
+            std::string status; // open or open|filtered
+            std::string service;
+        };
+    private:
+        std::string filename;
+        std::map<uint64_t, entry> previous; // ordered by host, so a host is one range
+        std::map<uint64_t, entry> current; // open ports found by this run
+        std::mutex current_mutex;
+
+        // host in host byte order
+        static uint64_t key(uint32_t host, uint16_t port, CONNECTION_TYPE protocol) {
+            return (static_cast<uint64_t>(host) << 24) | (static_cast<uint64_t>(port) << 8) | protocol;
+        }
+    public:
+        /**
+         * Throws std::runtime_error, if the file can't be read.
+        */
+        explicit Baseline(const std::string& filename);
+
+        /**
+         * Was the port open before (with any protocol)?
+        */
+        bool contains(const IpAddress& ip, uint16_t port) const;
+
+        /**
+         * Previously open ports of the host, sorted, without duplicates.
+        */
+        std::vector<uint16_t> getPorts(const IpAddress& ip) const;
+
+        /**
+         * Open port found by this run. Thread safe.
+         * Empty status = the same as before (results recovered from a checkpoint).
+        */
+        void add(const IpAddress& ip, uint16_t port, CONNECTION_TYPE protocol, const std::string& status, const std::string& service);
+
+        /**
+         * Changes since the previous run, sorted by host and port.
+         * Previously open ports, for which scanned() is false
+         * (out of the range, another shard..), are not reported as closed.
+        */
+        std::vector<std::string> diff(const std::function<bool(const IpAddress&, uint16_t, CONNECTION_TYPE)>& scanned);
+
+        const std::string& getFilename() const { return filename; }
+        size_t size() const { return previous.size(); }
+    };
+}
+
+#endif //PORTSCAN_BASELINE_H
@@ -0,0 +1,156 @@
+/**
+ * Capture.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "Capture.h"
+#include "Shard.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+
+namespace scanner {
+
+    static const uint64_t SAMPLE_SEED = 0x70636170; // any, but not the seeds of --shard and --sample
+
+    namespace {
+        struct pcapHeader {
+            uint32_t magic = 0xa1b2c3d4; // microsecond timestamps
+            uint16_t version_major = 2;
+            uint16_t version_minor = 4;
+            int32_t thiszone = 0;
+            uint32_t sigfigs = 0;
+            uint32_t snaplen = 0;
+            uint32_t network = 101; // LINKTYPE_RAW - packets start with the IP header
+        };
+
+        struct pcapRecord {
+            uint32_t seconds;
+            uint32_t microseconds;
+            uint32_t captured;
+            uint32_t size;
+        };
+    }
+
+    Capture::Capture(const std::string& filename, uint32_t snaplen, uint32_t sample)
+            : snaplen(std::clamp<uint32_t>(snaplen, 1, CAPTURE_MAX_SNAPLEN)),
+              sample(sample > 0 ? sample : 1), rings([this](ring& r) {
+                  r.slots = std::make_unique<uint8_t[]>(slot_size * CAPTURE_RING_SLOTS);
+              }) {
+        pcapHeader header;
+
+        slot_size = (sizeof(slotHeader) + this->snaplen + 7) & ~static_cast<size_t>(7);
+
+        file.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.good()) {
+            throw std::runtime_error("ERROR: Cannot create capture file `" + filename + "`");
+        }
+
+        header.snaplen = this->snaplen;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    void Capture::start() {
+        is_running = true;
+        writer = std::thread(&Capture::writerLoop, this);
+    }
+
+    void Capture::stop() {
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex);
+            if (!is_running)
+                return;
+            is_running = false;
+        }
+        writer_wakeup.notify_all();
+        writer.join();
+
+        drain();
+        file.flush();
+    }
+
+    bool Capture::isSampled(ipv4 ip, uint16_t port) const {
+        return sample == 1 || Shard::hash(SAMPLE_SEED, ip, port) % sample == 0;
+    }
+
+    void Capture::add(const uint8_t* packet, size_t size) {
+        ring& r = rings.local();
+        uint64_t head = r.head.load(std::memory_order_relaxed);
+        uint64_t queued = head - r.tail.load(std::memory_order_acquire);
+
+        if (queued >= CAPTURE_RING_SLOTS) {
+            r.dropped.fetch_add(1, std::memory_order_relaxed); // the writer is behind
+            return;
+        }
+        if (queued == CAPTURE_RING_SLOTS / 2) {
+            writer_wakeup.notify_one(); // a burst (--batch) - don't wait for the next flush
+        }
+
+        uint8_t* slot = r.slots.get() + (head & (CAPTURE_RING_SLOTS - 1)) * slot_size;
+        slotHeader header{
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count()),
+            static_cast<uint32_t>(size),
+            static_cast<uint32_t>(std::min<size_t>(size, snaplen))
+        };
+
+        memcpy(slot, &header, sizeof(header));
+        memcpy(slot + sizeof(header), packet, header.captured);
+        r.head.store(head + 1, std::memory_order_release);
+    }
+
+    void Capture::writerLoop() {
+        std::unique_lock<std::mutex> lock(writer_mutex);
+
+        while (is_running) {
+            writer_wakeup.wait_for(lock, std::chrono::milliseconds(CAPTURE_FLUSH_MS), [this]() {
+                return !is_running;
+            });
+
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+    }
+
+    void Capture::drain() {
+        std::vector<ring*> current;
+
+        rings.forEach([&current](ring& r) { current.push_back(&r); });
+
+        for (ring* r : current) {
+            uint64_t tail = r->tail.load(std::memory_order_relaxed);
+            uint64_t head = r->head.load(std::memory_order_acquire);
+
+            for (; tail < head; tail++) {
+                const uint8_t* slot = r->slots.get() + (tail & (CAPTURE_RING_SLOTS - 1)) * slot_size;
+                slotHeader header{};
+                pcapRecord record{};
+
+                memcpy(&header, slot, sizeof(header));
+                record.seconds = static_cast<uint32_t>(header.time / 1000000);
+                record.microseconds = static_cast<uint32_t>(header.time % 1000000);
+                record.captured = header.captured;
+                record.size = header.size;
+
+                file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+                file.write(reinterpret_cast<const char*>(slot + sizeof(header)), header.captured);
+                written++;
+            }
+            r->tail.store(tail, std::memory_order_release); // the slots are free again
+        }
+    }
+
+    uint64_t Capture::getDropped() {
+        uint64_t dropped = 0;
+
+        rings.forEach([&dropped](ring& r) { dropped += r.dropped.load(std::memory_order_relaxed); });
+        return dropped;
+    }
+}
@@ -0,0 +1,104 @@
+/**
+ * Capture.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * pcap file of raw UDP probes and the replies matched with them
+ * (--capture), so results of udp_connect and the batch scanner can be
+ * checked in Wireshark without a separate tcpdump to correlate with.
+ *
+ * The send path never waits for the disk: every thread copies its packets
+ * (up to the snap length) into its own single producer ring, and one writer
+ * thread moves them to the file. A full ring drops the packet and counts it.
+ * Probes are sampled by the hash of the (host, port) pair - a sampled probe
+ * is captured with all its retries and replies, the rest costs one branch.
+ *
+ * Packets are raw IPv4 (LINKTYPE_RAW), timestamps in microseconds.
+*/
+
+#ifndef PORTSCAN_CAPTURE_H
+#define PORTSCAN_CAPTURE_H
+
+#include "../net/IpAddress.h"
+#include "../async/PerThread.h"
+
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define CAPTURE_RING_SLOTS 4096 // packets of a thread waiting for the writer, must be a power of two
+#define CAPTURE_MAX_SNAPLEN 2048 // PACKET_SIZE - no probe or reply is longer
+#define CAPTURE_DEFAULT_SNAPLEN 256
+#define CAPTURE_FLUSH_MS 10 // how often the writer empties the rings
+
+namespace scanner {
+    using namespace net;
+
+    class Capture {
+    private:
+        struct slotHeader {
+            uint64_t time; // unix time in us
+            uint32_t size; // of the packet
+            uint32_t captured; // bytes in the slot
+        };
+
+        struct ring {
+            alignas(64) std::atomic<uint64_t> head{0}; // packets written by the thread
+            alignas(64) std::atomic<uint64_t> tail{0}; // packets taken by the writer
+            std::atomic<uint64_t> dropped{0};
+            std::unique_ptr<uint8_t[]> slots;
+        };
+
+        std::ofstream file;
+        uint32_t snaplen;
+        uint32_t sample; // 1 of sample probes
+        size_t slot_size;
+
+        async::PerThread<ring> rings;
+        uint64_t written = 0;
+
+        std::thread writer;
+        std::mutex writer_mutex;
+        std::condition_variable writer_wakeup;
+        bool is_running = false;
+
+        void writerLoop();
+        void drain();
+    public:
+        /**
+         * Throws std::runtime_error, if the file can't be created.
+         * @param snaplen bytes of every packet kept (1 - CAPTURE_MAX_SNAPLEN)
+         * @param sample capture 1 of sample probes (1 = all)
+        */
+        Capture(const std::string& filename, uint32_t snaplen, uint32_t sample);
+        ~Capture() { stop(); }
+
+        void start();
+        /**
+         * Writes what is left in the rings. Threads should be idle by now.
+        */
+        void stop();
+
+        // stateless hash, no lock
+        bool isSampled(ipv4 ip, uint16_t port) const;
+
+        /**
+         * Queues the IP packet for the writer, never blocks.
+        */
+        void add(const uint8_t* packet, size_t size);
+
+        uint64_t getWritten() const { return written; }
+        uint64_t getDropped();
+    };
+}
+
+#endif //PORTSCAN_CAPTURE_H
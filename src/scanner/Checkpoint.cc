@@ -0,0 +1,262 @@
+/**
+ * Checkpoint.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "Checkpoint.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <chrono>
+#include <cstdio>
+
+#define CHECKPOINT_MAGIC "portscan-checkpoint"
+#define CHECKPOINT_VERSION 2 // 1 has no shard and sample
+
+namespace scanner {
+
+    static const char* protocol_name(CONNECTION_TYPE type) {
+        return type == TCP ? "tcp" : type == UDP ? "udp" : "all";
+    }
+
+    static bool protocol_from_name(const std::string& name, CONNECTION_TYPE& type) {
+        if (name == "tcp")
+            type = TCP;
+        else if (name == "udp")
+            type = UDP;
+        else if (name == "all")
+            type = ALL;
+        else
+            return false;
+        return true;
+    }
+
+    Checkpoint::Checkpoint(const std::string& filename, int interval_in_seconds)
+            : filename(filename), interval(interval_in_seconds > 0 ? interval_in_seconds : 1) {}
+
+    void Checkpoint::setRange(const IpAddress& first, const IpAddress& last, uint16_t port_from, uint16_t port_to, CONNECTION_TYPE type) {
+        first_ip = first.getAsAddr().num;
+        last_ip = last.getAsAddr().num;
+        from = port_from;
+        to = port_to;
+        protocol = type;
+
+        done_words = ((static_cast<size_t>(to) - from + 1) + 63) / 64;
+        done.reset(new std::atomic<uint64_t>[done_words]);
+        for (size_t i = 0; i < done_words; i++)
+            done[i].store(0, std::memory_order_relaxed);
+
+        current_ip.store(first_ip);
+    }
+
+    void Checkpoint::setSelection(const Shard& selected, int percent, uint64_t seed) {
+        shard = selected;
+        sample_percent = percent;
+        sample_seed = seed;
+    }
+
+    void Checkpoint::load() {
+        std::ifstream f(filename, std::ios::in);
+        std::string word, s_first, s_last, s_host, s_proto;
+        int version = 0;
+        unsigned int p_from = 0, p_to = 0;
+        uint32_t s_index = 0, s_count = 0;
+        uint64_t s_seed = 0, p_seed = 0;
+        int percent = 0;
+        CONNECTION_TYPE type = ALL;
+
+        if (!f.is_open()) {
+            throw std::runtime_error("ERROR: Cannot open checkpoint file `" + filename + "`");
+        }
+
+        if (!(f >> word >> version) || word != CHECKPOINT_MAGIC) {
+            throw std::runtime_error("ERROR: `" + filename + "` is not a checkpoint file");
+        }
+        if (version != CHECKPOINT_VERSION) {
+            throw std::runtime_error("ERROR: Checkpoint `" + filename + "` was made by another version of portscan");
+        }
+
+        if (!(f >> word >> s_first >> s_last >> p_from >> p_to >> s_proto) || word != "range"
+            || !protocol_from_name(s_proto, type)) {
+            throw std::runtime_error("ERROR: Corrupted checkpoint file `" + filename + "`");
+        }
+
+        if (IpAddress(s_first).getAsAddr().num != first_ip || IpAddress(s_last).getAsAddr().num != last_ip
+            || p_from != from || p_to != to || type != protocol) {
+            throw std::runtime_error("ERROR: Checkpoint `" + filename + "` was made for a different scan ["
+                + s_first + " - " + s_last + ", ports " + std::to_string(p_from) + " - "
+                + std::to_string(p_to) + ", " + s_proto + "]");
+        }
+
+        if (!(f >> word >> s_index >> s_count >> s_seed) || word != "shard"
+            || !(f >> word >> percent >> p_seed) || word != "sample") {
+            throw std::runtime_error("ERROR: Corrupted checkpoint file `" + filename + "`");
+        }
+
+        // another selection of ports would leave holes or scan some of them twice
+        if (s_index != shard.getIndex() || s_count != shard.getCount() || s_seed != shard.getSeed()
+            || percent != sample_percent || (sample_seed != 0 && p_seed != sample_seed)) {
+            throw std::runtime_error("ERROR: Checkpoint `" + filename + "` was made for a different selection of ports [shard "
+                + std::to_string(s_index + 1) + "/" + std::to_string(s_count) + ", shard seed " + std::to_string(s_seed)
+                + ", sample " + std::to_string(percent) + "%, sample seed " + std::to_string(p_seed) + "]");
+        }
+        sample_seed = p_seed;
+
+        while (f >> word) {
+            if (word == "host") {
+                f >> s_host;
+                current_ip.store(IpAddress(s_host).getAsAddr().num);
+            } else if (word == "done") {
+                for (size_t i = 0; i < done_words; i++) {
+                    uint64_t bits = 0;
+                    f >> std::hex >> bits >> std::dec;
+                    done[i].store(bits, std::memory_order_relaxed);
+                }
+            } else if (word == "result") {
+                std::string s_ip;
+                unsigned int p = 0;
+                scanResult r;
+
+                f >> s_ip >> p >> s_proto;
+                r.ip = IpAddress(s_ip).getAsAddr().num;
+                r.port = static_cast<uint16_t>(p);
+                protocol_from_name(s_proto, r.protocol);
+                results.push_back(r);
+            } else if (word == "completed") {
+                completed = true;
+            } else if (word == "end") {
+                break;
+            }
+
+            if (!f) {
+                throw std::runtime_error("ERROR: Corrupted checkpoint file `" + filename + "`");
+            }
+        }
+
+        f.close();
+    }
+
+    void Checkpoint::start() {
+        is_running = true;
+        writer = std::thread(&Checkpoint::writerLoop, this);
+    }
+
+    void Checkpoint::stop() {
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex);
+            if (!is_running)
+                return;
+            is_running = false;
+        }
+        writer_wakeup.notify_all();
+        writer.join();
+
+        save();
+    }
+
+    void Checkpoint::writerLoop() {
+        std::unique_lock<std::mutex> lock(writer_mutex);
+
+        while (is_running) {
+            writer_wakeup.wait_for(lock, std::chrono::seconds(interval), [this]() {
+                return !is_running;
+            });
+
+            if (is_running) {
+                lock.unlock();
+                save();
+                lock.lock();
+            }
+        }
+    }
+
+    bool Checkpoint::snapshot(ipv4& ip, std::vector<uint64_t>& bits) {
+        uint32_t gen = generation.load(std::memory_order_acquire);
+
+        if (gen & 1)
+            return false; // host is being switched right now
+
+        ip = current_ip.load(std::memory_order_acquire);
+        for (size_t i = 0; i < done_words; i++)
+            bits[i] = done[i].load(std::memory_order_acquire);
+
+        return generation.load(std::memory_order_acquire) == gen;
+    }
+
+    void Checkpoint::save() {
+        std::vector<uint64_t> bits(done_words);
+        std::ostringstream ss;
+        ipv4 ip = 0;
+
+        // bits are read before results, so every finished port has its result in the file
+        while (!snapshot(ip, bits))
+            std::this_thread::yield();
+
+        ss  << CHECKPOINT_MAGIC << " " << CHECKPOINT_VERSION << "\n"
+            << "range " << IpAddress(first_ip).getAsString() << " " << IpAddress(last_ip).getAsString()
+            << " " << from << " " << to << " " << protocol_name(protocol) << "\n"
+            << "shard " << shard.getIndex() << " " << shard.getCount() << " " << shard.getSeed() << "\n"
+            << "sample " << sample_percent << " " << sample_seed << "\n"
+            << "host " << IpAddress(ip).getAsString() << "\n"
+            << "done" << std::hex;
+        for (auto word : bits)
+            ss << " " << word;
+        ss << std::dec << "\n";
+
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            for (auto& r : results) {
+                ss << "result " << IpAddress(r.ip).getAsString() << " " << r.port << " " << protocol_name(r.protocol) << "\n";
+            }
+        }
+
+        if (completed)
+            ss << "completed\n";
+        ss << "end\n";
+
+        // write to a temporary file first, so an interrupted write
+        // never destroys the previous checkpoint
+        std::string tmp = filename + ".tmp";
+        std::ofstream f(tmp, std::ios::out | std::ios::trunc);
+
+        if (!f.good()) {
+            std::cerr << "WARNING: Cannot write checkpoint file `" << tmp << "`\n";
+            return;
+        }
+
+        f << ss.str();
+        f.close();
+
+        if (std::rename(tmp.c_str(), filename.c_str()) != 0) {
+            std::cerr << "WARNING: Cannot replace checkpoint file `" << filename << "`\n";
+        }
+    }
+
+    void Checkpoint::beginHost(const IpAddress& ip) {
+        ipv4 num = ip.getAsAddr().num;
+
+        if (num == current_ip.load())
+            return; // resumed host - keep its progress
+
+        generation.fetch_add(1, std::memory_order_acq_rel);
+        for (size_t i = 0; i < done_words; i++)
+            done[i].store(0, std::memory_order_relaxed);
+        current_ip.store(num, std::memory_order_release);
+        generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    void Checkpoint::finish() {
+        completed = true;
+    }
+
+    void Checkpoint::addResult(const IpAddress& ip, uint16_t port, CONNECTION_TYPE type) {
+        std::lock_guard<std::mutex> lock(results_mutex);
+        results.push_back({ip.getAsAddr().num, port, type});
+    }
+}
@@ -0,0 +1,125 @@
+/**
+ * Checkpoint.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Periodic snapshots of the scan progress, so a long scan
+ * can be resumed after it was interrupted.
+ *
+ * Hosts are scanned one after another, so the whole position
+ * of the scan is the current host and a bitmap of its ports,
+ * that were already probed. Workers only set a bit in the bitmap
+ * (one relaxed atomic operation), the file itself is written
+ * by a separate thread every few seconds.
+*/
+
+#ifndef PORTSCAN_CHECKPOINT_H
+#define PORTSCAN_CHECKPOINT_H
+
+#include "../net/IpAddress.h"
+#include "../net/ServicesDictionary.h"
+#include "Shard.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+namespace scanner {
+    using namespace net;
+
+    struct scanResult {
+        ipv4 ip = 0; // as stored in IpAddress (network order)
+        uint16_t port = 0;
+        CONNECTION_TYPE protocol = TCP;
+    };
+
+    class Checkpoint {
+    private:
+        std::string filename;
+        int interval; // in seconds
+
+        // description of the scan, which has to match on resume
+        ipv4 first_ip = 0, last_ip = 0;
+        uint16_t from = 0, to = 0;
+        CONNECTION_TYPE protocol = ALL;
+        Shard shard{};
+        int sample_percent = 100;
+        uint64_t sample_seed = 0;
+
+        // position of the scan
+        std::atomic<ipv4> current_ip{0};
+        std::atomic<uint32_t> generation{0}; // odd while the host is being switched
+        std::unique_ptr<std::atomic<uint64_t>[]> done;
+        size_t done_words = 0;
+        std::atomic<bool> completed{false};
+
+        std::vector<scanResult> results;
+        std::mutex results_mutex;
+
+        std::thread writer;
+        std::mutex writer_mutex;
+        std::condition_variable writer_wakeup;
+        bool is_running = false;
+
+        void writerLoop();
+        bool snapshot(ipv4& ip, std::vector<uint64_t>& bits);
+    public:
+        Checkpoint(const std::string& filename, int interval_in_seconds);
+        ~Checkpoint() { stop(); }
+
+        /**
+         * Describe the scan. Must be called before load() and start().
+        */
+        void setRange(const IpAddress& first, const IpAddress& last, uint16_t port_from, uint16_t port_to, CONNECTION_TYPE type);
+
+        /**
+         * Ports of the range, which belong to this scan (--shard, --sample).
+         * Sample seed 0 is taken from the file by load().
+        */
+        void setSelection(const Shard& selected, int percent, uint64_t seed);
+
+        /**
+         * Read previous state from the file.
+         * Throws std::runtime_error if the file doesn't describe the same scan.
+        */
+        void load();
+
+        void start();
+        void stop();
+        void save();
+
+        /**
+         * Called by the scanning loop, after all probes
+         * of the previous host have finished.
+        */
+        void beginHost(const IpAddress& ip);
+        void finish();
+
+        // hot path - called by workers
+        void markDone(uint16_t port) {
+            uint32_t idx = port - from;
+            done[idx >> 6].fetch_or(uint64_t(1) << (idx & 63), std::memory_order_release);
+        }
+        bool isDone(uint16_t port) const {
+            uint32_t idx = port - from;
+            return (done[idx >> 6].load(std::memory_order_relaxed) >> (idx & 63)) & 1;
+        }
+        void addResult(const IpAddress& ip, uint16_t port, CONNECTION_TYPE type);
+
+        // Getters
+        IpAddress getCurrentHost() const { return IpAddress(current_ip.load()); }
+        bool isCompleted() const { return completed; }
+        uint64_t getSampleSeed() const { return sample_seed; }
+        const std::vector<scanResult>& getResults() const { return results; }
+    };
+}
+
+#endif //PORTSCAN_CHECKPOINT_H
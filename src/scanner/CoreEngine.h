@@ -0,0 +1,76 @@
+/**
+ * CoreEngine.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * State of one engine of the --per-core mode. Every engine is an event loop
+ * pinned to its own core, which takes every n-th pending port of a host
+ * and starts their probes by itself - so there is no shared queue,
+ * no shared counter of probes in flight and no print mutex on the way.
+ * Everything here is touched only by the engine's thread (its memory
+ * is allocated there as well), until the host is over and the main
+ * thread reads the results.
+*/
+
+#ifndef PORTSCAN_COREENGINE_H
+#define PORTSCAN_COREENGINE_H
+
+#include "../async/EventLoop.h"
+#include "../net/ServicesDictionary.h"
+#include "PortState.h"
+
+#include <coroutine>
+#include <vector>
+#include <cstdint>
+
+namespace scanner {
+    /**
+     * Result of a probe, before it's reported.
+    */
+    struct probeResult {
+        uint16_t port = 0;
+        net::CONNECTION_TYPE protocol = net::TCP;
+        PORT_STATE state = CLOSED;
+        bool waits_for_banner = false; // the port is marked as done by the banner grabber
+    };
+
+    struct CoreEngine {
+        size_t limit = 1; // probes in flight
+        size_t in_flight = 0;
+        async::EventLoop::clock::duration interval{0}; // between probes, 0 = no rate limit
+
+        std::vector<probeResult> results; // of the current host
+
+        std::coroutine_handle<> feeder; // waiting for a free slot
+
+        struct slotAwaiter {
+            CoreEngine& engine;
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) noexcept { engine.feeder = h; }
+            void await_resume() const noexcept {}
+        };
+
+        /**
+         * Suspends the feeder until one of the probes is over.
+        */
+        slotAwaiter slot() { return slotAwaiter{*this}; }
+
+        /**
+         * The probe is over - resume the feeder, if it's waiting.
+        */
+        void release() {
+            in_flight--;
+            if (feeder) {
+                auto h = feeder;
+                feeder = nullptr;
+                h.resume();
+            }
+        }
+    };
+}
+
+#endif //PORTSCAN_COREENGINE_H
@@ -0,0 +1,468 @@
+/**
+ * Daemon.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "Daemon.h"
+
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <deque>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+namespace scanner {
+
+    Daemon::Daemon(const std::string& path, flags defaults) : path(path), defaults(std::move(defaults)) {
+        struct sockaddr_un addr{};
+        struct stat st{};
+
+        if (path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("ERROR: Socket path `" + path + "` is too long");
+        }
+
+        // jobs share the engine - everything written per scan is turned off
+        flags& f = this->defaults;
+        f.b_print = false;
+        f.b_coroutines = true;
+        f.s_checkpoint_file.clear();
+        f.b_resume = false;
+        f.s_output_file.clear();
+        f.s_metrics_file.clear();
+        f.i_metrics_port = 0;
+        f.b_progress = false;
+        f.s_trace_file.clear();
+        f.s_capture_file.clear();
+        f.s_journal_file.clear();
+        f.s_baseline_file.clear();
+
+        engine = std::make_shared<Engine>();
+        engine->services = std::make_shared<ServicesDictionary>();
+        engine->payloads = std::make_shared<UdpPayloads>();
+        std::cout << "Loaded " << engine->services->size() << " known ports.." << std::endl
+                  << "Loaded " << engine->payloads->size() << " UDP payloads.." << std::endl;
+
+        engine->executor = std::make_unique<Executor>(f.i_thread_count, probe_limit(f));
+        engine->executor->setInterval(probe_interval(f));
+
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+        // a socket left by a daemon, which hasn't exited cleanly - but not the one of a running daemon
+        if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+            int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+            bool is_alive = probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+
+            if (probe >= 0)
+                close(probe);
+            if (is_alive) {
+                throw std::runtime_error("ERROR: Another daemon is listening on `" + path + "`");
+            }
+            unlink(path.c_str());
+        }
+
+        listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_socket >= 0) {
+            mode_t mask = umask(077); // only the owner may start scans (no window before a chmod)
+            int res = bind(listen_socket, (struct sockaddr*)&addr, sizeof(addr));
+
+            umask(mask);
+            if (res != 0 || listen(listen_socket, 64) != 0) {
+                int error = errno;
+
+                close(listen_socket);
+                throw std::runtime_error("ERROR: Cannot listen on `" + path + "` (" + std::strerror(error) + ")");
+            }
+        } else {
+            throw std::runtime_error("ERROR: Cannot listen on `" + path + "` (" + std::strerror(errno) + ")");
+        }
+
+        if (pipe(wakeup_pipe) != 0) {
+            close(listen_socket);
+            unlink(path.c_str());
+            throw std::runtime_error("ERROR: Cannot create pipe for the daemon");
+        }
+    }
+
+    Daemon::~Daemon() {
+        close(listen_socket);
+        unlink(path.c_str());
+        close(wakeup_pipe[0]);
+        close(wakeup_pipe[1]);
+    }
+
+    void Daemon::run() {
+        std::cout << "Waiting for scans on " << path << std::endl;
+
+        while (!stopping) {
+            pollfd fds[2] = {{wakeup_pipe[0], POLLIN, 0}, {listen_socket, POLLIN, 0}};
+
+            if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+                std::cerr << "WARNING: Daemon cannot wait for connections (" << std::strerror(errno) << ")\n";
+                break;
+            }
+            if (fds[0].revents & POLLIN) {
+                break;
+            }
+
+            if (fds[1].revents & POLLIN) {
+                int client = accept(listen_socket, nullptr, nullptr);
+
+                if (client >= 0) {
+                    std::lock_guard<std::mutex> lock(clients_mutex);
+                    clients++;
+                    std::thread(&Daemon::serve, this, client).detach();
+                }
+            }
+        }
+
+        stopping = true; // connections cancel their jobs
+        std::unique_lock<std::mutex> lock(clients_mutex);
+        idle.wait(lock, [this]() {
+            return clients == 0;
+        });
+    }
+
+    void Daemon::stop() {
+        char c = 1;
+
+        stopping = true;
+        (void) !write(wakeup_pipe[1], &c, 1);
+    }
+
+    void Daemon::serve(int client) {
+        std::string buffer;
+        char chunk[1024];
+
+        while (!stopping) {
+            size_t eol = buffer.find('\n');
+
+            if (eol == std::string::npos) {
+                pollfd pfd{client, POLLIN, 0};
+
+                if (buffer.size() > DAEMON_MAX_REQUEST) {
+                    send_line(client, "# ERROR: Request is too long");
+                    break;
+                }
+                if (poll(&pfd, 1, DAEMON_POLL_MS) <= 0)
+                    continue;
+
+                ssize_t n = recv(client, chunk, sizeof(chunk), 0);
+                if (n <= 0)
+                    break;
+                buffer.append(chunk, n);
+                continue;
+            }
+
+            std::string request = buffer.substr(0, eol);
+            buffer.erase(0, eol + 1);
+            if (!request.empty() && request.back() == '\r')
+                request.pop_back();
+
+            if (request.empty() || request == "CANCEL")
+                continue; // nothing is running
+            if (!run_job(client, request, buffer))
+                break;
+        }
+
+        close(client);
+
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        clients--;
+        idle.notify_all();
+    }
+
+    bool Daemon::run_job(int client, const std::string& request, std::string& buffer) {
+        std::string ip, mask, error;
+        flags f = defaults;
+        std::unique_ptr<PortScanner> scanner;
+
+        if (!parse_job(request, ip, mask, f, error)) {
+            return send_line(client, "# ERROR: " + error);
+        }
+
+        try {
+            scanner = std::make_unique<PortScanner>(ip, mask, f, engine);
+        } catch (const std::exception& e) {
+            return send_line(client, std::string("# ") + e.what());
+        }
+
+        uint64_t job = next_job++;
+        std::mutex results_mutex;
+        std::deque<std::string> pending; // results the client hasn't taken yet
+        bool paused = false;
+        std::atomic<bool> connected{true};
+        std::atomic<bool> done{false};
+        uint64_t results = 0;
+        int wakeup[2]; // the job has new results or is done
+
+        if (pipe(wakeup) != 0) {
+            return send_line(client, "# ERROR: Cannot create pipe for the job");
+        }
+        fcntl(wakeup[0], F_SETFL, O_NONBLOCK);
+        fcntl(wakeup[1], F_SETFL, O_NONBLOCK);
+
+        // called on the shared event loops - it never waits for the client,
+        // a full queue pauses only this job
+        scanner->setResultCallback([&](const portResult& r) {
+            std::string line = r.ip.getAsString() + " " + std::to_string(r.port) + (r.protocol == TCP ? "/tcp " : "/udp ")
+                + state_name(r.state) + " " + r.service;
+            bool was_empty;
+            char c = 1;
+
+            {
+                std::lock_guard<std::mutex> lock(results_mutex);
+
+                results++;
+                if (!connected)
+                    return;
+                was_empty = pending.empty();
+                pending.push_back(std::move(line));
+                if (pending.size() >= DAEMON_MAX_RESULTS && !paused) {
+                    paused = true;
+                    scanner->pause(true);
+                }
+            }
+            if (was_empty)
+                (void) !write(wakeup[1], &c, 1);
+        });
+
+        if (!send_line(client, "# job " + std::to_string(job) + " started")) {
+            close(wakeup[0]);
+            close(wakeup[1]);
+            return false;
+        }
+
+        std::exception_ptr failure;
+        std::thread worker([&]() {
+            char c = 1;
+
+            try {
+                scanner->scan();
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            done = true;
+            (void) !write(wakeup[1], &c, 1);
+        });
+
+        // meanwhile write the results, and watch the connection for CANCEL and hang ups
+        std::string out; // results taken from the queue, not sent yet
+        bool stop_sent = false;
+
+        if (take_cancel(buffer)) {
+            scanner->cancel(); // sent together with the request
+        }
+
+        while (connected) {
+            bool is_empty;
+
+            {
+                std::lock_guard<std::mutex> lock(results_mutex);
+
+                while (!pending.empty() && out.size() < DAEMON_MAX_REQUEST * 16) {
+                    out += pending.front() + "\n";
+                    pending.pop_front();
+                }
+                if (paused && pending.size() <= DAEMON_MAX_RESULTS / 2) {
+                    paused = false;
+                    scanner->pause(false);
+                }
+                is_empty = pending.empty() && out.empty();
+            }
+
+            if (done && (is_empty || stopping)) {
+                break; // a stopping daemon doesn't wait for slow clients
+            }
+            if (stopping && !stop_sent) {
+                stop_sent = true;
+                scanner->cancel();
+            }
+
+            pollfd fds[2] = {{wakeup[0], POLLIN, 0}, {client, static_cast<short>(POLLIN | (out.empty() ? 0 : POLLOUT)), 0}};
+            char chunk[1024];
+
+            if (poll(fds, 2, DAEMON_POLL_MS) <= 0)
+                continue;
+
+            if (fds[0].revents & POLLIN) {
+                while (read(wakeup[0], chunk, sizeof(chunk)) > 0);
+            }
+
+            if (fds[1].revents & POLLOUT) {
+                ssize_t n = send(client, out.data(), out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+
+                if (n > 0) {
+                    out.erase(0, n);
+                } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    connected = false;
+                    break;
+                }
+            }
+
+            if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n = recv(client, chunk, sizeof(chunk), MSG_DONTWAIT);
+
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    connected = false;
+                    break;
+                }
+                if (n > 0) {
+                    buffer.append(chunk, n);
+                    if (take_cancel(buffer))
+                        scanner->cancel();
+                }
+            }
+        }
+
+        if (!connected) {
+            scanner->cancel(); // nobody is listening
+        }
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            paused = false;
+        }
+        scanner->pause(false); // held back probes of a cancelled scan are dropped
+        worker.join();
+        close(wakeup[0]);
+        close(wakeup[1]);
+
+        if (!connected) {
+            return false;
+        }
+
+        std::string summary = "# job " + std::to_string(job);
+        if (failure) {
+            try {
+                std::rethrow_exception(failure);
+            } catch (const std::exception& e) {
+                summary += " failed: " + std::string(e.what());
+            } catch (...) {
+                summary += " failed";
+            }
+        } else if (scanner->is_cancelled()) {
+            summary += " cancelled, " + std::to_string(results) + " open ports";
+        } else {
+            summary += " done, " + std::to_string(results) + " open ports";
+        }
+
+        return send_line(client, summary);
+    }
+
+    bool Daemon::parse_job(const std::string& request, std::string& ip, std::string& mask, flags& f, std::string& error) {
+        std::istringstream ss(request);
+        std::vector<std::string> args;
+        std::string arg;
+
+        while (ss >> arg)
+            args.push_back(arg);
+
+        auto is_number = [](const std::string& s) {
+            return !s.empty() && s.find_first_not_of("0123456789") == std::string::npos;
+        };
+
+        for (size_t i = 0; i < args.size(); i++) {
+            std::string opt = args[i];
+
+            if (opt[0] != '-' && !isalpha(opt[0])) {
+                // the same as on the command line: "<ip> <mask>" or "<ip>/<mask>"
+                if (ip.empty()) {
+                    auto slash = opt.find('/');
+                    ip = opt.substr(0, slash);
+                    if (slash != std::string::npos)
+                        mask = opt.substr(slash);
+                } else if (mask.empty()) {
+                    mask = opt;
+                }
+                continue;
+            }
+
+            opt = opt.substr(1);
+            for (auto& c : opt)
+                c = static_cast<char>(std::tolower(c));
+
+            if (opt == "tcp") {
+                f.ct_protocol = TCP;
+            } else if (opt == "udp") {
+                f.ct_protocol = UDP;
+            } else if (opt == "all") {
+                f.ct_protocol = ALL;
+            } else if (opt == "p" && i + 2 < args.size() && is_number(args[i + 1]) && is_number(args[i + 2])) {
+                long from = std::strtol(args[i + 1].c_str(), nullptr, 10);
+                long to = std::strtol(args[i + 2].c_str(), nullptr, 10);
+
+                if (from > 65535 || to > 65535) {
+                    error = "Port out of range";
+                    return false;
+                }
+                f.pr_range = {static_cast<port>(std::min(from, to)), static_cast<port>(std::max(from, to))};
+                i += 2;
+            } else if (opt == "t" && i + 1 < args.size() && is_number(args[i + 1])) {
+                long ms = std::strtol(args[++i].c_str(), nullptr, 10);
+
+                f.t_timeout = f.t_min_timeout = f.t_max_timeout = {ms / 1000, (ms % 1000) * 1000};
+            } else if (opt.size() == 2 && opt[0] == 't' && opt[1] >= '0' && opt[1] <= '5') {
+                set_timing(f, Timing::get(opt[1] - '0'));
+            } else if (opt == "-filtered-cutoff" && i + 1 < args.size() && is_number(args[i + 1])) {
+                f.i_filtered_cutoff = static_cast<int>(std::strtol(args[++i].c_str(), nullptr, 10));
+            } else if (opt == "-banners") {
+                f.b_banners = true;
+            } else if (opt == "-no-payloads") {
+                f.b_udp_payloads = false;
+            } else {
+                error = "Unknown option `" + args[i] + "`";
+                return false;
+            }
+        }
+
+        if (ip.empty() || mask.empty()) {
+            error = "Missing IP or MASK parameter";
+            return false;
+        }
+        return true;
+    }
+
+    bool Daemon::take_cancel(std::string& buffer) {
+        size_t start = 0, end = 0;
+
+        while ((end = buffer.find('\n', start)) != std::string::npos) {
+            std::string line = buffer.substr(start, end - start);
+
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line == "CANCEL") {
+                buffer.erase(start, end + 1 - start); // the requests around it stay
+                return true;
+            }
+            start = end + 1;
+        }
+        return false;
+    }
+
+    bool Daemon::send_line(int client, const std::string& line) {
+        std::string data = line + "\n";
+        size_t sent = 0;
+
+        while (sent < data.size()) {
+            ssize_t n = send(client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                return false;
+            sent += n;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,95 @@
+/**
+ * Daemon.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Long-running scanner, which takes jobs over a UNIX socket (--daemon).
+ * The services table, payloads and event loops are built once (see Engine),
+ * so a small scan doesn't pay for them again. Scans of all clients run
+ * at the same time as --crazy scans on the shared event loops, each
+ * with a fair share of the sockets and of the probe rate (--rate).
+ *
+ * Protocol - lines of text, one job per line, jobs of one connection
+ * run one after another:
+ *
+ *      -> 10.0.0.0/24 -p 1 1024 -TCP -T4 --banners
+ *      <- # job 7 started
+ *      <- 10.0.0.5 22/tcp open ssh (OpenSSH_9.3)        (the same as -o lines)
+ *      <- # job 7 done, 1 open ports
+ *
+ * "CANCEL" stops the running job of the connection, closing
+ * the connection does the same. Errors come as "# ERROR: ..." lines.
+ *
+ * Results wait for the client in a queue of the job and its own thread
+ * writes them - the event loops never do. A client, which doesn't read,
+ * pauses only its own job, when the queue is full.
+*/
+
+#ifndef PORTSCAN_DAEMON_H
+#define PORTSCAN_DAEMON_H
+
+#include "PortScanner.h"
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#define DAEMON_POLL_MS 200 // how fast connections notice the end of the daemon
+#define DAEMON_MAX_REQUEST 4096
+#define DAEMON_MAX_RESULTS 1024 // lines waiting for a slow client, new probes of the job wait above it
+
+namespace scanner {
+    class Daemon {
+    private:
+        std::string path;
+        flags defaults;
+        std::shared_ptr<Engine> engine;
+
+        int listen_socket = -1;
+        int wakeup_pipe[2] = {-1, -1};
+        std::atomic<bool> stopping{false};
+        std::atomic<uint64_t> next_job{1};
+
+        size_t clients = 0;
+        std::mutex clients_mutex;
+        std::condition_variable idle;
+
+        void serve(int client);
+        /**
+         * Returns false, when the client is gone.
+         * @param buffer bytes received after the request (the next requests)
+        */
+        bool run_job(int client, const std::string& request, std::string& buffer);
+        bool parse_job(const std::string& request, std::string& ip, std::string& mask, flags& f, std::string& error);
+        /**
+         * Removes the first CANCEL line of the buffer, wherever it is - the next
+         * requests may come before it. Returns false, if there is none.
+        */
+        static bool take_cancel(std::string& buffer);
+        static bool send_line(int client, const std::string& line);
+    public:
+        /**
+         * @param defaults settings of every job, which the job doesn't change
+         * Throws std::runtime_error, if the socket can't be created.
+        */
+        Daemon(const std::string& path, flags defaults);
+        ~Daemon();
+
+        /**
+         * Accept jobs until stop(), then cancel the running ones and wait for them.
+        */
+        void run();
+
+        /**
+         * Safe to call from a signal handler.
+        */
+        void stop();
+    };
+}
+
+#endif //PORTSCAN_DAEMON_H
@@ -0,0 +1,61 @@
+/**
+ * Deadline.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "Deadline.h"
+
+#include <algorithm>
+
+namespace scanner {
+
+    Deadline::Deadline(std::chrono::seconds budget, std::function<void()> on_expired)
+            : budget(budget), on_expired(std::move(on_expired)) {}
+
+    void Deadline::start() {
+        started = clock::now();
+        is_running = true;
+        timer = std::thread(&Deadline::timerLoop, this);
+    }
+
+    void Deadline::stop() {
+        {
+            std::lock_guard<std::mutex> lock(timer_mutex);
+            if (!is_running)
+                return;
+            is_running = false;
+        }
+        timer_wakeup.notify_all();
+        timer.join();
+    }
+
+    void Deadline::timerLoop() {
+        std::unique_lock<std::mutex> lock(timer_mutex);
+
+        if (timer_wakeup.wait_until(lock, started + budget, [this]() { return !is_running; })) {
+            return; // the scan is over in time
+        }
+
+        is_expired.store(true, std::memory_order_relaxed);
+        lock.unlock();
+        on_expired();
+    }
+
+    Deadline::clock::duration Deadline::remaining() const {
+        return std::max(started + budget - clock::now(), clock::duration::zero());
+    }
+
+    double Deadline::rate() const {
+        double seconds = std::chrono::duration<double>(elapsed()).count();
+
+        return seconds > 0 ? static_cast<double>(getProbes()) / seconds : 0;
+    }
+
+    uint64_t Deadline::affordable() const {
+        return static_cast<uint64_t>(rate() * std::chrono::duration<double>(remaining()).count());
+    }
+}
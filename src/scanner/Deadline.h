@@ -0,0 +1,79 @@
+/**
+ * Deadline.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Wall clock budget of the scan (--max-duration). Measures how many
+ * probes per second the scan really finishes, so the scheduler knows,
+ * how much of the range still fits into the rest of the budget,
+ * and calls back once the time is over.
+ *
+ * The scanner spends the budget in passes over all hosts - every pass
+ * takes the next slice of the ports, the most common services first,
+ * and hosts, which have answered before, go first. So when the time
+ * runs out, every host got its most likely open ports probed,
+ * instead of the first hosts got all of theirs.
+*/
+
+#ifndef PORTSCAN_DEADLINE_H
+#define PORTSCAN_DEADLINE_H
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+
+#define DEADLINE_FIRST_PORTS 100 // per host in the first pass, before the rate is known
+#define DEADLINE_MIN_PORTS 100 // the smallest slice of the later passes
+
+namespace scanner {
+    class Deadline {
+    public:
+        typedef std::chrono::steady_clock clock;
+    private:
+        clock::duration budget;
+        clock::time_point started;
+        std::atomic<uint64_t> probes{0};
+        std::function<void()> on_expired;
+
+        std::thread timer;
+        std::mutex timer_mutex;
+        std::condition_variable timer_wakeup;
+        bool is_running = false;
+        std::atomic<bool> is_expired{false};
+
+        void timerLoop();
+    public:
+        Deadline(std::chrono::seconds budget, std::function<void()> on_expired);
+        ~Deadline() { stop(); }
+
+        void start();
+        void stop();
+
+        // counts the probes of the budget, nothing else
+        void probeDone() { probes.fetch_add(1, std::memory_order_relaxed); }
+
+        uint64_t getProbes() const { return probes.load(std::memory_order_relaxed); }
+        bool expired() const { return is_expired.load(std::memory_order_relaxed); }
+        clock::duration elapsed() const { return clock::now() - started; }
+        clock::duration remaining() const;
+
+        /**
+         * Probes finished per second since the start.
+        */
+        double rate() const;
+
+        /**
+         * Probes, which fit into the rest of the budget at the current rate.
+        */
+        uint64_t affordable() const;
+    };
+}
+
+#endif //PORTSCAN_DEADLINE_H
@@ -0,0 +1,36 @@
+/**
+ * Engine.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Parts of the scanner, which are expensive to build and can outlive
+ * a single scan: the services table, UDP payloads and the event loops.
+ * The daemon keeps one engine warm and gives it to every PortScanner,
+ * so a small scan starts probing right away.
+*/
+
+#ifndef PORTSCAN_ENGINE_H
+#define PORTSCAN_ENGINE_H
+
+#include "../net/ServicesDictionary.h"
+#include "../net/UdpPayloads.h"
+#ifdef __linux__
+#   include "../async/Executor.h"
+#endif
+
+#include <memory>
+
+namespace scanner {
+    struct Engine {
+        std::shared_ptr<net::ServicesDictionary> services;
+        std::shared_ptr<net::UdpPayloads> payloads;
+#ifdef __linux__
+        std::unique_ptr<async::Executor> executor; // shared by --crazy scans, fairly
+#endif
+    };
+}
+
+#endif //PORTSCAN_ENGINE_H
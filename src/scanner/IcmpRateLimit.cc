@@ -0,0 +1,100 @@
+/**
+ * IcmpRateLimit.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "IcmpRateLimit.h"
+
+#include <thread>
+#include <algorithm>
+#include <cmath>
+
+namespace scanner {
+
+    void IcmpRateLimit::evaluate(clock::time_point now) {
+        if (window_start == clock::time_point{}) {
+            window_start = now;
+            return;
+        }
+        if (now - window_start < std::chrono::milliseconds(ICMP_WINDOW_MS)) {
+            return;
+        }
+
+        double seconds = std::chrono::duration<double>(now - window_start).count();
+
+        if (retried_count > 0 && silent_count > icmp_count) {
+            // silent ports answer on retries - as many ICMP as the host allows
+            double measured = std::max(static_cast<double>(icmp_count) / seconds, ICMP_MIN_RATE);
+
+            if (rate == 0)
+                next = now; // paced from now on
+            rate = measured;
+        } else if (rate > 0) {
+            // no proof of the limit - a bit faster, for every window that has passed
+            rate *= std::pow(1.25, seconds * 1000 / ICMP_WINDOW_MS);
+            if (rate > ICMP_MAX_RATE)
+                rate = 0;
+        }
+
+        window_start = now;
+        icmp_count = 0;
+        retried_count = 0;
+        silent_count = 0;
+    }
+
+    void IcmpRateLimit::reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        window_start = {};
+        icmp_count = 0;
+        retried_count = 0;
+        silent_count = 0;
+        rate = 0;
+        next = {};
+    }
+
+    void IcmpRateLimit::unreachable(bool retried, uint64_t n) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        evaluate(clock::now());
+        icmp_count += n;
+        if (retried)
+            retried_count += n;
+    }
+
+    void IcmpRateLimit::silent(uint64_t n) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        evaluate(clock::now());
+        silent_count += n;
+    }
+
+    IcmpRateLimit::clock::time_point IcmpRateLimit::reserve() {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto now = clock::now();
+
+        evaluate(now);
+        if (rate == 0) {
+            return now;
+        }
+
+        if (next < now)
+            next = now; // no credit for the idle time
+        auto at = next;
+        next += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / rate));
+        return at;
+    }
+
+    void IcmpRateLimit::wait() {
+        std::this_thread::sleep_until(reserve());
+    }
+
+    double IcmpRateLimit::getRate() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return rate;
+    }
+}
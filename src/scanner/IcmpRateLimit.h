@@ -0,0 +1,80 @@
+/**
+ * IcmpRateLimit.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Pacing of UDP probes to the rate, at which the host sends
+ * ICMP port unreachable. Linux and most routers send only a few
+ * of them per second, the rest of the closed ports stay silent and
+ * would be reported as open|filtered after all retries.
+ *
+ * Answers are counted in windows of ICMP_WINDOW_MS. Silence alone proves
+ * nothing - a firewall, which drops some ports and rejects the rest, looks
+ * the same. The host limits ICMP only when ports, which were silent, send
+ * it on a retry: then, if most tries of the window got nothing, its rate
+ * is the number of ICMP in the window. From then on every try (retries
+ * included) waits for its turn, so each closed port gets its ICMP.
+ * Every window without such a retry raises the rate by a quarter, until
+ * the host is (nearly) not limited or starts dropping ICMP again.
+ *
+ * One host at a time - reset() at the start of the next one.
+*/
+
+#ifndef PORTSCAN_ICMPRATELIMIT_H
+#define PORTSCAN_ICMPRATELIMIT_H
+
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+
+#define ICMP_WINDOW_MS 1000
+#define ICMP_MIN_RATE 0.5 // per second
+#define ICMP_MAX_RATE 100000 // faster than that is not limited at all
+
+namespace scanner {
+    class IcmpRateLimit {
+    public:
+        typedef std::chrono::steady_clock clock;
+    private:
+        std::mutex mutex;
+        clock::time_point window_start{};
+        uint64_t icmp_count = 0; // in the window
+        uint64_t retried_count = 0; // ICMP of ports, which were silent before
+        uint64_t silent_count = 0;
+        double rate = 0; // ICMP per second, 0 = not limited
+        clock::time_point next{}; // the turn of the next try
+
+        void evaluate(clock::time_point now);
+    public:
+        void reset();
+
+        /**
+         * A try of a probe got ICMP unreachable.
+         * @param retried the previous tries of the port got nothing
+        */
+        void unreachable(bool retried, uint64_t n = 1);
+
+        /**
+         * Tries, which got no answer at all.
+        */
+        void silent(uint64_t n = 1);
+
+        /**
+         * Reserve the turn of the next try.
+         * @return when it may be sent (now, if the host isn't limited)
+        */
+        clock::time_point reserve();
+
+        /**
+         * The same as reserve(), but sleeps until the turn.
+        */
+        void wait();
+
+        double getRate();
+    };
+}
+
+#endif //PORTSCAN_ICMPRATELIMIT_H
@@ -0,0 +1,102 @@
+/**
+ * Journal.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "Journal.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+
+namespace scanner {
+
+    Journal::Journal(const std::string& filename)
+            : shards([](shard& s) { s.records.reserve(JOURNAL_BLOCK_RECORDS); }), run(now()) {
+        std::ifstream existing(filename, std::ios::in | std::ios::binary);
+        char magic[sizeof(JOURNAL_MAGIC) - 1];
+        bool is_new = !existing.good() || existing.peek() == std::ifstream::traits_type::eof();
+
+        if (!is_new && (!existing.read(magic, sizeof(magic)) || memcmp(magic, JOURNAL_MAGIC, sizeof(magic)) != 0)) {
+            throw std::runtime_error("ERROR: `" + filename + "` is not a portscan journal");
+        }
+        existing.close();
+
+        file.open(filename, std::ios::out | std::ios::binary | std::ios::app);
+        if (!file.good()) {
+            throw std::runtime_error("ERROR: Cannot open journal `" + filename + "`");
+        }
+
+        if (is_new) {
+            uint32_t sizes[2] = {sizeof(journalBlock), sizeof(journalRecord)};
+
+            file.write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1);
+            file.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+            file.flush();
+        }
+    }
+
+    uint64_t Journal::now() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(clock::now().time_since_epoch()).count();
+    }
+
+    void Journal::add(const IpAddress& ip, uint16_t port, CONNECTION_TYPE protocol, PORT_STATE state,
+                      std::chrono::microseconds rtt) {
+        shard& s = shards.local();
+        journalBlock& b = s.block;
+        uint64_t time = now();
+        ipv4 host = ip.getAsNetNumber();
+
+        if (s.records.empty()) {
+            b = journalBlock{};
+            memcpy(b.magic, JOURNAL_BLOCK_MAGIC, sizeof(b.magic));
+            b.run = run;
+            b.first_time = time;
+            b.ip_min = host;
+            b.ip_max = host;
+        }
+
+        b.last_time = time;
+        b.ip_min = std::min(b.ip_min, host);
+        b.ip_max = std::max(b.ip_max, host);
+        b.states[state]++;
+        b.protocols |= static_cast<uint8_t>(1 << protocol);
+
+        s.records.push_back({
+            static_cast<uint32_t>(std::min<uint64_t>(time - b.first_time, UINT32_MAX)),
+            ip.getAsAddr().num, port, static_cast<uint8_t>(protocol), static_cast<uint8_t>(state),
+            static_cast<uint32_t>(std::clamp<int64_t>(rtt.count(), 0, UINT32_MAX))
+        });
+
+        if (s.records.size() >= JOURNAL_BLOCK_RECORDS) {
+            write(s);
+        }
+    }
+
+    void Journal::write(shard& s) {
+        s.block.count = static_cast<uint32_t>(s.records.size());
+
+        {
+            // the block goes in one piece - blocks of the threads don't interleave
+            std::lock_guard<std::mutex> lock(file_mutex);
+
+            file.write(reinterpret_cast<const char*>(&s.block), sizeof(s.block));
+            file.write(reinterpret_cast<const char*>(s.records.data()),
+                       static_cast<std::streamsize>(s.records.size() * sizeof(journalRecord)));
+            file.flush();
+        }
+        s.records.clear();
+    }
+
+    void Journal::flush() {
+        shards.forEach([this](shard& s) {
+            if (!s.records.empty())
+                write(s);
+        });
+    }
+}
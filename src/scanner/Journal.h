@@ -0,0 +1,115 @@
+/**
+ * Journal.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Binary journal of every probe (--journal) - open, closed and filtered
+ * ports alike, with their round trip and time. Runs append to the same
+ * file, and portscan-query filters and aggregates any number of them
+ * block by block, without loading them.
+ *
+ * Every thread fills its own block of JOURNAL_BLOCK_RECORDS records
+ * (no locks on the way), which is appended as a whole, when it's full.
+ * The header of the block is an index of it: a reader skips blocks
+ * of other hosts, times or states without reading their records.
+ * All parts are fixed size and 8 byte aligned, so the file can be
+ * read as it is (mmap) as well.
+ *
+ * File format (little endian):
+ *
+ *      "PSJRNL01"
+ *      uint32 size of the block header, uint32 size of the record
+ *      blocks[...]:
+ *          journalBlock
+ *          journalRecord[count]
+*/
+
+#ifndef PORTSCAN_JOURNAL_H
+#define PORTSCAN_JOURNAL_H
+
+#include "../net/IpAddress.h"
+#include "../net/ServicesDictionary.h"
+#include "../async/PerThread.h"
+#include "PortState.h"
+
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+
+#define JOURNAL_MAGIC "PSJRNL01"
+#define JOURNAL_BLOCK_MAGIC "PSJB"
+#define JOURNAL_BLOCK_RECORDS 4096
+
+namespace scanner {
+    using namespace net;
+
+    struct journalRecord {
+        uint32_t time; // ms since the first record of the block
+        ipv4 ip; // network order, as in IpAddress
+        uint16_t port;
+        uint8_t protocol; // CONNECTION_TYPE
+        uint8_t state; // PORT_STATE
+        uint32_t rtt; // us from the start of the probe to its result (UDP with retries), 0 = unknown
+    };
+    static_assert(sizeof(journalRecord) == 16, "records are written as they are");
+
+    struct journalBlock {
+        char magic[4]; // JOURNAL_BLOCK_MAGIC
+        uint32_t count; // records
+        uint64_t run; // unix time in ms, when the scan, which wrote the block, has started
+        uint64_t first_time; // unix time in ms
+        uint64_t last_time;
+        uint32_t ip_min; // host order - ranges of addresses can be compared
+        uint32_t ip_max;
+        uint32_t states[PORT_STATES]; // records by state
+        uint8_t protocols; // bit per CONNECTION_TYPE
+        uint8_t reserved[7];
+    };
+    static_assert(sizeof(journalBlock) == 64, "headers are written as they are");
+
+    class Journal {
+    public:
+        typedef std::chrono::system_clock clock;
+    private:
+        struct shard {
+            journalBlock block{};
+            std::vector<journalRecord> records;
+        };
+
+        std::ofstream file;
+        std::mutex file_mutex;
+        async::PerThread<shard> shards;
+        uint64_t run;
+
+        void write(shard& s);
+    public:
+        /**
+         * Opens the journal for appending (creates it, if it doesn't exist).
+        */
+        explicit Journal(const std::string& filename);
+        ~Journal() { flush(); }
+
+        /**
+         * Buffers the record in the block of the calling thread, no lock
+         * until the block is full.
+        */
+        void add(const IpAddress& ip, uint16_t port, CONNECTION_TYPE protocol, PORT_STATE state,
+                 std::chrono::microseconds rtt);
+
+        /**
+         * Appends blocks, which aren't full yet. Threads should be idle by now.
+        */
+        void flush();
+
+        static uint64_t now();
+    };
+}
+
+#endif //PORTSCAN_JOURNAL_H
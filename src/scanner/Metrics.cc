@@ -0,0 +1,193 @@
+/**
+ * Metrics.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "Metrics.h"
+
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+namespace scanner {
+
+    Metrics::Metrics() : started(clock::now()) {}
+
+    void Metrics::error(int err) {
+        bump(local().errors[err > 0 && err < METRICS_MAX_ERRNO ? err : 0], 1);
+    }
+
+    void Metrics::observe(histogram h, clock::duration d) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        shard& s = local();
+
+        if (us < 0)
+            us = 0;
+        bump(s.buckets[h][bucketOf(us)], 1);
+        bump(s.sums[h], us);
+    }
+
+    void Metrics::probe(CONNECTION_TYPE protocol, int error) {
+        shard& s = local();
+        bool tcp = protocol == TCP;
+
+        bump(s.counters[tcp ? PROBES_TCP : PROBES_UDP], 1);
+
+        if (error == 0 || error == ECONNREFUSED) {
+            bump(s.counters[tcp ? REPLIES_TCP : REPLIES_UDP], 1);
+        } else if (error == ETIMEDOUT) {
+            bump(s.counters[tcp ? TIMEOUTS_TCP : TIMEOUTS_UDP], 1);
+        } else {
+            bump(s.errors[error > 0 && error < METRICS_MAX_ERRNO ? error : 0], 1);
+        }
+    }
+
+    size_t Metrics::bucketOf(uint64_t us) {
+        if (us < METRICS_SUB_BUCKETS)
+            return us;
+
+        int exponent = 63 - __builtin_clzll(us); // >= 3
+        if (exponent > METRICS_MAX_EXPONENT)
+            return METRICS_BUCKETS - 1;
+
+        size_t sub = (us >> (exponent - 3)) & (METRICS_SUB_BUCKETS - 1);
+        return (exponent - 2) * METRICS_SUB_BUCKETS + sub;
+    }
+
+    uint64_t Metrics::bucketUpperBound(size_t bucket) {
+        if (bucket < METRICS_SUB_BUCKETS)
+            return bucket + 1;
+
+        int exponent = static_cast<int>(bucket / METRICS_SUB_BUCKETS) + 2;
+        uint64_t sub = bucket % METRICS_SUB_BUCKETS;
+        return (METRICS_SUB_BUCKETS + sub + 1) << (exponent - 3);
+    }
+
+    void Metrics::collect(totals& t) {
+        shards.forEach([&t](shard& s) {
+            for (int i = 0; i < COUNTERS; i++)
+                t.counters[i] += s.counters[i].load(std::memory_order_relaxed);
+            for (int i = 0; i < METRICS_MAX_ERRNO; i++)
+                t.errors[i] += s.errors[i].load(std::memory_order_relaxed);
+            for (int h = 0; h < HISTOGRAMS; h++) {
+                for (int i = 0; i < METRICS_BUCKETS; i++)
+                    t.buckets[h][i] += s.buckets[h][i].load(std::memory_order_relaxed);
+                t.sums[h] += s.sums[h].load(std::memory_order_relaxed);
+            }
+        });
+    }
+
+    static const char* errno_name(int err) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 32)
+        const char* name = err > 0 ? strerrorname_np(err) : nullptr;
+        if (name != nullptr)
+            return name;
+#endif
+        return nullptr;
+    }
+
+    static void header(std::ostringstream& ss, const char* name, const char* type, const char* help) {
+        ss << "# HELP " << name << " " << help << "\n"
+           << "# TYPE " << name << " " << type << "\n";
+    }
+
+    /**
+     * Microseconds as exact seconds ("1.048576"), not rounded to 6 significant digits.
+    */
+    static std::string seconds(uint64_t us) {
+        std::string fraction = std::to_string(us % 1000000);
+
+        fraction.insert(0, 6 - fraction.size(), '0');
+        while (!fraction.empty() && fraction.back() == '0')
+            fraction.pop_back();
+        return std::to_string(us / 1000000) + (fraction.empty() ? "" : "." + fraction);
+    }
+
+    static void histogram_lines(std::ostringstream& ss, const char* name, const char* help, const uint64_t* buckets, uint64_t sum) {
+        uint64_t count = 0;
+        const double quantiles[] = {0.5, 0.9, 0.99};
+        size_t b = 0;
+
+        header(ss, name, "histogram", help);
+
+        // exported at powers of two - they are exact bounds of the sub-buckets
+        for (int exponent = 0; exponent <= METRICS_MAX_EXPONENT; exponent++) {
+            uint64_t le = uint64_t(1) << exponent;
+
+            while (b < METRICS_BUCKETS && Metrics::bucketUpperBound(b) <= le)
+                count += buckets[b++];
+            ss << name << "_bucket{le=\"" << seconds(le) << "\"} " << count << "\n";
+        }
+        while (b < METRICS_BUCKETS)
+            count += buckets[b++];
+
+        ss << name << "_bucket{le=\"+Inf\"} " << count << "\n"
+           << name << "_sum " << seconds(sum) << "\n"
+           << name << "_count " << count << "\n";
+
+        // full resolution of the sub-buckets is only visible in the quantiles
+        ss << "# TYPE " << name << "_quantile gauge\n";
+        for (double q : quantiles) {
+            uint64_t target = static_cast<uint64_t>(q * static_cast<double>(count) + 0.5);
+            uint64_t seen = 0, value = 0;
+
+            for (b = 0; b < METRICS_BUCKETS && count > 0; b++) {
+                seen += buckets[b];
+                if (seen >= target && seen > 0) {
+                    value = Metrics::bucketUpperBound(b);
+                    break;
+                }
+            }
+            ss << name << "_quantile{quantile=\"" << q << "\"} " << seconds(value) << "\n";
+        }
+    }
+
+    std::string Metrics::render() {
+        auto t = std::make_unique<totals>();
+        std::ostringstream ss;
+
+        collect(*t);
+
+        header(ss, "portscan_probes_sent_total", "counter", "Probes sent to the targets.");
+        ss << "portscan_probes_sent_total{protocol=\"tcp\"} " << t->counters[PROBES_TCP] << "\n"
+           << "portscan_probes_sent_total{protocol=\"udp\"} " << t->counters[PROBES_UDP] << "\n";
+
+        header(ss, "portscan_replies_total", "counter", "Probes answered by the target (open or closed).");
+        ss << "portscan_replies_total{protocol=\"tcp\"} " << t->counters[REPLIES_TCP] << "\n"
+           << "portscan_replies_total{protocol=\"udp\"} " << t->counters[REPLIES_UDP] << "\n";
+
+        header(ss, "portscan_timeouts_total", "counter", "Probes without any answer.");
+        ss << "portscan_timeouts_total{protocol=\"tcp\"} " << t->counters[TIMEOUTS_TCP] << "\n"
+           << "portscan_timeouts_total{protocol=\"udp\"} " << t->counters[TIMEOUTS_UDP] << "\n";
+
+        header(ss, "portscan_source_exhausted_total", "counter", "Connects delayed, because no local port was free.");
+        ss << "portscan_source_exhausted_total " << t->counters[SOURCE_EXHAUSTED] << "\n";
+        header(ss, "portscan_filtered_hosts_total", "counter", "Hosts skipped, because none of their probes was answered.");
+        ss << "portscan_filtered_hosts_total " << t->counters[FILTERED_HOSTS] << "\n";
+
+        header(ss, "portscan_errors_total", "counter", "Probes failed locally or rejected by the network, by errno.");
+        for (int i = 0; i < METRICS_MAX_ERRNO; i++) {
+            if (t->errors[i] == 0)
+                continue;
+
+            const char* name = errno_name(i);
+            ss << "portscan_errors_total{errno=\"" << (name != nullptr ? name : std::to_string(i)) << "\"} "
+               << t->errors[i] << "\n";
+        }
+
+        histogram_lines(ss, "portscan_connect_rtt_seconds", "Time from connect() to the answer of the target.",
+                        t->buckets[CONNECT_RTT], t->sums[CONNECT_RTT]);
+        histogram_lines(ss, "portscan_queue_wait_seconds", "Time between queueing the probe and its start.",
+                        t->buckets[QUEUE_WAIT], t->sums[QUEUE_WAIT]);
+
+        header(ss, "portscan_uptime_seconds", "gauge", "Time since the scan has started.");
+        ss << "portscan_uptime_seconds "
+           << std::chrono::duration<double>(clock::now() - started).count() << "\n";
+
+        return ss.str();
+    }
+}
@@ -0,0 +1,108 @@
+/**
+ * Metrics.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Counters and latency histograms of the running scan.
+ *
+ * Every thread writes only to its own shard (plain relaxed load + store,
+ * no locked instructions, no shared cache lines), and the reader sums
+ * all shards up, when the metrics are exported. The sum is not an atomic
+ * snapshot, but every single value in it is correct.
+ *
+ * Histograms are HDR-like: 8 linear sub-buckets for every power of two
+ * of microseconds, so the relative error is below 12.5% from 1us to 17min.
+*/
+
+#ifndef PORTSCAN_METRICS_H
+#define PORTSCAN_METRICS_H
+
+#include "../net/ServicesDictionary.h"
+#include "../async/PerThread.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+#define METRICS_SUB_BUCKETS 8 // per power of two
+#define METRICS_MAX_EXPONENT 30 // 2^30us ~ 17min, longer values land in the last bucket
+#define METRICS_BUCKETS ((METRICS_MAX_EXPONENT - 2) * METRICS_SUB_BUCKETS + METRICS_SUB_BUCKETS)
+#define METRICS_MAX_ERRNO 256
+
+namespace scanner {
+    using namespace net;
+
+    class Metrics {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        enum counter {
+            PROBES_TCP, PROBES_UDP,
+            REPLIES_TCP, REPLIES_UDP,
+            TIMEOUTS_TCP, TIMEOUTS_UDP,
+            SOURCE_EXHAUSTED, // connect() without a free local port, retried later
+            FILTERED_HOSTS, // cut off after --filtered-cutoff probes without an answer
+            COUNTERS
+        };
+
+        enum histogram {
+            CONNECT_RTT, // from connect() to the answer of the target
+            QUEUE_WAIT, // from the push to the pool (or spawn) to the start of the probe
+            HISTOGRAMS
+        };
+    private:
+        struct alignas(64) shard {
+            std::atomic<uint64_t> counters[COUNTERS]{};
+            std::atomic<uint64_t> errors[METRICS_MAX_ERRNO]{};
+            std::atomic<uint64_t> buckets[HISTOGRAMS][METRICS_BUCKETS]{};
+            std::atomic<uint64_t> sums[HISTOGRAMS]{}; // in microseconds
+        };
+
+        struct totals {
+            uint64_t counters[COUNTERS]{};
+            uint64_t errors[METRICS_MAX_ERRNO]{};
+            uint64_t buckets[HISTOGRAMS][METRICS_BUCKETS]{};
+            uint64_t sums[HISTOGRAMS]{};
+        };
+
+        async::PerThread<shard> shards;
+        clock::time_point started;
+
+        shard& local() { return shards.local(); }
+        void collect(totals& t);
+
+        // only the owner thread writes to its shard
+        static void bump(std::atomic<uint64_t>& value, uint64_t n) {
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+    public:
+        Metrics();
+
+        void add(counter c, uint64_t n = 1) { bump(local().counters[c], n); }
+        void error(int err);
+        void observe(histogram h, clock::duration d);
+
+        /**
+         * Count one finished probe.
+         * @param error 0 - open, ETIMEDOUT - no answer, ECONNREFUSED - closed, others - failed
+        */
+        void probe(CONNECTION_TYPE protocol, int error);
+
+        static size_t bucketOf(uint64_t us);
+        static uint64_t bucketUpperBound(size_t bucket); // in microseconds, exclusive
+
+        /**
+         * All metrics in the Prometheus text exposition format.
+        */
+        std::string render();
+    };
+}
+
+#endif //PORTSCAN_METRICS_H
@@ -0,0 +1,140 @@
+/**
+ * MetricsExporter.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "MetricsExporter.h"
+#include "../net/IpAddress.h"
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+
+#include <poll.h>
+
+namespace scanner {
+
+    MetricsExporter::MetricsExporter(Metrics& metrics, const std::string& filename, uint16_t port)
+            : metrics(metrics), filename(filename) {
+        if (port != 0) {
+            struct sockaddr_in addr{0};
+            int on = 1;
+
+            listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+            // metrics are for the operator, not for the scanned network
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(port);
+            addr.sin_family = AF_INET;
+
+            if (listen_socket < 0 || bind(listen_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0
+                || listen(listen_socket, 16) != 0) {
+                if (listen_socket >= 0)
+                    close(listen_socket);
+                throw std::runtime_error("ERROR: Cannot listen for metrics on 127.0.0.1:" + std::to_string(port));
+            }
+        }
+
+        if (pipe(wakeup_pipe) != 0) {
+            throw std::runtime_error("ERROR: Cannot create pipe for metrics exporter");
+        }
+
+        is_running = true;
+        worker = std::thread(&MetricsExporter::loop, this);
+    }
+
+    MetricsExporter::~MetricsExporter() {
+        char c = 1;
+
+        is_running = false;
+        (void) !write(wakeup_pipe[1], &c, 1);
+        worker.join();
+
+        writeFile(); // the final numbers
+
+        close(wakeup_pipe[0]);
+        close(wakeup_pipe[1]);
+        if (listen_socket >= 0)
+            close(listen_socket);
+    }
+
+    void MetricsExporter::loop() {
+        auto next_write = std::chrono::steady_clock::now() + std::chrono::seconds(METRICS_INTERVAL);
+
+        while (is_running) {
+            pollfd fds[2] = {{wakeup_pipe[0], POLLIN, 0}, {listen_socket, POLLIN, 0}};
+            auto wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                next_write - std::chrono::steady_clock::now()).count();
+
+            poll(fds, listen_socket >= 0 ? 2 : 1, static_cast<int>(std::max<long long>(wait_ms, 0)));
+
+            if (listen_socket >= 0 && (fds[1].revents & POLLIN)) {
+                int client = accept(listen_socket, nullptr, nullptr);
+
+                if (client >= 0)
+                    serve(client);
+            }
+
+            if (std::chrono::steady_clock::now() >= next_write) {
+                writeFile();
+                next_write += std::chrono::seconds(METRICS_INTERVAL);
+            }
+        }
+    }
+
+    void MetricsExporter::serve(int client) {
+        char request[1024];
+        timeval timeout = {1, 0};
+
+        // the request doesn't matter - every path returns the metrics,
+        // but it has to be read, or the client may get a reset instead of the answer
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        (void) !recv(client, request, sizeof(request), 0);
+
+        std::string body = metrics.render();
+        std::string response = "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + body;
+
+        size_t sent = 0;
+        while (sent < response.size()) {
+            ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += n;
+        }
+
+        close(client);
+    }
+
+    void MetricsExporter::writeFile() {
+        if (filename.empty()) {
+            return;
+        }
+
+        // the same as checkpoints - readers never see a half written file
+        std::string tmp = filename + ".tmp";
+        std::ofstream f(tmp, std::ios::out | std::ios::trunc);
+
+        if (!f.good()) {
+            std::cerr << "WARNING: Cannot write metrics file `" << tmp << "`\n";
+            return;
+        }
+
+        f << metrics.render();
+        f.close();
+
+        if (std::rename(tmp.c_str(), filename.c_str()) != 0) {
+            std::cerr << "WARNING: Cannot replace metrics file `" << filename << "`\n";
+        }
+    }
+}
@@ -0,0 +1,52 @@
+/**
+ * MetricsExporter.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Publishes the metrics of the scan in the Prometheus text format:
+ * rewrites a file every few seconds (for node_exporter textfile collector)
+ * and/or answers every HTTP request on 127.0.0.1:<port> with the metrics.
+ * Both are done by one thread, so the scan itself never waits for them.
+*/
+
+#ifndef PORTSCAN_METRICSEXPORTER_H
+#define PORTSCAN_METRICSEXPORTER_H
+
+#include "Metrics.h"
+
+#include <string>
+#include <thread>
+#include <atomic>
+
+#define METRICS_INTERVAL 5 // seconds between rewrites of the file
+
+namespace scanner {
+    class MetricsExporter {
+    private:
+        Metrics& metrics;
+        std::string filename;
+
+        int listen_socket = -1;
+        int wakeup_pipe[2] = {-1, -1};
+
+        std::thread worker;
+        std::atomic<bool> is_running{false};
+
+        void loop();
+        void writeFile();
+        void serve(int client);
+    public:
+        /**
+         * @param filename empty = no file
+         * @param port 0 = no HTTP endpoint
+         * Throws std::runtime_error if the port can't be bound.
+        */
+        MetricsExporter(Metrics& metrics, const std::string& filename, uint16_t port);
+        ~MetricsExporter(); // writes the final state of the file
+    };
+}
+
+#endif //PORTSCAN_METRICSEXPORTER_H
@@ -8,181 +8,1203 @@
 */
 
 #include "PortScanner.h"
+#ifdef __linux__
+#   include "../net/PacketRing.h"
+#endif
 
 #include <iostream>
 #include <thread>
 #include <vector>
-#include <system_error>
+#include <algorithm>
+#include <cerrno>
+
+#ifdef _WIN32
+#   include <io.h>
+#   define STDIN_FILENO 0
+#else
+#   include <poll.h>
+#   include <unistd.h>
+#endif
 
 namespace scanner {
-    bool PortScanner::test_port(IpAddress ip, port in_port, CONNECTION_TYPE protocol, timeval timeout) {
-        return protocol == TCP ? PortScanner::tcp_connect(ip, in_port, timeout) : PortScanner::udp_connect(ip, in_port, timeout);
+    PORT_STATE PortScanner::test_port(IpAddress ip, port in_port, CONNECTION_TYPE protocol, timeval timeout) {
+        if (protocol == TCP)
+            return PortScanner::tcp_connect(ip, in_port, timeout);
+        return PortScanner::udp_connect(ip, in_port, {timeout, timeout, settings.i_retries}, udp_template(in_port));
+    }
+
+    void set_timing(flags& f, const timingProfile& profile) {
+        f.s_timing = profile.name;
+        f.i_concurrency = profile.concurrency;
+        f.t_timeout = Timing::toTimeval(profile.timeout_ms);
+        f.t_min_timeout = Timing::toTimeval(profile.min_timeout_ms);
+        f.t_max_timeout = Timing::toTimeval(profile.max_timeout_ms);
+        f.i_retries = profile.retries;
+        f.t_udp_timeout = Timing::toTimeval(profile.udp_timeout_ms);
+        f.t_probe_delay = Timing::toTimeval(profile.delay_ms);
+        f.i_rate = profile.rate;
+    }
+
+    std::chrono::nanoseconds probe_interval(const flags& f) {
+        std::chrono::nanoseconds delay = std::chrono::seconds(f.t_probe_delay.tv_sec)
+                                         + std::chrono::microseconds(f.t_probe_delay.tv_usec);
+        std::chrono::nanoseconds rate(f.i_rate > 0 ? 1000000000 / f.i_rate : 0);
+
+        return std::max(delay, rate);
     }
 
     PortScanner::PortScanner(IpAddress *ip, IpAddress *mask, flags args) 
             : SubNet(ip, mask), settings(args) {
+        init_stream();
         init_dictionary();
+        init_timing();
+        init_sources();
+        init_deadline();
         print_settings();
+        init_metrics();
+        init_sample();
+        init_checkpoint();
+        init_baseline();
+        init_progress();
+        init_output();
+        init_journal();
+        init_capture();
+        init_banners();
+        init_udp_templates();
+        init_udp_batch();
     }
 
-    PortScanner::PortScanner(std::string &ip, std::string &mask, flags args)             
-            : SubNet(ip, mask), settings(args) {
+    PortScanner::PortScanner(std::string &ip, std::string &mask, flags args, std::shared_ptr<Engine> engine)
+            : SubNet(ip, mask), settings(args), engine(std::move(engine)) {
+        init_stream();
         init_dictionary();
+        init_timing();
+        init_sources();
+        init_deadline();
         print_settings();
+        init_metrics();
+        init_sample();
+        init_checkpoint();
+        init_baseline();
+        init_progress();
+        init_output();
+        init_journal();
+        init_capture();
+        init_banners();
+        init_udp_templates();
+        init_udp_batch();
     }
 
     void PortScanner::scan() {
-        if (this->settings.b_threads) {
-            return no_threads_scan();
-        } else if (this->settings.b_each_in_new_thread) {
+        if (this->settings.b_stdin) {
+            return stream_scan(STDIN_FILENO);
+        } else if (this->settings.b_per_core) {
+            return per_core_scan();
+        } else if (this->settings.b_coroutines) {
             return crazy_scan();
+        } else if (!this->settings.b_threads) {
+            return no_threads_scan();
         }
 
-        auto thread_pool = std::unique_ptr<ThreadPool>(new ThreadPool(settings.i_thread_count));
-        auto current_ip = IpAddress(this->getSubnetAddress());
-        auto broadcast_ip = IpAddress(this->getBroadcastAddress());
+        int pool_size = settings.i_concurrency > 0 ? settings.i_concurrency : settings.i_thread_count;
+        auto thread_pool = std::unique_ptr<ThreadPool>(new ThreadPool(pool_size));
+        std::unique_ptr<ThreadPool> udp_pool; // with -ALL, slow UDP probes don't hold TCP ones back
+        IpAddress current_ip;
 
-        port port = 0;
-        while (current_ip <= this->getBroadcastAddress()) {
-            print_scan_info(current_ip);
+        if (split_pipelines()) {
+            udp_pool = std::make_unique<ThreadPool>(settings.i_udp_thread_count > 0 ? settings.i_udp_thread_count : pool_size);
+        }
 
-            port = settings.pr_range.from;
-            do {
-                scanner::port p = port;
-                thread_pool->push(
-                    [this, current_ip, p]() {
-                        check_port(current_ip, p);
-                    }
-                );
-                port++;
-            } while(port != 0 && port <= this->settings.pr_range.to);
+        while (next_host(current_ip)) {
+            begin_host(current_ip);
+
+            for_each_port(current_ip, [&](port p) {
+                auto queued = metrics != nullptr ? Metrics::clock::now() : Metrics::clock::time_point{};
+                auto enqueue = [&](ThreadPool& pool, CONNECTION_TYPE protocol) {
+                    Trace::add(Trace::ENQUEUE, current_ip, p, protocol);
+                    pool.push(
+                        [this, current_ip, p, queued, protocol]() {
+                            Trace::add(Trace::DEQUEUE, current_ip, p, protocol);
+                            count_queue_wait(queued);
+                            check_port(current_ip, p, protocol);
+                        }
+                    );
+                };
+
+                if (udp_pool != nullptr) {
+                    probes_left[p] = 2;
+                    enqueue(*thread_pool, TCP);
+                    enqueue(*udp_pool, UDP);
+                } else {
+                    enqueue(*thread_pool, settings.ct_protocol);
+                }
+            });
 
+            scan_udp_batch(current_ip); // meanwhile TCP is checked by the pool
             thread_pool->waitForThreads();
-            current_ip.operator++();
-            print_separator('=');
+            if (udp_pool != nullptr)
+                udp_pool->waitForThreads();
+            end_host(current_ip);
         }
+        finish_scan();
     }
 
     void PortScanner::no_threads_scan() {
-        if (this->settings.b_each_in_new_thread) {
+        if (this->settings.b_coroutines) {
             return crazy_scan();
         }
 
-        auto current_ip = IpAddress(this->getSubnetAddress());
-        auto broadcast_ip = IpAddress(this->getBroadcastAddress());
+        IpAddress current_ip;
 
-        port port = 0;
-        while (current_ip <= this->getBroadcastAddress()) {
-            print_scan_info(current_ip);
+        while (next_host(current_ip)) {
+            begin_host(current_ip);
 
-            port = settings.pr_range.from;
-            do {
-                scanner::port p = port;
-                check_port(current_ip, p); // no threads allowed
-                port++;
-            } while(port != 0 && port <= this->settings.pr_range.to);
+            for_each_port(current_ip, [&](port p) {
+                check_port(current_ip, p, settings.ct_protocol); // no threads allowed
+            });
+
+            scan_udp_batch(current_ip);
 
-            current_ip.operator++();
-            print_separator('=');
+            end_host(current_ip);
         }
+        finish_scan();
+    }
+
+#ifdef __linux__
+    void PortScanner::pause(bool paused) {
+        std::lock_guard<std::mutex> lock(pause_mutex);
+
+        is_paused = paused;
+        if (paused_executor != nullptr)
+            paused_executor->pause(*paused_group, paused);
     }
 
+    void PortScanner::attach_pause(Executor* executor, JobGroup* group) {
+        std::lock_guard<std::mutex> lock(pause_mutex);
+
+        if (executor != nullptr && is_paused)
+            executor->pause(*group, true); // paused before the scan has started
+        paused_executor = executor;
+        paused_group = group;
+    }
+#endif
+
     /**
-     * This function is legacy code from the first version of the program.
-     * It is very fast, but it violates multiple rules of good multi-threaded programming.
-     * 
-     * Before we proceed, let's discuss why this function works.
-     * In every modern operating system, there is a Task/Process Manager that manages
-     * all tasks and processes in the system. This means that there will be interruptions
-     * in the execution of processes or threads to allow each task to have some CPU time.
-     * What if we create 1,000 or 10,000 threads? Each of them will receive some CPU time,
-     * more than they would get if there were only six threads.
-     * 
-     * However, it is important to note that this is considered a bad practice, but for the sake of demonstration,
-     * it has been marked as legacy code.
-     * 
-     * You have been warned, so let's proceed!
+     * The name stays from the first version of the program, which created
+     * a new thread for every port. Now every probe is a coroutine instead:
+     * it waits for its socket on one of a few event loops, so the scan keeps
+     * the same crazy number of probes in flight (100k+, as many as open files allow)
+     * for a few hundred bytes each, instead of a thread with its own stack.
      */
     void PortScanner::crazy_scan() {
-        auto current_ip = IpAddress(this->getSubnetAddress());
-        auto broadcast_ip = IpAddress(this->getBroadcastAddress());
-        std::vector<std::thread*> threads;
+#ifdef __linux__
+        std::unique_ptr<Executor> own_executor;
+        Executor* executor = engine != nullptr ? engine->executor.get() : nullptr;
+        JobGroup group;
 
-        port port = 0;
-        while (current_ip <= this->getBroadcastAddress()) {
-            print_scan_info(current_ip);
+        if (executor == nullptr) {
+            own_executor = std::make_unique<Executor>(settings.i_thread_count, probe_limit(settings));
+            own_executor->setInterval(probe_interval(settings));
+            executor = own_executor.get();
+        }
+        JobGroup udp_group;
+        std::vector<port> pending;
+        bool split = split_pipelines();
 
-            port = settings.pr_range.from;
-            do {
-                scanner::port p = port;
-
-                int tries = 0;
-                // Fasten your seat belt, because it's gonna be a crazy drive!!!
-
-                /**
-                 * In "Clean Code" by Robert C. Martin [page 48],
-                 * it is stated that using 'goto' is generally considered
-                 * bad practice acording to Dijkstra rules.
-                 * Well.. Dijkstra also said, that functions should have only
-                 * one entry and one exit. That rule was extended by Martin
-                 * to the point at which loops shouldn't have any break or continue,
-                 * which - in some cases - is almost impossible to avoid.
-                 *
-                 * So let's sum up Dijkstra and Martin rules:
-                 * Goto is considered bad practice, 
-                 * because it often leads to uncontrolled jumps
-                 * and makes code harder to read and maintain.
-                 *
-                 * However, in certain cases, if used judiciously and in a
-                 * well-structured manner, it can potentially provide huge optimizations.
-                */  
-            try_new_thread:
-                try {
-                    threads.push_back( 
-                        new std::thread(
-                            [this, current_ip, p]() {
-                                check_port(current_ip, p);
-                            }
-                        )
-                    );
-                } catch (const std::system_error& e) {
-                    // Owww... system couldn't handle
-                    // need some space
-                    for (auto &thread : threads) {
-                        thread->join();
-                        delete thread;
-                    }
-                    threads.clear();
-                    if (tries++ > 10) {
-                    std::cerr << "Threads are messed up" << std::endl;
-                    exit(666);
+        // shares the limits with other scans of the engine
+        // (and with -ALL, TCP and UDP pipelines split the share of the scan)
+        executor->join(group);
+        if (split)
+            executor->join(udp_group, group);
+        attach_pause(executor, &group);
+
+        IpAddress current_ip;
+
+        while (next_host(current_ip)) {
+            begin_host(current_ip);
+
+            pending.clear();
+            for_each_port(current_ip, [&](port p) {
+                if (split)
+                    probes_left[p] = 2;
+                pending.push_back(p);
+            });
+
+            if (split) {
+                // spawn() blocks on a full share, so every pipeline has its own feeder
+                std::thread udp_feeder([&]() {
+                    spawn_probes(*executor, udp_group, current_ip, pending, UDP);
+                });
+
+                spawn_probes(*executor, group, current_ip, pending, TCP);
+                udp_feeder.join();
+            } else {
+                spawn_probes(*executor, group, current_ip, pending, settings.ct_protocol);
+            }
+
+            scan_udp_batch(current_ip);
+            executor->wait(group);
+            if (split)
+                executor->wait(udp_group);
+            end_host(current_ip);
+        }
+        attach_pause(nullptr, nullptr);
+        if (split)
+            executor->leave(udp_group);
+        executor->leave(group);
+        finish_scan();
+#else
+        std::cerr << "WARNING: --crazy requires epoll (Linux), using the thread pool..\n";
+        this->settings.b_coroutines = false;
+        scan();
+#endif
+    }
+
+    /**
+     * The same probes as crazy_scan, but without the shared Executor queue
+     * and limit: every core runs its own engine (see CoreEngine.h),
+     * which takes every n-th pending port of the host.
+     */
+    void PortScanner::per_core_scan() {
+#ifdef __linux__
+        std::vector<int> cpus = Executor::cpus(settings.b_numa);
+        size_t count = settings.i_thread_count > 0 ? settings.i_thread_count : std::max<size_t>(cpus.size(), 1);
+        size_t max_probes = probe_limit(settings);
+
+        // only the feeders go through the executor - one per engine and host
+        Executor executor(static_cast<int>(count), count, cpus);
+        std::vector<std::unique_ptr<CoreEngine>> engines;
+        std::vector<port> pending;
+
+        for (size_t i = 0; i < count; i++) {
+            auto engine = std::make_unique<CoreEngine>();
+
+            engine->limit = std::max<size_t>(max_probes / count, 1);
+            engine->interval = probe_interval(settings) * count; // every engine keeps its part of the rate
+            engines.push_back(std::move(engine));
+        }
+
+        IpAddress current_ip;
+
+        while (next_host(current_ip)) {
+            begin_host(current_ip);
+
+            pending.clear();
+            for_each_port(current_ip, [&](port p) {
+                pending.push_back(p);
+            });
+
+            for (size_t i = 0; i < count && !pending.empty(); i++) {
+                CoreEngine& engine = *engines[i];
+
+                executor.spawnOn(i, [this, &engine, &pending, current_ip, i, count](EventLoop& loop) {
+                    return feed_core(loop, engine, current_ip, pending, i, count);
+                });
+            }
+
+            scan_udp_batch(current_ip);
+            executor.wait();
+            flush_core_results(current_ip, engines);
+            end_host(current_ip);
+        }
+        finish_scan();
+#else
+        std::cerr << "WARNING: --per-core requires epoll (Linux), using the thread pool..\n";
+        this->settings.b_per_core = false;
+        scan();
+#endif
+    }
+
+    /**
+     * Consumers take the pairs from the queue - threads of the pool size,
+     * or one feeder of coroutines (--crazy), whose spawn() waits for a free
+     * place in the share - and the reader stays at most the queue ahead of them.
+     */
+    void PortScanner::stream_scan(int fd) {
+        TargetQueue targets;
+        std::thread reader(&PortScanner::read_targets, this, fd, std::ref(targets));
+
+#ifdef __linux__
+        if (settings.b_coroutines) {
+            std::unique_ptr<Executor> own_executor;
+            Executor* executor = engine != nullptr ? engine->executor.get() : nullptr;
+            JobGroup group;
+            target t;
+
+            if (executor == nullptr) {
+                own_executor = std::make_unique<Executor>(settings.i_thread_count, probe_limit(settings));
+                own_executor->setInterval(probe_interval(settings));
+                executor = own_executor.get();
+            }
+
+            executor->join(group);
+            while (!is_cancelled() && targets.pop(t)) {
+                if (!is_pending(t.ip, t.port))
+                    continue;
+
+                // the probe records DEQUEUE and the wait since the push
+                executor->spawn(
+                    [this, t](EventLoop& loop) {
+                        return probe_port(loop, t.ip, t.port, t.protocol, t.queued);
+                    }, &group
+                );
+            }
+            executor->wait(group);
+            executor->leave(group);
+        } else
+#endif
+        {
+            int pool_size = settings.i_concurrency > 0 ? settings.i_concurrency : settings.i_thread_count;
+            std::vector<std::thread> workers;
+
+            for (int i = 0; i < std::max(pool_size, 1); i++) {
+                workers.emplace_back([this, &targets]() {
+                    target t;
+
+                    while (!is_cancelled() && targets.pop(t)) {
+                        Trace::add(Trace::DEQUEUE, t.ip, t.port, t.protocol);
+                        count_queue_wait(t.queued);
+
+                        if (is_pending(t.ip, t.port))
+                            check_port(t.ip, t.port, t.protocol);
                     }
-                    goto try_new_thread;
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+
+        // the reader waits for the input at most TARGET_POLL_MS after cancel()
+        targets.cancel();
+        reader.join();
+
+#ifdef __linux__
+        if (banner_grabber != nullptr) {
+            banner_grabber->wait();
+        }
+#endif
+        if (journal != nullptr) {
+            journal->flush();
+        }
+        finish_scan();
+    }
+
+    void PortScanner::init_metrics() {
+        if (!settings.s_trace_file.empty()) {
+            Trace::start();
+        }
+
+        if (settings.s_metrics_file.empty() && settings.i_metrics_port == 0) {
+            return;
+        }
+
+#ifdef __linux__
+        metrics = std::make_unique<Metrics>();
+        metrics_exporter = std::make_unique<MetricsExporter>(*metrics, settings.s_metrics_file, settings.i_metrics_port);
+#else
+        std::cerr << "WARNING: --metrics and --metrics-port are supported only on Linux..\n";
+#endif
+    }
+
+    void PortScanner::init_sample() {
+        // a resumed scan keeps the seed of its checkpoint, the day may have changed since
+        if (settings.i_sample_percent < 100 && settings.i_sample_seed == 0 && !settings.b_resume) {
+            // tonight's sample differs from yesterday's, so all ports are seen sooner or later
+            settings.i_sample_seed = static_cast<uint64_t>(std::time(nullptr) / (24 * 60 * 60)) + 1;
+        }
+    }
+
+    void PortScanner::init_checkpoint() {
+        if (settings.s_checkpoint_file.empty()) {
+            return;
+        }
+
+        checkpoint = std::make_unique<Checkpoint>(settings.s_checkpoint_file, settings.i_checkpoint_interval);
+        checkpoint->setRange(this->getSubnetAddress(), this->getBroadcastAddress(),
+                             settings.pr_range.from, settings.pr_range.to, settings.ct_protocol);
+        checkpoint->setSelection(settings.sh_shard, settings.i_sample_percent, settings.i_sample_seed);
+
+        if (settings.b_resume) {
+            checkpoint->load(); // throws, if the file is for another scan
+            settings.i_sample_seed = checkpoint->getSampleSeed();
+            print_recovered();
+        }
+
+        checkpoint->start();
+    }
+
+    void PortScanner::init_baseline() {
+        if (settings.s_baseline_file.empty()) {
+            return;
+        }
+
+        baseline = std::make_unique<Baseline>(settings.s_baseline_file); // throws, if it can't be read
+        print("Loaded " + std::to_string(baseline->size()) + " results of the previous scan..\n");
+
+        if (checkpoint != nullptr) {
+            // hosts scanned before the resume
+            for (auto& r : checkpoint->getResults()) {
+                baseline->add(IpAddress(r.ip), r.port, r.protocol, "",
+                              service_dictionary != nullptr ? service_dictionary->getService(r.port, r.protocol) : "unknown");
+            }
+        }
+    }
+
+    void PortScanner::init_progress() {
+        if (!settings.b_progress) {
+            return;
+        }
+
+        uint64_t hosts = static_cast<uint64_t>(this->getBroadcastAddress().getAsNetNumber())
+                         - this->getSubnetAddress().getAsNetNumber() + 1;
+
+        progress = std::make_unique<Progress>(hosts * probes_per_host(), settings.i_progress_interval);
+        // hosts before the resumed one are already done
+        progress->skip((static_cast<uint64_t>(first_host().getAsNetNumber()) - this->getSubnetAddress().getAsNetNumber())
+                       * probes_per_host());
+        progress->start();
+    }
+
+    uint64_t PortScanner::probes_per_host() {
+        uint64_t ports = static_cast<uint64_t>(settings.pr_range.to) - settings.pr_range.from + 1;
+
+        return settings.ct_protocol == ALL ? 2 * ports : ports;
+    }
+
+    void PortScanner::init_output() {
+        if (settings.s_output_file.empty()) {
+            return;
+        }
+
+        result_writer = std::make_unique<ResultWriter>(settings.s_output_file, settings.b_resume);
+
+        std::ostringstream ss;
+        ss  << "portscan " << (settings.b_stdin ? "--stdin" : this->getSubnetAddress().getAsString() + " - "
+                                                             + this->getBroadcastAddress().getAsString()
+                                                             + " ports " + std::to_string(settings.pr_range.from)
+                                                             + " - " + std::to_string(settings.pr_range.to))
+            << " shard " << settings.sh_shard.getIndex() + 1 << "/" << settings.sh_shard.getCount()
+            << " seed " << settings.sh_shard.getSeed();
+        result_writer->writeComment(ss.str());
+    }
+
+    void PortScanner::init_journal() {
+        if (settings.s_journal_file.empty()) {
+            return;
+        }
+
+        journal = std::make_unique<Journal>(settings.s_journal_file); // throws, if it's another file
+    }
+
+    void PortScanner::init_capture() {
+        if (settings.s_capture_file.empty()) {
+            return;
+        }
+
+        if (settings.ct_protocol == TCP && !settings.b_stdin) {
+            std::cerr << "WARNING: --capture records UDP probes, there are none with -TCP..\n";
+        } else if ((settings.b_coroutines || settings.b_per_core) && !settings.b_batch) {
+            // connected datagram sockets - the kernel builds the packets and matches the replies
+            std::cerr << "WARNING: --capture records raw UDP probes, those of --crazy and --per-core are sent by the kernel..\n";
+        }
+
+        capture = std::make_unique<Capture>(settings.s_capture_file, settings.i_capture_snaplen, settings.i_capture_sample);
+        capture->start();
+    }
+
+    void PortScanner::init_banners() {
+        // pairs of --stdin bring their own protocol
+        if (!settings.b_banners || (settings.ct_protocol == UDP && !settings.b_stdin)) {
+            return;
+        }
+
+#ifndef __linux__
+        std::cerr << "WARNING: --banners is supported only on Linux..\n";
+#else
+        banner_grabber = std::make_unique<BannerGrabber>(settings.i_banner_concurrency, settings.t_banner_timeout,
+            [this](const IpAddress& ip, uint16_t port, const banner& b) {
+                std::string service = b.service;
+
+                if (service.empty()) {
+                    service = service_dictionary != nullptr ? service_dictionary->getService(port, TCP) : "unknown";
+                    if (!b.raw.empty())
+                        service += " [" + b.raw + "]";
+                } else if (!b.version.empty()) {
+                    service += " (" + b.version + ")";
                 }
-                port++;
-            } while(port != 0 && port <= this->settings.pr_range.to);
 
-            for (auto &thread : threads) {
-                thread->join();
-                delete thread;
+                report(ip, port, OPEN, TCP, service);
+                port_done(port);
+            });
+#endif
+    }
+
+    void PortScanner::init_udp_templates() {
+        if (settings.ct_protocol == TCP && !settings.b_stdin) {
+            return;
+        }
+
+        // all hosts of the subnet are reached the same way
+        // (pairs of --stdin may go anywhere - the kernel fills the address)
+        uint32_t source = settings.b_stdin ? 0 : PacketTemplate::sourceFor(this->getSubnetAddress().getAsAddr().num);
+
+#ifdef __linux__
+        // nobody fills the source address of frames from the packet ring
+        if (!settings.s_ring_interface.empty() && PacketRing::interfaceAddress(settings.s_ring_interface) != 0) {
+            source = PacketRing::interfaceAddress(settings.s_ring_interface);
+        }
+#endif
+
+        udp_templates.emplace(nullptr, PacketTemplate(source, nullptr, 0));
+        if (udp_payloads != nullptr) {
+            for (auto& payload : udp_payloads->getAll()) {
+                udp_templates.emplace(&payload, PacketTemplate(source, payload.data.data(), payload.data.size()));
             }
-            threads.clear();
-            current_ip.operator++();
-            print_separator('=');
         }
     }
 
-    void PortScanner::check_port(IpAddress ip, port port) {
-        bool is_open = false;
+    const PacketTemplate& PortScanner::udp_template(port port) {
+        auto it = udp_templates.find(udp_payloads != nullptr ? udp_payloads->get(port) : nullptr);
 
-        if (settings.ct_protocol != ALL) {
-            is_open = test_port(ip, port, settings.ct_protocol, settings.t_timeout);
-            print_row(port, is_open, settings.ct_protocol);
+        return it != udp_templates.end() ? it->second : udp_templates.at(nullptr);
+    }
+
+    void PortScanner::init_udp_batch() {
+        if (!settings.b_batch || settings.ct_protocol == TCP) {
+            return;
+        }
+
+        std::unique_ptr<RawTransport> transport;
+
+#ifdef __linux__
+        if (!settings.s_ring_interface.empty()) {
+            transport = std::make_unique<PacketRing>(settings.s_ring_interface, this->getSubnetAddress().getAsAddr().num);
+        } else
+#endif
+        {
+            transport = std::make_unique<SocketTransport>();
+        }
+
+        udp_batch = std::make_unique<UdpBatchScanner>(std::move(transport),
+            [this](uint16_t port) -> const PacketTemplate& { return udp_template(port); }, &icmp_limit, capture.get(),
+            settings.i_retries + 1, std::chrono::milliseconds(Timing::toMs(udp_policy().max_timeout))); // the longest wait of udp_connect
+
+        if (!udp_batch->isOpen()) {
+            std::cerr << "WARNING: Cannot create raw sockets or rings for batched UDP scan, falling back to udp_connect..\n";
+            udp_batch.reset();
+        }
+    }
+
+    void PortScanner::init_timing() {
+        timeouts.setBounds(settings.t_timeout, settings.t_min_timeout, settings.t_max_timeout);
+        pacer.setInterval(probe_interval(settings));
+    }
+
+    retryPolicy PortScanner::udp_policy() {
+        if (Timing::toMs(settings.t_udp_timeout) > 0) {
+            timeval max = Timing::toMs(settings.t_udp_timeout) > Timing::toMs(settings.t_max_timeout)
+                          ? settings.t_udp_timeout : settings.t_max_timeout;
+            return {settings.t_udp_timeout, max, settings.i_retries};
+        }
+        return {timeouts.current(), settings.t_max_timeout, settings.i_retries};
+    }
+
+    void PortScanner::init_sources() {
+        if (settings.s_source_addresses.empty()) {
+            return;
+        }
+
+        sources = std::make_unique<SourcePool>();
+        if (!sources->parse(settings.s_source_addresses)) {
+            throw std::runtime_error("ERROR: Invalid source addresses `" + settings.s_source_addresses + "`");
+        }
+
+        ipv4 missing = sources->check();
+        if (missing != 0) {
+            throw std::runtime_error("ERROR: Source address " + IpAddress(missing).getAsString()
+                                     + " doesn't belong to this machine");
+        }
+    }
+
+    void PortScanner::init_deadline() {
+        if (settings.i_max_duration <= 0) {
+            return;
+        }
+        if (!settings.s_checkpoint_file.empty() || settings.b_resume) {
+            // the checkpoint keeps one host at a time, passes come back to all of them
+            throw std::runtime_error("ERROR: --max-duration can't be combined with --checkpoint or --resume");
+        }
+
+        port p = settings.pr_range.from;
+        do {
+            port_order.push_back(p);
+            p++;
+        } while (p != 0 && p <= settings.pr_range.to);
+
+        if (service_dictionary != nullptr) {
+            // how often the service is seen open on the Internet
+            std::vector<double> priority(65536, 0.0);
+
+            for (port q : port_order) {
+                bsd_leaf* leaf = service_dictionary->getLeaf(q);
+                priority[q] = leaf != nullptr ? leaf->priority : 0.0;
+            }
+            std::stable_sort(port_order.begin(), port_order.end(), [&priority](port a, port b) {
+                return priority[a] > priority[b];
+            });
+        }
+
+        deadline = std::make_unique<Deadline>(std::chrono::seconds(settings.i_max_duration), [this]() {
+            cancel(); // probes in flight are finished, the rest is dropped
+        });
+    }
+
+    void PortScanner::init_stream() {
+        if (!settings.b_stdin) {
+            return;
+        }
+        if (!settings.s_checkpoint_file.empty() || settings.b_resume || settings.i_max_duration > 0
+            || !settings.s_baseline_file.empty()) {
+            // all of them walk through the range host by host
+            throw std::runtime_error("ERROR: --stdin can't be combined with --checkpoint, --resume, --max-duration or --baseline");
+        }
+
+        if (settings.b_per_core) {
+            std::cerr << "WARNING: --per-core splits ports of one host, --stdin pairs go through --crazy..\n";
+            settings.b_per_core = false;
+            settings.b_coroutines = true;
+        }
+        if (settings.b_batch) {
+            std::cerr << "WARNING: --batch scans whole hosts, --stdin pairs are probed one by one..\n";
+            settings.b_batch = false;
+        }
+        if (settings.i_filtered_cutoff > 0) {
+            std::cerr << "WARNING: --filtered-cutoff is ignored with --stdin, pairs of all hosts are mixed..\n";
+            settings.i_filtered_cutoff = 0;
+        }
+        if (settings.b_progress) {
+            std::cerr << "WARNING: --progress is ignored with --stdin, the length of the input isn't known..\n";
+            settings.b_progress = false;
+        }
+
+        settings.b_print = false; // stdout is for the results only
+    }
+
+    IpAddress PortScanner::first_host() {
+        if (checkpoint != nullptr) {
+            return checkpoint->getCurrentHost();
+        }
+        return IpAddress(this->getSubnetAddress());
+    }
+
+    bool PortScanner::next_host(IpAddress& ip) {
+        if (!hosts_started) {
+            hosts_started = true;
+            if (deadline != nullptr) {
+                deadline->start();
+                if (!next_pass())
+                    return false; // nothing to scan
+            } else {
+                ip = first_host();
+            }
+        } else if (deadline == nullptr && ip.operator++() == nullptr) {
+            return false; // 255.255.255.255
+        }
+
+        if (is_completed()) {
+            return false;
+        }
+        if (deadline != nullptr) {
+            return next_visit(ip);
+        }
+        return ip <= this->getBroadcastAddress();
+    }
+
+    bool PortScanner::next_visit(IpAddress& ip) {
+        uint64_t last = this->getBroadcastAddress().getAsNetNumber();
+
+        while (true) {
+            if (pass_first_index < pass_first.size()) {
+                ip = IpAddress(htonl(pass_first[pass_first_index++]));
+                return true;
+            }
+
+            while (pass_address <= last) {
+                auto host = static_cast<uint32_t>(pass_address++);
+
+                // answered hosts went first, silent ones are given up
+                if (!answered_hosts.contains(host) && !silent_hosts.contains(host)) {
+                    ip = IpAddress(htonl(host));
+                    return true;
+                }
+            }
+
+            if (!next_pass()) {
+                return false;
+            }
+        }
+    }
+
+    bool PortScanner::next_pass() {
+        uint64_t hosts = static_cast<uint64_t>(this->getBroadcastAddress().getAsNetNumber())
+                         - this->getSubnetAddress().getAsNetNumber() + 1 - silent_hosts.size();
+        uint64_t ports = DEADLINE_FIRST_PORTS;
+
+        if (slice_to >= port_order.size() || hosts == 0) {
+            return false; // the whole range is done
+        }
+
+        if (pass > 0) {
+            // as many ports, as all hosts can get at the rate measured so far
+            uint64_t per_host = deadline->affordable() / (hosts * (settings.ct_protocol == ALL ? 2 : 1));
+            ports = std::max<uint64_t>(per_host, DEADLINE_MIN_PORTS);
+        }
+
+        pass++;
+        slice_from = slice_to;
+        slice_to = static_cast<size_t>(std::min<uint64_t>(slice_from + ports, port_order.size()));
+
+        pass_first.clear();
+        for (uint32_t host : answered_hosts) {
+            if (!silent_hosts.contains(host))
+                pass_first.push_back(host);
+        }
+        pass_first_index = 0;
+        pass_address = this->getSubnetAddress().getAsNetNumber();
+        return true;
+    }
+
+    bool PortScanner::is_completed() {
+        return is_cancelled() || (checkpoint != nullptr && checkpoint->isCompleted());
+    }
+
+    void PortScanner::begin_host(const IpAddress& ip) {
+        if (checkpoint != nullptr) {
+            checkpoint->beginHost(ip);
+        }
+        if (progress != nullptr) {
+            progress->beginHost();
+        }
+        icmp_limit.reset();
+        for (auto& count : host_states) {
+            count.store(0, std::memory_order_relaxed);
+        }
+        host_cut_off.store(false, std::memory_order_relaxed);
+        print_scan_info(ip);
+    }
+
+    bool PortScanner::is_pending(const IpAddress& ip, port port) {
+        if (settings.sh_shard.isEnabled() && !settings.sh_shard.owns(ip.getAsNetNumber(), port)) {
+            return false; // another node will take care of it
+        }
+        if (!is_sampled(ip, port)) {
+            return false;
+        }
+        return checkpoint == nullptr || !checkpoint->isDone(port);
+    }
+
+    bool PortScanner::is_host_stopped() {
+        return is_cancelled() || host_cut_off.load(std::memory_order_relaxed);
+    }
+
+    bool PortScanner::is_sampled(const IpAddress& ip, port port) {
+        if (settings.i_sample_percent >= 100 || (baseline != nullptr && baseline->contains(ip, port))) {
+            return true; // previously open ports are always probed
+        }
+
+        uint64_t h = Shard::hash(settings.i_sample_seed, ip.getAsNetNumber(), port);
+        return static_cast<int>(((h >> 32) * 100) >> 32) < settings.i_sample_percent;
+    }
+
+    void PortScanner::for_each_port(const IpAddress& ip, const std::function<void(port)>& probe) {
+        if (!has_port_tasks()) {
+            return;
+        }
+
+        if (baseline != nullptr && pass <= 1) {
+            // queued first, so changes of known services are found early
+            for (port p : baseline->getPorts(ip)) {
+                if (p >= settings.pr_range.from && p <= settings.pr_range.to && is_pending(ip, p) && !is_host_stopped())
+                    probe(p);
+            }
+        }
+
+        if (deadline != nullptr) {
+            for (size_t i = slice_from; i < slice_to && !is_host_stopped(); i++) {
+                if ((baseline == nullptr || !baseline->contains(ip, port_order[i])) && is_pending(ip, port_order[i]))
+                    probe(port_order[i]);
+            }
+            return;
+        }
+
+        port p = settings.pr_range.from;
+        do {
+            if ((baseline == nullptr || !baseline->contains(ip, p)) && is_pending(ip, p))
+                probe(p);
+            p++;
+        } while (p != 0 && p <= settings.pr_range.to && !is_host_stopped());
+    }
+
+    bool PortScanner::split_pipelines() {
+        // batched UDP is a pipeline of its own already
+        if (settings.ct_protocol != ALL || udp_batch != nullptr) {
+            return false;
+        }
+
+        if (probes_left == nullptr) {
+            probes_left = std::make_unique<std::atomic<uint8_t>[]>(65536);
+        }
+        return true;
+    }
+
+    void PortScanner::port_done(port port) {
+        if (checkpoint == nullptr) {
+            return;
+        }
+
+        // with -ALL pipelines the port is done, when both protocols are
+        if (probes_left != nullptr && probes_left[port].fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        checkpoint->markDone(port);
+    }
+
+    bool PortScanner::has_port_tasks() {
+        // with batched UDP only scan, there is nothing to do per port
+        return udp_batch == nullptr || settings.ct_protocol != UDP;
+    }
+
+    void PortScanner::scan_udp_batch(const IpAddress& ip) {
+        std::vector<uint16_t> ports;
+
+        if (udp_batch == nullptr || is_host_stopped()) {
+            return;
+        }
+
+        if (deadline != nullptr) {
+            for (size_t i = slice_from; i < slice_to; i++) {
+                if (is_pending(ip, port_order[i]))
+                    ports.push_back(port_order[i]);
+            }
         } else {
-            is_open = test_port(ip, port, TCP, settings.t_timeout);
-            print_row(port, is_open, TCP);
-            is_open = test_port(ip, port, UDP, settings.t_timeout);
-            print_row(port, is_open, UDP);
+            port p = settings.pr_range.from;
+            do {
+                if (is_pending(ip, p))
+                    ports.push_back(p);
+                p++;
+            } while (p != 0 && p <= settings.pr_range.to);
+        }
+
+        udp_batch->scan(ip, ports, [this, &ip](uint16_t port, PORT_STATE state) {
+            count_probe(ip, port, UDP, state, udp_error(state), {});
+            report(ip, port, state, UDP);
+        });
+    }
+
+    void PortScanner::end_host(const IpAddress& ip) {
+#ifdef __linux__
+        if (banner_grabber != nullptr) {
+            banner_grabber->wait(); // banners belong to this host's table
+        }
+#endif
+
+        if (journal != nullptr) {
+            journal->flush(); // the host is in the journal, even if the scan is killed later
+        }
+
+        if (progress != nullptr && deadline == nullptr) {
+            progress->endHost(probes_per_host()); // a pass is only a part of the host
+        }
+
+        if (deadline != nullptr && !is_cancelled()) {
+            if (host_states[OPEN] + host_states[CLOSED] > 0) {
+                answered_hosts.insert(ip.getAsNetNumber());
+            } else if (host_cut_off) {
+                silent_hosts.insert(ip.getAsNetNumber());
+            }
+        }
+
+        print_host_summary();
+        if (icmp_limit.getRate() > 0) {
+            print_icmp_limit(icmp_limit.getRate());
+        }
+
+        if (checkpoint != nullptr && (udp_batch != nullptr || host_cut_off) && !is_cancelled()) {
+            // batched UDP reports the whole host at once,
+            // so the host is the smallest unit of progress
+            // (and the host, which was cut off, is done with all its ports)
+            port p = settings.pr_range.from;
+            do {
+                checkpoint->markDone(p);
+                p++;
+            } while (p != 0 && p <= settings.pr_range.to);
+        }
+        print_separator('=');
+    }
+
+    void PortScanner::read_targets(int fd, TargetQueue& targets) {
+        std::string pending; // the line read partly
+        char buffer[4096];
+        bool is_over = false;
+        target t;
+
+        // not std::getline - it can't be woken up, when the scan is cancelled
+        // (Ctrl+C only sets the flag), and the input may stay quiet for long
+        while (!is_over) {
+            if (is_cancelled()) {
+                targets.cancel(); // wakes up the consumers waiting for pairs
+                return;
+            }
+
+#ifdef _WIN32
+            // no poll() for console and pipes - cancel() is noticed with the next input
+            int n = _read(fd, buffer, sizeof(buffer));
+#else
+            pollfd pfd{fd, POLLIN, 0};
+
+            if (poll(&pfd, 1, TARGET_POLL_MS) <= 0) {
+                continue;
+            }
+
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+#endif
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            if (n <= 0) {
+                is_over = true;
+                if (pending.empty())
+                    break;
+                pending += '\n'; // the last line without the end of line
+            } else {
+                pending.append(buffer, n);
+            }
+
+            size_t start = 0, end = 0;
+            while ((end = pending.find('\n', start)) != std::string::npos) {
+                std::string line = pending.substr(start, end - start);
+                auto first = line.find_first_not_of(" \t\r");
+
+                start = end + 1;
+                if (first == std::string::npos || line[first] == '#') {
+                    continue; // comments of -o lists as well
+                }
+                if (!TargetQueue::parse(line, settings.ct_protocol, t)) {
+                    std::cerr << "WARNING: Invalid target `" << line << "`, expected host:port[/proto]\n";
+                    continue;
+                }
+                t.queued = metrics != nullptr ? Metrics::clock::now() : Metrics::clock::time_point{};
+                Trace::add(Trace::ENQUEUE, t.ip, t.port, t.protocol);
+                if (!targets.push(t)) {
+                    return; // waits here, while the queue is full - cancelled meanwhile
+                }
+            }
+            pending.erase(0, start);
+        }
+        targets.close();
+    }
+
+    void PortScanner::finish_scan() {
+        if (deadline != nullptr) {
+            deadline->stop();
+            print_coverage();
+        }
+        if (checkpoint != nullptr) {
+            if (!is_cancelled())
+                checkpoint->finish();
+            checkpoint->stop(); // writes the final state
+        }
+        if (!settings.s_trace_file.empty() && !Trace::dump(settings.s_trace_file)) {
+            std::cerr << "WARNING: Cannot write trace file `" << settings.s_trace_file << "`\n";
+        }
+        if (capture != nullptr) {
+            capture->stop(); // the rest of the rings
+            if (capture->getDropped() > 0) {
+                std::cerr << "WARNING: " << capture->getDropped() << " packets weren't captured, the writer couldn't keep up"
+                          << " (--capture-sample makes it lighter)..\n";
+            }
+        }
+#ifdef __linux__
+        metrics_exporter.reset(); // writes the final numbers
+#endif
+        if (progress != nullptr) {
+            progress->stop(); // the final line
+        }
+        if (baseline != nullptr) {
+            print_changes();
+        }
+    }
+
+    void PortScanner::check_port(IpAddress ip, port port, CONNECTION_TYPE protocol) {
+        bool waits_for_banner = false;
+
+        if (is_host_stopped()) {
+            return; // queued before cancel() or the cut off - not probed, not marked as done
+        }
+        pacer.wait();
+        if (is_host_stopped()) {
+            return;
+        }
+
+        if (protocol != UDP) {
+            waits_for_banner = check_tcp(ip, port);
+        }
+        if (protocol != TCP && udp_batch == nullptr) {
+            check_udp(ip, port);
+        }
+
+        // results first, so a saved port always has its result saved as well
+        // (with banner it will be marked as done by the banner grabber,
+        // with batched UDP - at the end of the host)
+        if (!waits_for_banner && udp_batch == nullptr) {
+            port_done(port);
+        }
+    }
+
+    bool PortScanner::check_tcp(const IpAddress& ip, port port) {
+        SOCKET s = INVALID_SOCKET;
+        int error = 0;
+        auto backoff = std::chrono::milliseconds(SOURCE_BACKOFF_MS);
+        auto started = Metrics::clock::now();
+#ifdef __linux__
+        SOCKET* keep = banner_grabber != nullptr ? &s : nullptr; // open sockets go to the banner grabber
+#else
+        SOCKET* keep = nullptr;
+#endif
+        PORT_STATE state = tcp_connect(ip, port, timeouts.current(), keep, &error, sources.get());
+
+        // no free local port is not an answer of the target - wait for one
+        while (is_source_exhausted(error)) {
+            if (is_cancelled())
+                return true; // not probed, not marked as done
+
+            std::this_thread::sleep_for(backoff);
+            backoff = std::min(backoff * 2, std::chrono::milliseconds(SOURCE_MAX_BACKOFF_MS));
+            started = Metrics::clock::now();
+            state = tcp_connect(ip, port, timeouts.current(), keep, &error, sources.get());
+        }
+
+        count_probe(ip, port, TCP, state, error, started);
+
+        if (state != OPEN || keep == nullptr) {
+            report(ip, port, state, TCP);
+            return false;
+        }
+
+#ifdef __linux__
+        banner_grabber->submit(s, ip, port); // reported, when the banner is read
+#endif
+        return true;
+    }
+
+    void PortScanner::check_udp(const IpAddress& ip, port port) {
+        auto started = Metrics::clock::now();
+        // --stdin mixes hosts, so there is no current host to measure
+        PORT_STATE state = udp_connect(ip, port, udp_policy(), udp_template(port),
+                                       settings.b_stdin ? nullptr : &icmp_limit, capture.get());
+
+        count_probe(ip, port, UDP, state, udp_error(state), started);
+        report(ip, port, state, UDP);
+    }
+
+    bool PortScanner::is_source_exhausted(int error) {
+        if (error != EADDRNOTAVAIL && error != EADDRINUSE) {
+            return false;
+        }
+
+        if (metrics != nullptr) {
+            metrics->add(Metrics::SOURCE_EXHAUSTED);
+        }
+        return true;
+    }
+
+    void PortScanner::count_probe(const IpAddress& ip, port port, CONNECTION_TYPE protocol, PORT_STATE state, int error,
+                                  Metrics::clock::time_point started) {
+        if (progress != nullptr) {
+            progress->probeDone();
+        }
+        if (journal != nullptr) {
+            journal->add(ip, port, protocol, state, started == Metrics::clock::time_point{} ? std::chrono::microseconds(0)
+                : std::chrono::duration_cast<std::chrono::microseconds>(Metrics::clock::now() - started));
+        }
+
+        host_states[state].fetch_add(1, std::memory_order_relaxed);
+        if (deadline != nullptr) {
+            deadline->probeDone();
+        }
+
+        // a firewalled host takes the whole timeout for every port - give up on it,
+        // once it stays silent for long enough (even closed ports answer at once)
+        if (settings.i_filtered_cutoff > 0 && !is_answer(state) && !host_cut_off.load(std::memory_order_relaxed)) {
+            uint64_t answers = host_states[OPEN].load(std::memory_order_relaxed) + host_states[CLOSED].load(std::memory_order_relaxed);
+            uint64_t silent = host_states[FILTERED].load(std::memory_order_relaxed)
+                              + host_states[OPEN_FILTERED].load(std::memory_order_relaxed);
+
+            if (answers == 0 && silent >= static_cast<uint64_t>(settings.i_filtered_cutoff)
+                && !host_cut_off.exchange(true) && metrics != nullptr) {
+                metrics->add(Metrics::FILTERED_HOSTS);
+            }
+        }
+
+        // any answer is a round trip - the timeout follows them
+        if (protocol == TCP && (error == 0 || error == ECONNREFUSED)) {
+            timeouts.observe(Metrics::clock::now() - started);
+        }
+
+        if (metrics == nullptr) {
+            return;
+        }
+
+        metrics->probe(protocol, error);
+        // UDP answer may come after a few retries - that's not a round trip
+        if (protocol == TCP && (error == 0 || error == ECONNREFUSED)) {
+            metrics->observe(Metrics::CONNECT_RTT, Metrics::clock::now() - started);
+        }
+    }
+
+    int PortScanner::udp_error(PORT_STATE state) {
+        switch (state) {
+            case OPEN: return 0;
+            case CLOSED: return ECONNREFUSED; // ICMP unreachable is an answer as well
+            case FILTERED: return EHOSTUNREACH;
+            default: return ETIMEDOUT;
+        }
+    }
+
+    void PortScanner::count_queue_wait(Metrics::clock::time_point queued) {
+        if (metrics != nullptr) {
+            metrics->observe(Metrics::QUEUE_WAIT, Metrics::clock::now() - queued);
+        }
+    }
+
+    void PortScanner::report(const IpAddress& ip, port port, PORT_STATE state, CONNECTION_TYPE protocol,
+                             const std::string& service) {
+        Trace::add(Trace::RESULT, ip, port, protocol);
+        print_row(port, state, protocol, service);
+        if (settings.b_stdin) {
+            print_target(ip, port, state, protocol, service); // closed pairs are answers as well
+        }
+        Trace::add(Trace::PRINT, ip, port, protocol);
+
+        if (!is_reported(state)) {
+            return; // only counted for the summary of the host
+        }
+
+        std::string name = !service.empty() ? service
+            : service_dictionary != nullptr ? service_dictionary->getService(port, protocol) : "unknown";
+
+        if (checkpoint != nullptr) {
+            checkpoint->addResult(ip, port, protocol);
+        }
+        if (baseline != nullptr) {
+            baseline->add(ip, port, protocol, state_name(state), name);
+        }
+        if (result_writer != nullptr) {
+            result_writer->write(ip, port, protocol, state_name(state), name);
+        }
+        if (result_callback) {
+            result_callback({ip, port, protocol, state, name});
         }
     }
 }
\ No newline at end of file
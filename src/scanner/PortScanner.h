@@ -12,11 +12,41 @@
 
 #include "../net/SubNet.h"
 #include "../net/ServicesDictionary.h"
+#include "../net/UdpPayloads.h"
+#include "../net/PacketTemplate.h"
+#include "../net/SourcePool.h"
 #include "../async/ThreadPool.h"
+#ifdef __linux__
+#   include "../async/Executor.h"
+#   include "CoreEngine.h"
+#   include "BannerGrabber.h"
+#   include "MetricsExporter.h"
+#endif
+#include "Checkpoint.h"
+#include "Shard.h"
+#include "ResultWriter.h"
+#include "UdpBatchScanner.h"
+#include "Metrics.h"
+#include "Progress.h"
+#include "Trace.h"
+#include "Baseline.h"
+#include "Engine.h"
+#include "Timing.h"
+#include "IcmpRateLimit.h"
+#include "PortState.h"
+#include "Deadline.h"
+#include "Journal.h"
+#include "TargetQueue.h"
+#include "Capture.h"
+#include "../async/Pacer.h"
 
 #include <ctime>
 #include <chrono>
 #include <mutex>
+#include <map>
+#include <set>
+#include <atomic>
+#include <functional>
 
 #ifndef _WIN32 // POSIX (a small standarizations)
 #   define SOCKET int32_t
@@ -29,6 +59,8 @@
 #endif
 
 #define PACKET_SIZE 2048 // size of buffers for UDP packets
+#define SOURCE_BACKOFF_MS 10 // first wait for a free local port, doubles up to the max
+#define SOURCE_MAX_BACKOFF_MS 1000
 
 namespace scanner {
     using namespace net;
@@ -41,48 +73,344 @@ namespace scanner {
         port to = 65535;
     };
 
+    /**
+     * Open port, as delivered to the result callback.
+    */
+    struct portResult {
+        IpAddress ip;
+        uint16_t port = 0;
+        CONNECTION_TYPE protocol = TCP;
+        PORT_STATE state = OPEN; // or OPEN_FILTERED (UDP without an answer)
+        std::string service;
+    };
+
     struct _flags {
+        bool b_print = true; // the table on stdout, off for embedded scans
         bool b_threads = true;
         CONNECTION_TYPE ct_protocol = ALL;
-        timeval t_timeout = {0, 500000};
+        timeval t_timeout = {0, 500000}; // initial, adapts to round trips between the two below
+        timeval t_min_timeout = {0, 500000}; // the same - normal timing is fixed
+        timeval t_max_timeout = {0, 500000};
+        int i_retries = 4; // of UDP probes without an answer
+        timeval t_udp_timeout = {1, 0}; // the first wait of a UDP probe, 0 = the current TCP timeout
+        int i_filtered_cutoff = 0; // silent probes, after which a host without any answer is skipped, 0 = never
+        int i_max_duration = 0; // wall clock budget in seconds, 0 = until the whole range is done
+        timeval t_probe_delay = {0, 0}; // between two probes of the scan
+        int i_concurrency = 0; // probes in flight (threads of the pool, coroutines), 0 = what the mode allows
+        std::string s_timing = "normal"; // name of the profile
+        std::string s_source_addresses{}; // local addresses of TCP probes, empty = chosen by the kernel
         struct portRange pr_range{};
+        bool b_stdin = false; // (host, port) pairs from stdin instead of the range
         int i_thread_count = std::thread::hardware_concurrency();
-        bool b_each_in_new_thread = false;
+        int i_udp_thread_count = 0; // UDP pipeline of -ALL in the thread pool mode, 0 = the same as i_thread_count
+        bool b_coroutines = false; // every probe is a coroutine on a few event loops (--crazy)
+        int i_max_probes = 0; // coroutines at once, 0 = as many as open files allow
+        int i_rate = 0; // coroutines started per second, 0 = no limit
+        bool b_per_core = false; // one pinned event loop per core, ports split between them
+        bool b_numa = false; // spread the engines over NUMA nodes
+        std::string s_checkpoint_file{}; // empty = no checkpoints
+        int i_checkpoint_interval = 5; // in seconds
+        bool b_resume = false;
+        Shard sh_shard{}; // whole range by default
+        std::string s_output_file{}; // empty = no list of results
+        std::string s_journal_file{}; // every probe in the binary journal, empty = none
+        bool b_banners = false;
+        int i_banner_concurrency = 256; // sockets waiting for banners at once
+        timeval t_banner_timeout = {2, 0};
+        bool b_udp_payloads = true; // protocol specific requests instead of empty datagrams
+        bool b_batch = false; // UDP scan of whole host with sendmmsg/recvmmsg
+        std::string s_ring_interface{}; // batched UDP through AF_PACKET rings on this interface
+        std::string s_metrics_file{}; // empty = no Prometheus file
+        uint16_t i_metrics_port = 0; // 0 = no HTTP endpoint
+        bool b_progress = false;
+        int i_progress_interval = 2; // in seconds
+        std::string s_trace_file{}; // empty = no tracing
+        std::string s_capture_file{}; // pcap of raw UDP probes and their replies, empty = none
+        int i_capture_snaplen = CAPTURE_DEFAULT_SNAPLEN; // bytes of every packet
+        int i_capture_sample = 1; // 1 of n probes is captured
+        std::string s_baseline_file{}; // results of the previous run, empty = full report
+        int i_sample_percent = 100; // of ports, which weren't open in the baseline
+        uint64_t i_sample_seed = 0; // 0 = another sample every day
     };
     typedef _flags flags;
 
+    /**
+     * Take everything the profile sets (-T0..-T5 or --timing-file),
+     * options given explicitly should be applied afterwards.
+    */
+    void set_timing(flags& f, const timingProfile& profile);
+
+    /**
+     * Between the starts of two probes - the longer of the delay and the rate.
+    */
+    std::chrono::nanoseconds probe_interval(const flags& f);
+#ifdef __linux__
+    /**
+     * Coroutines in flight for the flags - as many as open files allow,
+     * without sockets kept for the banners.
+    */
+    size_t probe_limit(const flags& f);
+#endif
+
     class PortScanner : public SubNet {
     private:
         flags settings{};
         std::mutex print_mutex;
 
-        ServicesDictionary* service_dictionary = nullptr;
+        std::shared_ptr<Engine> engine; // nullptr = everything is built for this scan
+        std::shared_ptr<ServicesDictionary> service_dictionary;
+        std::shared_ptr<UdpPayloads> udp_payloads;
+        std::map<const udpPayload*, PacketTemplate> udp_templates; // nullptr = empty datagram
+        std::unique_ptr<UdpBatchScanner> udp_batch;
+        std::unique_ptr<Checkpoint> checkpoint;
+        std::unique_ptr<ResultWriter> result_writer;
+        std::unique_ptr<Journal> journal;
+        std::unique_ptr<Capture> capture;
+#ifdef __linux__
+        std::unique_ptr<BannerGrabber> banner_grabber;
+#endif
+        std::unique_ptr<Metrics> metrics; // nullptr = not collected at all
+#ifdef __linux__
+        std::unique_ptr<MetricsExporter> metrics_exporter;
+#endif
+        std::unique_ptr<Progress> progress;
+        std::unique_ptr<Baseline> baseline;
+        AdaptiveTimeout timeouts;
+        std::unique_ptr<SourcePool> sources; // nullptr = the kernel picks the address
+        IcmpRateLimit icmp_limit; // of the current host
+        std::atomic<uint64_t> host_states[PORT_STATES]{}; // probes of the current host by their results
+        std::atomic<bool> host_cut_off{false}; // nothing but silence - the rest of its ports is skipped
+        bool hosts_started = false;
+
+        // --max-duration: hosts are visited in passes, see Deadline.h
+        std::unique_ptr<Deadline> deadline; // nullptr = one visit per host, in address order
+        std::vector<port> port_order; // ports of the range, the most common services first
+        size_t slice_from = 0; // of port_order, probed in the current pass
+        size_t slice_to = 0;
+        int pass = 0;
+        std::set<uint32_t> answered_hosts; // host order numbers of hosts with open or closed ports
+        std::set<uint32_t> silent_hosts; // cut off by --filtered-cutoff, never visited again
+        std::vector<uint32_t> pass_first; // answered hosts - the first ones of the pass
+        size_t pass_first_index = 0;
+        uint64_t pass_address = 0; // the rest of the hosts, in address order
+        Pacer pacer; // of the thread pool (--crazy uses the executor's one)
+
+        std::function<void(const portResult&)> result_callback;
+        std::atomic<bool> cancelled{false};
+#ifdef __linux__
+        // pause() of a running --crazy scan
+        std::mutex pause_mutex;
+        bool is_paused = false;
+        Executor* paused_executor = nullptr;
+        JobGroup* paused_group = nullptr;
+
+        void attach_pause(Executor* executor, JobGroup* group);
+#endif
+        std::unique_ptr<std::atomic<uint8_t>[]> probes_left; // per port, while TCP and UDP pipelines run apart
 
         void init_dictionary();
+        void init_metrics();
+        void init_sample();
+        void init_checkpoint();
+        void init_baseline();
+        void init_progress();
+        uint64_t probes_per_host();
+        void init_output();
+        void init_journal();
+        void init_capture();
+        void init_banners();
+        void init_udp_templates();
+        const PacketTemplate& udp_template(port port);
+        void init_udp_batch();
+        void init_timing();
+        void init_sources();
+        void init_deadline();
+        void init_stream();
+        retryPolicy udp_policy();
 
         void print(const std::ostringstream& stream);
         void print(const std::string& string);
         void print_settings();
         void print_scan_info(const IpAddress& address);
-        void print_row(port port, bool status, CONNECTION_TYPE protocol);
+        void print_row(port port, PORT_STATE state, CONNECTION_TYPE protocol, const std::string& service = "");
         void print_separator(const char& separator);
+        void print_recovered();
+        void print_changes();
+        void print_icmp_limit(double rate);
+        void print_host_summary();
+        void print_coverage();
+        void print_target(const IpAddress& ip, port port, PORT_STATE state, CONNECTION_TYPE protocol, const std::string& service);
 
-        void check_port(IpAddress ip, port port);
+        IpAddress first_host();
+        /**
+         * Moves to the next host to scan (the first one at the first call).
+         * @return false, when the scan is over
+        */
+        bool next_host(IpAddress& ip);
+        /**
+         * next_host of --max-duration - the next host of the pass,
+         * or the first one of the next pass with the next slice of ports.
+        */
+        bool next_visit(IpAddress& ip);
+        bool next_pass();
+        bool is_completed();
+        void begin_host(const IpAddress& ip);
+        bool is_pending(const IpAddress& ip, port port);
+        /**
+         * Probes of the current host are over (cancelled or the host was cut off).
+        */
+        bool is_host_stopped();
+        bool is_sampled(const IpAddress& ip, port port);
+        /**
+         * Calls probe for every pending port of the host,
+         * previously open ones (from the baseline) first.
+        */
+        void for_each_port(const IpAddress& ip, const std::function<void(port)>& probe);
+        bool has_port_tasks();
+        /**
+         * With -ALL, TCP and UDP probes go through pipelines of their own
+         * (workers, shares of the limits, completion), so the host takes
+         * as long as the slower protocol, not the sum of both.
+         * Makes room for the per port completion, when they do.
+        */
+        bool split_pipelines();
+        /**
+         * One probe of the port is over - marks it in the checkpoint,
+         * when it's the last one of the port.
+        */
+        void port_done(port port);
+        void scan_udp_batch(const IpAddress& ip);
+        void end_host(const IpAddress& ip);
+        void finish_scan();
+        /**
+         * Reads pairs of --stdin into the queue (closes it at the end of the input).
+        */
+        void read_targets(int fd, TargetQueue& targets);
+        void check_port(IpAddress ip, port port, CONNECTION_TYPE protocol);
+        bool check_tcp(const IpAddress& ip, port port);
+        /**
+         * Counts EADDRNOTAVAIL (no free local port) and similar,
+         * which are retried instead of being reported.
+        */
+        bool is_source_exhausted(int error);
+        /**
+         * Counts the finished probe - and cuts the host off after
+         * i_filtered_cutoff silent probes without any answer.
+        */
+        void count_probe(const IpAddress& ip, port port, CONNECTION_TYPE protocol, PORT_STATE state, int error,
+                         Metrics::clock::time_point started);
+        void count_queue_wait(Metrics::clock::time_point queued);
+        /**
+         * errno, which Metrics count for the UDP probe with the result.
+        */
+        static int udp_error(PORT_STATE state);
+        void check_udp(const IpAddress& ip, port port);
+        void report(const IpAddress& ip, port port, PORT_STATE state, CONNECTION_TYPE protocol,
+                    const std::string& service = "");
 
-        bool test_port(IpAddress ip, port in_port, CONNECTION_TYPE protocol, timeval timeout);
+        PORT_STATE test_port(IpAddress ip, port in_port, CONNECTION_TYPE protocol, timeval timeout);
+#ifdef __linux__
+        /**
+         * The same as check_port, but suspends on sockets instead of blocking the thread.
+         * @param buffer keep the results there instead of reporting them (--per-core)
+        */
+        Task<> probe_port(EventLoop& loop, IpAddress ip, port port, CONNECTION_TYPE protocol,
+                          Metrics::clock::time_point queued, std::vector<probeResult>* buffer = nullptr);
+        void spawn_probes(Executor& executor, JobGroup& group, const IpAddress& ip,
+                          const std::vector<port>& ports, CONNECTION_TYPE protocol);
+        /**
+         * Starts probes of every n-th pending port on the engine's own loop.
+        */
+        Task<> feed_core(EventLoop& loop, CoreEngine& engine, IpAddress ip, const std::vector<port>& pending,
+                         size_t first, size_t step);
+        static Job core_probe(PortScanner* scanner, EventLoop& loop, CoreEngine& engine, IpAddress ip, port port);
+        void flush_core_results(const IpAddress& ip, std::vector<std::unique_ptr<CoreEngine>>& engines);
+#endif
     public:
         PortScanner(IpAddress* ip, IpAddress* mask, flags args);
-        PortScanner(std::string& ip, std::string& mask, flags args);
+        /**
+         * @param engine warm services, payloads and event loops to use (daemon mode)
+        */
+        PortScanner(std::string& ip, std::string& mask, flags args, std::shared_ptr<Engine> engine = nullptr);
 
-        ~PortScanner() { delete service_dictionary; }
+#ifdef __linux__
+        ~PortScanner() { banner_grabber.reset(); }
+#endif
 
         void setFlags(flags f) { this->settings = f; }
+
+        /**
+         * Called for every open port, from the scanning threads
+         * (so it has to be thread safe), before scan() returns.
+        */
+        void setResultCallback(std::function<void(const portResult&)> callback) { result_callback = std::move(callback); }
+
+        /**
+         * Stop the scan as soon as possible - probes in flight are finished,
+         * queued ones are dropped. Safe to call from any thread
+         * and from a signal handler. The checkpoint (if any) stays resumable.
+        */
+        void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+        bool is_cancelled() const { return cancelled.load(std::memory_order_relaxed); }
+
+#ifdef __linux__
+        /**
+         * Hold back new probes of a --crazy scan (probes in flight go on),
+         * eg. while the reader of the results is behind. Other scans of
+         * the shared executor keep running. Resume a cancelled scan, before
+         * waiting for it - held back probes would never be dropped.
+        */
+        void pause(bool paused);
+#endif
         void scan();
         void no_threads_scan();
         void crazy_scan();
+        void per_core_scan();
+        /**
+         * Probes (host, port) pairs read from the stream, see TargetQueue.h.
+         * Every result is written as the -o line to stdout, as soon as the probe is over.
+        */
+        void stream_scan(int fd);
 
-        static bool tcp_connect(IpAddress ip, port in_port, timeval timeout);
-        static bool udp_connect(IpAddress ip, port in_port, timeval timeout);
+        static PORT_STATE tcp_connect(IpAddress ip, port in_port, timeval timeout);
+        /**
+         * If keep_open is given, connected socket is not closed,
+         * but returned through it (and owned by the caller).
+         * error gets 0 when connected, ETIMEDOUT without any answer,
+         * or errno of the failure (ECONNREFUSED for closed ports).
+         * @return OPEN, CLOSED (refused) or FILTERED (anything else)
+        */
+        static PORT_STATE tcp_connect(IpAddress ip, port in_port, timeval timeout, SOCKET* keep_open, int* error = nullptr,
+                                SourcePool* sources = nullptr);
+        /**
+         * State of the port, to which connect() has failed with the error.
+        */
+        static PORT_STATE failed_state(int error);
+        /**
+         * Closes the connected socket with RST, so its local port is free at once.
+        */
+        static void reset_socket(SOCKET s);
+        static PORT_STATE udp_connect(IpAddress ip, port in_port, timeval timeout);
+        /**
+         * Sends the probe built from the template and stops
+         * retrying as soon as the service or ICMP answers.
+         * @param capture writes sent probes and the matched replies (if the pair is sampled)
+         * @return OPEN (the service has replied), CLOSED (ICMP port unreachable),
+         * FILTERED (other ICMP unreachable) or OPEN_FILTERED (nothing)
+        */
+        static PORT_STATE udp_connect(IpAddress ip, port in_port, const retryPolicy& policy, const PacketTemplate& probe,
+                                      IcmpRateLimit* limit = nullptr, Capture* capture = nullptr);
+#ifdef __linux__
+        static Task<PORT_STATE> async_tcp_connect(EventLoop& loop, IpAddress ip, port in_port, timeval timeout, SOCKET* keep_open, int* error,
+                                                  SourcePool* sources = nullptr);
+        /**
+         * Coroutine version of udp_connect. Uses a connected datagram socket
+         * instead of raw ones, so the kernel matches replies and ICMP errors
+         * (ECONNREFUSED) with the probe - nobody has to read all the traffic.
+        */
+        static Task<PORT_STATE> async_udp_connect(EventLoop& loop, IpAddress ip, port in_port, retryPolicy policy,
+                                                  const udpPayload* payload, IcmpRateLimit* limit = nullptr);
+#endif
     };
 }
 
@@ -0,0 +1,48 @@
+/**
+ * PortState.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * What a probe has found out about the port:
+ * - OPEN - connected (TCP) or the service has replied (UDP)
+ * - CLOSED - the host itself refused it (RST, ICMP port unreachable)
+ * - FILTERED - no answer (TCP), or another ICMP unreachable - a firewall on the way
+ * - OPEN_FILTERED - UDP without any answer, open and filtered look the same
+*/
+
+#ifndef PORTSCAN_PORTSTATE_H
+#define PORTSCAN_PORTSTATE_H
+
+#include <cstdint>
+
+namespace scanner {
+    enum PORT_STATE : uint8_t {CLOSED, OPEN, FILTERED, OPEN_FILTERED, PORT_STATES};
+
+    inline const char* state_name(PORT_STATE state) {
+        switch (state) {
+            case OPEN: return "open";
+            case CLOSED: return "closed";
+            case FILTERED: return "filtered";
+            default: return "open|filtered";
+        }
+    }
+
+    /**
+     * Reported in the table and the results (closed and filtered ports are only counted).
+    */
+    inline bool is_reported(PORT_STATE state) {
+        return state == OPEN || state == OPEN_FILTERED;
+    }
+
+    /**
+     * The host itself has answered the probe - it's up.
+    */
+    inline bool is_answer(PORT_STATE state) {
+        return state == OPEN || state == CLOSED;
+    }
+}
+
+#endif //PORTSCAN_PORTSTATE_H
@@ -15,18 +15,40 @@
 namespace scanner {
 
     void PortScanner::print(const std::ostringstream &stream) {
+        if (!this->settings.b_print)
+            return;
+
         std::lock_guard<std::mutex> lock(print_mutex);
         std::cout << stream.str();
     }
 
     void PortScanner::print(const std::string &string) {
+        if (!this->settings.b_print)
+            return;
+
         std::lock_guard<std::mutex> lock(print_mutex);
         std::cout << string;
     }
 
     void PortScanner::init_dictionary() {
-        std::cout << "Loading services dictionary...\n";
-        this->service_dictionary = new ServicesDictionary();
+        bool payloads = this->settings.b_udp_payloads && (this->settings.ct_protocol != TCP || this->settings.b_stdin);
+
+        if (this->engine != nullptr) {
+            // loaded once for all scans
+            this->service_dictionary = this->engine->services;
+            if (payloads)
+                this->udp_payloads = this->engine->payloads;
+            return;
+        }
+
+        print("Loading services dictionary...\n");
+        this->service_dictionary = std::make_shared<ServicesDictionary>();
+        print("Loaded " + std::to_string(this->service_dictionary->size()) + " known ports..\n");
+
+        if (payloads) {
+            this->udp_payloads = std::make_shared<UdpPayloads>();
+            print("Loaded " + std::to_string(this->udp_payloads->size()) + " UDP payloads..\n");
+        }
     }
 
     void PortScanner::print_settings() {
@@ -37,12 +59,111 @@ namespace scanner {
             << "\tBroadcast ip: " << this->getBroadcastAddress().getAsString() << std::endl
             << "\tPorts for scan: " << this->settings.pr_range.from << " - " << this->settings.pr_range.to << std::endl
             << "\tProtocols: " << (this->settings.ct_protocol == TCP ? "TCP" : this->settings.ct_protocol == UDP ? "UDP" : "TCP and UDP") << std::endl
-            << "\tTime for response [only for TCP/IP!]: "
+            << "\tTiming: " << this->settings.s_timing << std::endl
+            << "\tTime for response: "
             << (static_cast<double>(this->settings.t_timeout.tv_sec) +
                 static_cast<double>(this->settings.t_timeout.tv_usec) * 0.000001)
-            << "s\n"
-            << "\tMultitasking: " << (this->settings.b_threads ? "true" : "false") << std::endl
-            << "\tThread pool: " << this->settings.i_thread_count << std::endl
+            << "s" << (Timing::toMs(this->settings.t_min_timeout) < Timing::toMs(this->settings.t_max_timeout)
+                       ? " (adapts within " + std::to_string(Timing::toMs(this->settings.t_min_timeout)) + " - "
+                         + std::to_string(Timing::toMs(this->settings.t_max_timeout)) + "ms)" : "") << std::endl
+            << "\tMultitasking: " << (this->settings.b_per_core ? "per-core engines" : this->settings.b_coroutines ? "coroutines"
+                                      : this->settings.b_threads ? "true" : "false") << std::endl
+            << (this->settings.b_per_core ? "\tEngines (pinned" + std::string(this->settings.b_numa ? ", over NUMA nodes): " : "): ")
+                : this->settings.b_coroutines ? "\tEvent loops: " : "\tThread pool: ") << this->settings.i_thread_count << std::endl;
+
+        if (this->settings.ct_protocol == ALL && this->settings.b_threads && !this->settings.b_coroutines
+            && !this->settings.b_per_core && !this->settings.b_batch) {
+            ss  << "\tUDP thread pool: " << (this->settings.i_udp_thread_count > 0 ? this->settings.i_udp_thread_count
+                                                                                   : this->settings.i_thread_count) << std::endl;
+        }
+
+        if (this->settings.i_concurrency > 0) {
+            ss  << "\tProbes in flight: " << this->settings.i_concurrency << std::endl;
+        }
+
+        if (probe_interval(this->settings).count() > 0) {
+            ss  << "\tBetween probes: "
+                << std::chrono::duration<double>(probe_interval(this->settings)).count() << "s" << std::endl;
+        }
+
+        if (this->deadline != nullptr) {
+            ss  << "\tMax duration: " << this->settings.i_max_duration
+                << "s (passes over all hosts, the most common ports first)" << std::endl;
+        }
+
+        if (this->settings.i_filtered_cutoff > 0) {
+            ss  << "\tFiltered hosts: skipped after " << this->settings.i_filtered_cutoff
+                << " probes without an answer" << std::endl;
+        }
+
+        if (this->sources != nullptr) {
+            ss  << "\tSource addresses: " << this->settings.s_source_addresses
+                << " (" << this->sources->size() << ")" << std::endl;
+        }
+
+        if (this->settings.sh_shard.isEnabled()) {
+            ss  << "\tShard: " << this->settings.sh_shard.getIndex() + 1 << "/" << this->settings.sh_shard.getCount()
+                << " (seed " << this->settings.sh_shard.getSeed() << ")" << std::endl;
+        }
+
+        if (this->settings.ct_protocol != TCP) {
+            ss  << "\tUDP retries: " << this->settings.i_retries << std::endl
+                << "\tUDP wait: " << (Timing::toMs(this->settings.t_udp_timeout) > 0
+                                     ? std::to_string(Timing::toMs(this->settings.t_udp_timeout)) + "ms" : "the TCP timeout")
+                << (Timing::toMs(this->settings.t_udp_timeout) < Timing::toMs(this->settings.t_max_timeout)
+                    ? ", doubles with every retry up to " + std::to_string(Timing::toMs(this->settings.t_max_timeout)) + "ms"
+                    : " per try") << std::endl
+                << "\tUDP payloads: " << (this->settings.b_udp_payloads ? "true" : "false") << std::endl
+                << "\tUDP engine: " << (!this->settings.s_ring_interface.empty() ? "batched (packet ring on " + this->settings.s_ring_interface + ")"
+                                     : this->settings.b_batch ? "batched (sendmmsg/recvmmsg)" : "per port") << std::endl;
+        }
+
+        if (this->settings.b_banners) {
+            ss  << "\tBanners: " << this->settings.i_banner_concurrency << " at once, timeout "
+                << (static_cast<double>(this->settings.t_banner_timeout.tv_sec) +
+                    static_cast<double>(this->settings.t_banner_timeout.tv_usec) * 0.000001)
+                << "s" << std::endl;
+        }
+
+        if (!this->settings.s_output_file.empty()) {
+            ss  << "\tResults list: " << this->settings.s_output_file << std::endl;
+        }
+
+        if (!this->settings.s_journal_file.empty()) {
+            ss  << "\tJournal: " << this->settings.s_journal_file << std::endl;
+        }
+
+        if (!this->settings.s_capture_file.empty()) {
+            ss  << "\tCapture: " << this->settings.s_capture_file << " (" << this->settings.i_capture_snaplen << " bytes of packets"
+                << (this->settings.i_capture_sample > 1 ? ", 1 of " + std::to_string(this->settings.i_capture_sample) + " probes)" : ")")
+                << std::endl;
+        }
+
+        if (!this->settings.s_metrics_file.empty() || this->settings.i_metrics_port != 0) {
+            ss  << "\tMetrics:"
+                << (!this->settings.s_metrics_file.empty() ? " " + this->settings.s_metrics_file : "")
+                << (this->settings.i_metrics_port != 0 ? " http://127.0.0.1:" + std::to_string(this->settings.i_metrics_port) + "/metrics" : "")
+                << std::endl;
+        }
+
+        if (!this->settings.s_baseline_file.empty()) {
+            ss  << "\tBaseline: " << this->settings.s_baseline_file << " (changes only)" << std::endl;
+        }
+
+        if (this->settings.i_sample_percent < 100) {
+            ss  << "\tSample: " << this->settings.i_sample_percent << "% of ports"
+                << (!this->settings.s_baseline_file.empty() ? " closed in the baseline" : "")
+                << (this->settings.i_sample_seed != 0 ? " (seed " + std::to_string(this->settings.i_sample_seed) + ")" : "")
+                << std::endl;
+        }
+
+        if (!this->settings.s_checkpoint_file.empty()) {
+            ss  << "\tCheckpoint: " << this->settings.s_checkpoint_file
+                << " (every " << this->settings.i_checkpoint_interval << "s"
+                << (this->settings.b_resume ? ", resumed)" : ")") << std::endl;
+        }
+
+        ss
             << std::setfill('-') << std::setw(56) << "" << std::setfill(' ') << std::endl;
 
         print(ss);
@@ -51,6 +172,10 @@ namespace scanner {
     void PortScanner::print_scan_info(const IpAddress& address) {
         std::ostringstream ss;
 
+        if (baseline != nullptr) {
+            return; // only changes are reported
+        }
+
         ss  << "\nStarting scanning for " << address.getAsString()
             << " with timeout = "
             << (static_cast<double>(this->settings.t_timeout.tv_sec) +
@@ -65,28 +190,153 @@ namespace scanner {
         print(ss);
     }
 
-    void PortScanner::print_row(port port, bool status, CONNECTION_TYPE protocol) {
-        std::string serv = "unknown";
+    void PortScanner::print_row(port port, PORT_STATE state, CONNECTION_TYPE protocol, const std::string& service) {
+        std::string serv = service.empty() ? "unknown" : service;
 
-        if (status) {
-            if (service_dictionary != nullptr) {
+        if (is_reported(state) && baseline == nullptr) {
+            if (service.empty() && service_dictionary != nullptr) {
                 serv = service_dictionary->getService(port, protocol);
             }
 
             std::ostringstream ss;
             ss
                 << std::left << std::setw(20) << std::to_string(port) + (protocol == TCP ? "/tcp" : "/udp")
-                << std::left << std::setw(20) << (protocol == TCP ? "open" : "open|filtered") 
+                << std::left << std::setw(20) << state_name(state)
                 << std::left << serv << std::endl;
             print(ss);
         }
     }
 
+    void PortScanner::print_target(const IpAddress& ip, port port, PORT_STATE state, CONNECTION_TYPE protocol,
+                                   const std::string& service) {
+        std::string serv = !service.empty() ? service
+            : service_dictionary != nullptr ? service_dictionary->getService(port, protocol) : "unknown";
+        std::string line = ip.getAsString() + " " + std::to_string(port) + (protocol == TCP ? "/tcp " : "/udp ")
+            + state_name(state) + " " + serv + "\n";
+
+        std::lock_guard<std::mutex> lock(print_mutex);
+        std::cout << line << std::flush; // the next stage of the pipeline gets it at once
+    }
+
+    void PortScanner::print_recovered() {
+        std::ostringstream ss;
+        auto& results = checkpoint->getResults();
+
+        ss  << "\nResuming from " << this->settings.s_checkpoint_file
+            << " at " << checkpoint->getCurrentHost().getAsString()
+            << (checkpoint->isCompleted() ? " (scan already completed)" : "") << std::endl
+            << std::setw(56) << std::setfill('=') << "" << std::setfill(' ') << std::endl
+            << std::left << std::setw(20) << "HOST"
+            << std::setw(20) << "PORT/PROTOCOL"
+            << std::setw(20) << "SERVICE"
+            << std::endl;
+
+        for (auto& r : results) {
+            ss  << std::left << std::setw(20) << IpAddress(r.ip).getAsString()
+                << std::left << std::setw(20) << std::to_string(r.port) + (r.protocol == TCP ? "/tcp" : "/udp")
+                << std::left << (service_dictionary != nullptr ? service_dictionary->getService(r.port, r.protocol) : "unknown")
+                << std::endl;
+        }
+
+        ss << std::setw(56) << std::setfill('=') << "" << std::setfill(' ') << std::endl;
+
+        print(ss);
+    }
+
     void PortScanner::print_separator(const char &separator) {
         std::ostringstream ss;
 
+        if (baseline != nullptr) {
+            return;
+        }
+
         ss << std::setw(56) << std::setfill(separator) << "" << std::setfill(' ') << std::endl;
 
         print(ss);
     }
-}
\ No newline at end of file
+
+    void PortScanner::print_icmp_limit(double rate) {
+        std::ostringstream ss;
+
+        if (baseline != nullptr) {
+            return;
+        }
+
+        ss << "ICMP unreachable limited to " << std::setprecision(3) << rate << "/s by the host, UDP probes were paced" << std::endl;
+        print(ss);
+    }
+
+    void PortScanner::print_host_summary() {
+        std::ostringstream ss;
+        uint64_t closed = host_states[CLOSED].load(std::memory_order_relaxed);
+        uint64_t filtered = host_states[FILTERED].load(std::memory_order_relaxed);
+
+        if (baseline != nullptr) {
+            return;
+        }
+
+        if (host_cut_off) {
+            ss << "No answer to " << filtered + host_states[OPEN_FILTERED].load(std::memory_order_relaxed)
+               << " probes - the host is down or filtered, the rest of its ports were skipped" << std::endl;
+        } else if (closed > 0 || filtered > 0) {
+            ss << "Not shown: " << closed << " closed, " << filtered << " filtered" << std::endl;
+        } else {
+            return;
+        }
+        print(ss);
+    }
+
+    void PortScanner::print_coverage() {
+        std::ostringstream ss;
+        uint64_t hosts = static_cast<uint64_t>(this->getBroadcastAddress().getAsNetNumber())
+                         - this->getSubnetAddress().getAsNetNumber() + 1;
+        uint64_t total = hosts * probes_per_host();
+        uint64_t probes = deadline->getProbes();
+        // the pass, which was stopped, covered only some of the hosts
+        size_t complete = deadline->expired() || is_cancelled() ? slice_from : slice_to;
+
+        ss  << "\n" << (deadline->expired() ? "Deadline reached" : is_cancelled() ? "Scan cancelled" : "Scan finished")
+            << " after " << std::fixed << std::setprecision(1) << std::chrono::duration<double>(deadline->elapsed()).count()
+            << "s of " << settings.i_max_duration << "s (" << std::setprecision(0) << deadline->rate() << " probes/s)" << std::endl
+            << "Coverage: " << probes << " of " << total << " probes (" << std::setprecision(1)
+            << 100.0 * static_cast<double>(probes) / static_cast<double>(total > 0 ? total : 1) << "%), "
+            << complete << " of " << port_order.size() << " most common ports on every host" << std::endl
+            << "Hosts: " << answered_hosts.size() << " answered, " << silent_hosts.size() << " silent (cut off), "
+            << hosts - answered_hosts.size() - silent_hosts.size() << " without any answer so far" << std::endl;
+
+        print(ss);
+    }
+
+    void PortScanner::print_changes() {
+        std::ostringstream ss;
+
+        if (is_cancelled()) {
+            ss  << "\n" << (deadline != nullptr && deadline->expired() ? "Deadline reached" : "Scan cancelled")
+                << " - changes since " << baseline->getFilename() << " are reported by a complete scan\n";
+            print(ss);
+            return;
+        }
+
+        auto changes = baseline->diff([this](const IpAddress& ip, uint16_t port, CONNECTION_TYPE protocol) {
+            // previously open ports of the range were probed, whatever the sample
+            return ip >= this->getSubnetAddress() && ip <= this->getBroadcastAddress()
+                && port >= settings.pr_range.from && port <= settings.pr_range.to
+                && (settings.ct_protocol == ALL || settings.ct_protocol == protocol)
+                && (!settings.sh_shard.isEnabled() || settings.sh_shard.owns(ip.getAsNetNumber(), port));
+        });
+
+        ss  << "\nChanges since " << baseline->getFilename() << ":\n"
+            << std::setw(56) << std::setfill('=') << "" << std::setfill(' ') << std::endl;
+
+        for (auto& change : changes) {
+            ss << change << std::endl;
+        }
+        if (changes.empty()) {
+            ss << "no changes" << std::endl;
+        }
+
+        ss << std::setw(56) << std::setfill('=') << "" << std::setfill(' ') << std::endl;
+
+        print(ss);
+    }
+}
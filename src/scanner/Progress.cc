@@ -0,0 +1,110 @@
+/**
+ * Progress.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "Progress.h"
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#define RATE_SMOOTHING 0.3 // weight of the last interval in the rate
+
+namespace scanner {
+
+    Progress::Progress(uint64_t total, int interval_in_seconds)
+            : total(total > 0 ? total : 1), interval(interval_in_seconds > 0 ? interval_in_seconds : 1) {}
+
+    void Progress::start() {
+        started = clock::now();
+        is_running = true;
+        reporter = std::thread(&Progress::reporterLoop, this);
+    }
+
+    void Progress::stop() {
+        {
+            std::lock_guard<std::mutex> lock(reporter_mutex);
+            if (!is_running)
+                return;
+            is_running = false;
+        }
+        reporter_wakeup.notify_all();
+        reporter.join();
+
+        print(true);
+    }
+
+    void Progress::beginHost() {
+        host_base = probed.load(std::memory_order_relaxed) + skipped.load(std::memory_order_relaxed);
+    }
+
+    void Progress::endHost(uint64_t expected) {
+        uint64_t seen = probed.load(std::memory_order_relaxed) + skipped.load(std::memory_order_relaxed) - host_base;
+
+        if (seen < expected) {
+            skip(expected - seen); // not ours (shard) or done before resume
+        }
+    }
+
+    void Progress::reporterLoop() {
+        std::unique_lock<std::mutex> lock(reporter_mutex);
+        uint64_t last = probed.load(std::memory_order_relaxed) + skipped.load(std::memory_order_relaxed);
+        auto last_time = clock::now();
+
+        while (is_running) {
+            reporter_wakeup.wait_for(lock, std::chrono::seconds(interval), [this]() {
+                return !is_running;
+            });
+
+            if (!is_running)
+                break;
+
+            uint64_t now_done = probed.load(std::memory_order_relaxed) + skipped.load(std::memory_order_relaxed);
+            auto now = clock::now();
+            double seconds = std::chrono::duration<double>(now - last_time).count();
+            double current = seconds > 0 ? static_cast<double>(now_done - last) / seconds : 0;
+
+            rate = rate == 0 ? current : RATE_SMOOTHING * current + (1 - RATE_SMOOTHING) * rate;
+            last = now_done;
+            last_time = now;
+
+            lock.unlock();
+            print(false);
+            lock.lock();
+        }
+    }
+
+    static std::string format_time(double seconds) {
+        std::ostringstream ss;
+        auto s = static_cast<uint64_t>(seconds + 0.5);
+
+        ss << std::setfill('0') << s / 3600 << ":" << std::setw(2) << s / 60 % 60 << ":" << std::setw(2) << s % 60;
+        return ss.str();
+    }
+
+    void Progress::print(bool final) {
+        std::ostringstream ss;
+        uint64_t p = probed.load(std::memory_order_relaxed);
+        uint64_t done = std::min(p + skipped.load(std::memory_order_relaxed), total);
+        double elapsed = std::chrono::duration<double>(clock::now() - started).count();
+
+        ss  << "PROGRESS: " << std::fixed << std::setprecision(1)
+            << 100.0 * static_cast<double>(done) / static_cast<double>(total) << "% "
+            << "(" << done << "/" << total << "), " << p << " probes";
+
+        if (final) {
+            ss  << " in " << format_time(elapsed) << "\n";
+        } else {
+            ss  << ", " << std::setprecision(0) << rate << "/s, ETA "
+                << (rate > 0 ? format_time(static_cast<double>(total - done) / rate) : "?") << "\n";
+        }
+
+        std::cerr << ss.str();
+    }
+}
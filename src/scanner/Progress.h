@@ -0,0 +1,71 @@
+/**
+ * Progress.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Completion, probe rate and ETA of the scan, printed to stderr
+ * every few seconds by a separate thread.
+ *
+ * Probes only increment one relaxed atomic counter. Pairs, which are
+ * never probed here (other shards, ports done before resume), are
+ * accounted at the end of every host, so the host boundaries are exact
+ * and the rate includes them - what matters for the ETA is how fast
+ * the scan moves through the range, not how many packets it sends.
+*/
+
+#ifndef PORTSCAN_PROGRESS_H
+#define PORTSCAN_PROGRESS_H
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace scanner {
+    class Progress {
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        uint64_t total; // probes of the whole range
+        int interval; // in seconds
+
+        std::atomic<uint64_t> probed{0};
+        std::atomic<uint64_t> skipped{0};
+        uint64_t host_base = 0; // probed + skipped, when the current host has started
+
+        clock::time_point started;
+        double rate = 0; // smoothed, probes (or skipped) per second
+
+        std::thread reporter;
+        std::mutex reporter_mutex;
+        std::condition_variable reporter_wakeup;
+        bool is_running = false;
+
+        void reporterLoop();
+        void print(bool final);
+    public:
+        Progress(uint64_t total, int interval_in_seconds);
+        ~Progress() { stop(); }
+
+        void start();
+        void stop(); // prints the final line
+
+        // one relaxed increment, the timer thread reads it
+        void probeDone() { probed.fetch_add(1, std::memory_order_relaxed); }
+
+        /**
+         * Called by the scanning loop, around every host.
+         * @param expected probes of the whole host
+        */
+        void beginHost();
+        void endHost(uint64_t expected);
+        void skip(uint64_t probes) { skipped.fetch_add(probes, std::memory_order_relaxed); }
+    };
+}
+
+#endif //PORTSCAN_PROGRESS_H
@@ -0,0 +1,40 @@
+/**
+ * ResultWriter.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "ResultWriter.h"
+
+#include <stdexcept>
+
+namespace scanner {
+
+    ResultWriter::ResultWriter(const std::string& filename, bool append)
+            : file(filename, std::ios::out | (append ? std::ios::app : std::ios::trunc)) {
+        if (!file.good()) {
+            throw std::runtime_error("ERROR: Cannot create output file `" + filename + "`");
+        }
+    }
+
+    ResultWriter::~ResultWriter() {
+        file.close();
+    }
+
+    void ResultWriter::writeComment(const std::string& comment) {
+        std::lock_guard<std::mutex> lock(file_mutex);
+        file << "# " << comment << "\n";
+    }
+
+    void ResultWriter::write(const IpAddress& ip, uint16_t port, CONNECTION_TYPE protocol, const std::string& status, const std::string& service) {
+        std::string line = ip.getAsString() + " " + std::to_string(port) + (protocol == TCP ? "/tcp " : "/udp ")
+            + status + " " + service + "\n";
+
+        std::lock_guard<std::mutex> lock(file_mutex);
+        file << line;
+        file.flush(); // so the list is usable while the scan is running
+    }
+}
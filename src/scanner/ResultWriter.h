@@ -0,0 +1,45 @@
+/**
+ * ResultWriter.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Machine readable list of results - one line per open port:
+ *
+ *      <ip> <port>/<tcp|udp> <status> <service>
+ *
+ * Lines don't depend on each other, so lists from many runs
+ * (eg. from every shard) can be merged with `sort -u`.
+*/
+
+#ifndef PORTSCAN_RESULTWRITER_H
+#define PORTSCAN_RESULTWRITER_H
+
+#include "../net/IpAddress.h"
+#include "../net/ServicesDictionary.h"
+
+#include <string>
+#include <fstream>
+#include <mutex>
+
+namespace scanner {
+    using namespace net;
+
+    class ResultWriter {
+        std::ofstream file;
+        std::mutex file_mutex;
+    public:
+        /**
+         * @param append keep lines of the previous run (used on resume)
+        */
+        ResultWriter(const std::string& filename, bool append);
+        ~ResultWriter();
+
+        void writeComment(const std::string& comment);
+        void write(const IpAddress& ip, uint16_t port, CONNECTION_TYPE protocol, const std::string& status, const std::string& service);
+    };
+}
+
+#endif //PORTSCAN_RESULTWRITER_H
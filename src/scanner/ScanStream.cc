@@ -0,0 +1,90 @@
+/**
+ * ScanStream.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "ScanStream.h"
+
+namespace scanner {
+
+    ScanStream::ScanStream(std::string ip, std::string mask, flags f, size_t capacity)
+            : capacity(capacity > 0 ? capacity : 1) {
+        f.b_print = false;
+
+        scanner = std::make_unique<PortScanner>(ip, mask, f); // throws here, not in next()
+        scanner->setResultCallback([this](const portResult& r) {
+            push(r);
+        });
+
+        worker = std::thread(&ScanStream::run, this);
+    }
+
+    ScanStream::~ScanStream() {
+        cancel();
+        worker.join();
+    }
+
+    void ScanStream::run() {
+        try {
+            scanner->scan();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            finished = true;
+        }
+        not_empty.notify_all();
+    }
+
+    void ScanStream::push(const portResult& r) {
+        std::unique_lock<std::mutex> lock(results_mutex);
+
+        not_full.wait(lock, [this]() {
+            return results.size() < capacity || scanner->is_cancelled();
+        });
+
+        if (scanner->is_cancelled()) {
+            return; // nobody is going to read it
+        }
+
+        results.push_back(r);
+        lock.unlock();
+        not_empty.notify_one();
+    }
+
+    bool ScanStream::next(portResult& r) {
+        std::unique_lock<std::mutex> lock(results_mutex);
+
+        not_empty.wait(lock, [this]() {
+            return !results.empty() || finished;
+        });
+
+        if (results.empty()) {
+            if (error)
+                std::rethrow_exception(error);
+            return false;
+        }
+
+        r = std::move(results.front());
+        results.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+        return true;
+    }
+
+    void ScanStream::cancel() {
+        scanner->cancel();
+        {
+            // the flag is checked under the mutex by push()
+            std::lock_guard<std::mutex> lock(results_mutex);
+        }
+        not_full.notify_all();
+    }
+}
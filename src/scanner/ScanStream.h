@@ -0,0 +1,72 @@
+/**
+ * ScanStream.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Pull interface of the scanner, for programs embedding libportscan:
+ *
+ *      scanner::ScanStream scan("10.0.0.0", "/24", f);
+ *      scanner::portResult r;
+ *
+ *      while (scan.next(r))
+ *          ...
+ *
+ * The scan runs in its own thread and open ports wait in a bounded
+ * queue - when the reader is slow, the scan slows down as well.
+ * Destroying the stream cancels the scan.
+*/
+
+#ifndef PORTSCAN_SCANSTREAM_H
+#define PORTSCAN_SCANSTREAM_H
+
+#include "PortScanner.h"
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+
+namespace scanner {
+    class ScanStream {
+    private:
+        std::unique_ptr<PortScanner> scanner;
+        std::thread worker;
+
+        std::deque<portResult> results;
+        size_t capacity;
+        bool finished = false;
+        std::exception_ptr error;
+
+        std::mutex results_mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+
+        void push(const portResult& r);
+        void run();
+    public:
+        /**
+         * Throws std::runtime_error, if the scan can't be set up
+         * (eg. wrong address or checkpoint of another scan).
+        */
+        ScanStream(std::string ip, std::string mask, flags f, size_t capacity = 1024);
+        ~ScanStream();
+
+        ScanStream(const ScanStream&) = delete;
+        ScanStream& operator=(const ScanStream&) = delete;
+
+        /**
+         * Wait for the next open port.
+         * Returns false, when the scan is over (rethrows its error, if it has failed).
+        */
+        bool next(portResult& r);
+
+        void cancel();
+    };
+}
+
+#endif //PORTSCAN_SCANSTREAM_H
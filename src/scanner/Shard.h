@@ -0,0 +1,98 @@
+/**
+ * Shard.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Split of one scan between many machines, without any communication
+ * between them. Every (host, port) pair is hashed together with a seed,
+ * and the hash decides which shard owns the pair. All nodes started
+ * with the same range, N and seed will agree on the owner, so each pair
+ * is scanned exactly once. Hashing (instead of cutting the range into
+ * N pieces) spreads hosts and popular ports evenly between shards.
+*/
+
+#ifndef PORTSCAN_SHARD_H
+#define PORTSCAN_SHARD_H
+
+#include <cstdint>
+#include <string>
+#include <cstdlib>
+
+namespace scanner {
+    class Shard {
+        uint32_t index = 0; // 0 based
+        uint32_t count = 1;
+        uint64_t seed = 0;
+
+        // splitmix64 finalizer - cheap and good enough for uniform split
+        static uint64_t mix(uint64_t x) {
+            x += 0x9e3779b97f4a7c15ULL;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+            return x ^ (x >> 31);
+        }
+    public:
+        Shard() = default;
+        Shard(uint32_t index, uint32_t count, uint64_t seed) : index(index), count(count), seed(seed) {}
+
+        /**
+         * Parse "i/N", where 1 <= i <= N.
+         * Returns false, if the string is not a valid shard.
+        */
+        static bool parse(const std::string& str, Shard& shard) {
+            auto slash = str.find('/');
+            char* end = nullptr;
+
+            if (slash == std::string::npos)
+                return false;
+
+            // named, so `end` doesn't point into a destroyed temporary
+            std::string first = str.substr(0, slash);
+            std::string second = str.substr(slash + 1);
+
+            unsigned long i = std::strtoul(first.c_str(), &end, 10);
+            if (*end != '\0')
+                return false;
+            unsigned long n = std::strtoul(second.c_str(), &end, 10);
+            if (*end != '\0')
+                return false;
+
+            if (n == 0 || i == 0 || i > n || n > UINT32_MAX)
+                return false;
+
+            shard.index = static_cast<uint32_t>(i - 1);
+            shard.count = static_cast<uint32_t>(n);
+            return true;
+        }
+
+        /**
+         * @param host address in host byte order
+        */
+        bool owns(uint32_t host, uint16_t port) const {
+            if (count == 1)
+                return true;
+
+            // multiply-shift instead of modulo, to map hash into [0, count)
+            return static_cast<uint32_t>(((hash(seed, host, port) >> 32) * count) >> 32) == index;
+        }
+
+        /**
+         * The same hash of the pair is used for sampling (--sample).
+        */
+        static uint64_t hash(uint64_t seed, uint32_t host, uint16_t port) {
+            return mix(seed ^ ((static_cast<uint64_t>(host) << 16) | port));
+        }
+
+        void setSeed(uint64_t s) { seed = s; }
+
+        bool isEnabled() const { return count > 1; }
+        uint32_t getIndex() const { return index; }
+        uint32_t getCount() const { return count; }
+        uint64_t getSeed() const { return seed; }
+    };
+}
+
+#endif //PORTSCAN_SHARD_H
@@ -9,10 +9,33 @@
 
 #include "PortScanner.h"
 #include <iostream>
+#include <cerrno>
 
 namespace scanner {
 
-    bool PortScanner::tcp_connect(IpAddress ip, port in_port, timeval timeout) {
+    PORT_STATE PortScanner::tcp_connect(IpAddress ip, port in_port, timeval timeout) {
+        return tcp_connect(ip, in_port, timeout, nullptr, nullptr);
+    }
+
+    PORT_STATE PortScanner::failed_state(int error) {
+        // RST is the answer of the host itself, silence or ICMP unreachable - of a firewall
+#ifdef _WIN32
+        return error == ECONNREFUSED || error == WSAECONNREFUSED ? CLOSED : FILTERED;
+#else
+        return error == ECONNREFUSED ? CLOSED : FILTERED;
+#endif
+    }
+
+    void PortScanner::reset_socket(SOCKET s) {
+        struct linger l = {1, 0};
+
+        // RST instead of FIN - the local port doesn't wait in TIME_WAIT
+        setsockopt(s, SOL_SOCKET, SO_LINGER, (const char*)&l, sizeof(l));
+        closesocket(s);
+    }
+
+    PORT_STATE PortScanner::tcp_connect(IpAddress ip, port in_port, timeval timeout, SOCKET* keep_open, int* error,
+                                        SourcePool* sources) {
         struct sockaddr_in addr{0}; // connection struct
         SOCKET S_socket = 1;
         int res = 0;
@@ -22,6 +45,7 @@ namespace scanner {
         // for socket state purposes
         int val = 0;
         socklen_t len = 0;
+        int failure = 0; // tells closed and filtered ports apart, when the caller doesn't want the error
 
 #ifdef _WIN32
         // Windows needs to enable socket before using it.
@@ -33,17 +57,30 @@ namespace scanner {
         }
 #endif
 
+        if (error == nullptr)
+            error = &failure;
+        *error = 0;
+
         // Create TCP socket. Many people skip last parameter,
         // but accordint to standard it should be here.
         S_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 
        if (S_socket == INVALID_SOCKET) {
+            *error = errno; // before anything else overwrites it
             std::cerr << "ERROR: Cannot create socket.." << std::endl;
 #ifdef _WIN32
             WSACleanup();
 #endif
             closesocket(S_socket);
-            return false;
+            return failed_state(*error);
+        }
+
+        Trace::add(Trace::SOCKET_CREATED, ip, in_port, TCP);
+
+        if (sources != nullptr && (res = sources->bind(S_socket)) != 0) {
+            *error = res;
+            closesocket(S_socket);
+            return failed_state(*error);
         }
 
         // fill conection struct
@@ -63,7 +100,15 @@ namespace scanner {
 
         // If response wasn't immediately received,
         // we have to wait a little bit
-        if (res < 0) {
+#ifdef _WIN32
+        if (res < 0 && WSAGetLastError() != WSAEWOULDBLOCK) {
+#else
+        if (res < 0 && errno != EINPROGRESS) {
+#endif
+            // failed at once - eg. EADDRNOTAVAIL, when no local port is free
+            *error = errno;
+            res = SOCKET_ERROR;
+        } else if (res < 0) {
             FD_ZERO(&fd);
             FD_SET(S_socket, &fd);
 
@@ -81,21 +126,35 @@ namespace scanner {
                 if (res == SOCKET_ERROR || val) {
                     res = SOCKET_ERROR;
                 }
+                *error = val != 0 ? val : res == SOCKET_ERROR ? errno : 0;
             } else {
+                *error = res == 0 ? ETIMEDOUT : errno;
                 res = SOCKET_ERROR;
             }
         }
 
-        shutdown(S_socket, SD_RECEIVE); // block socket from reciving requests
-        closesocket(S_socket); // close socket
+        Trace::add(Trace::CONNECT, ip, in_port, TCP);
+
+        if (keep_open != nullptr && res != SOCKET_ERROR) {
+            // connected - the caller wants to talk with the server
+            *keep_open = S_socket;
+            return OPEN;
+        }
+
+        if (res == SOCKET_ERROR) {
+            shutdown(S_socket, SD_RECEIVE); // block socket from reciving requests
+            closesocket(S_socket); // close socket
+        } else {
+            reset_socket(S_socket);
+        }
 
         if (res == SOCKET_ERROR) {
 #ifdef _WIN32
             WSACleanup();
 #endif
-            return false; // closed
+            return failed_state(*error); // closed or filtered
         } else {
-            return true; // opened
+            return OPEN;
         }
     }
     
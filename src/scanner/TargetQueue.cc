@@ -0,0 +1,116 @@
+/**
+ * TargetQueue.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "TargetQueue.h"
+
+#include <sstream>
+#include <cstdlib>
+
+namespace scanner {
+
+    bool TargetQueue::push(const target& t) {
+        std::unique_lock<std::mutex> lock(targets_mutex);
+
+        not_full.wait(lock, [this]() {
+            return targets.size() < capacity || cancelled;
+        });
+
+        if (cancelled) {
+            return false;
+        }
+
+        targets.push_back(t);
+        lock.unlock();
+        not_empty.notify_one();
+        return true;
+    }
+
+    bool TargetQueue::pop(target& t) {
+        std::unique_lock<std::mutex> lock(targets_mutex);
+
+        not_empty.wait(lock, [this]() {
+            return !targets.empty() || closed || cancelled;
+        });
+
+        if (targets.empty() || cancelled) {
+            return false;
+        }
+
+        t = targets.front();
+        targets.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+        return true;
+    }
+
+    void TargetQueue::close() {
+        {
+            std::lock_guard<std::mutex> lock(targets_mutex);
+            closed = true;
+        }
+        not_empty.notify_all();
+    }
+
+    void TargetQueue::cancel() {
+        {
+            std::lock_guard<std::mutex> lock(targets_mutex);
+            cancelled = true;
+            targets.clear();
+        }
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    bool TargetQueue::parse(const std::string& line, CONNECTION_TYPE protocol, target& t) {
+        std::istringstream ss(line);
+        std::string host, port;
+
+        ss >> host;
+        auto colon = host.find(':');
+
+        if (colon != std::string::npos) {
+            port = host.substr(colon + 1); // host:port[/proto]
+            host.resize(colon);
+        } else {
+            ss >> port; // the -o line
+        }
+
+        auto slash = port.find('/');
+        if (slash != std::string::npos) {
+            std::string name = port.substr(slash + 1);
+
+            if (name == "tcp" || name == "TCP")
+                protocol = TCP;
+            else if (name == "udp" || name == "UDP")
+                protocol = UDP;
+            else
+                return false;
+            port.resize(slash);
+        }
+
+        if (port.empty() || port.size() > 5 || port.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        long number = std::strtol(port.c_str(), nullptr, 10);
+        if (number > 65535) {
+            return false;
+        }
+
+        // not IpAddress::pton - errors of the input don't belong to stdout
+        addr_ipv4 addr{};
+        if (::inet_pton(AF_INET, host.c_str(), &addr) != 1) {
+            return false;
+        }
+
+        t.ip = IpAddress(addr.num);
+        t.port = static_cast<uint16_t>(number);
+        t.protocol = protocol;
+        return true;
+    }
+}
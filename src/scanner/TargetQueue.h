@@ -0,0 +1,93 @@
+/**
+ * TargetQueue.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * (host, port) pairs of the --stdin mode, on their way from the reader
+ * to the probes. The queue is bounded - when probes are slower than
+ * the input, the reader waits, so the pipe fills up and the program
+ * in front of the scanner slows down, instead of the memory filling up.
+ *
+ * Lines of the input:
+ *
+ *      10.0.0.5:22
+ *      10.0.0.5:53/udp
+ *      10.0.0.5 443/tcp open https         (-o lines, so results can be rescanned)
+ *
+ * Without the protocol, the pair is probed with -TCP, -UDP or -ALL.
+*/
+
+#ifndef PORTSCAN_TARGETQUEUE_H
+#define PORTSCAN_TARGETQUEUE_H
+
+#include "../net/IpAddress.h"
+#include "../net/ServicesDictionary.h"
+
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#define TARGET_QUEUE_SIZE 4096 // pairs read ahead of the probes
+#define TARGET_POLL_MS 100 // the reader checks so often, whether the scan was cancelled
+
+namespace scanner {
+    using namespace net;
+
+    struct target {
+        IpAddress ip;
+        uint16_t port = 0;
+        CONNECTION_TYPE protocol = TCP; // or ALL - both probes of the pair
+        std::chrono::steady_clock::time_point queued{}; // pushed, for the queue wait (empty = not measured)
+    };
+
+    class TargetQueue {
+    private:
+        std::deque<target> targets;
+        size_t capacity;
+        bool closed = false; // nothing more is coming
+        bool cancelled = false;
+
+        std::mutex targets_mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+    public:
+        explicit TargetQueue(size_t capacity = TARGET_QUEUE_SIZE) : capacity(capacity > 0 ? capacity : 1) {}
+
+        /**
+         * Waits for room in the queue.
+         * Returns false, when the queue was cancelled (stop reading).
+        */
+        bool push(const target& t);
+
+        /**
+         * Waits for the next pair.
+         * Returns false, when the input is over and the queue is empty, or it was cancelled.
+        */
+        bool pop(target& t);
+
+        /**
+         * The end of the input - pairs in the queue are still taken.
+        */
+        void close();
+
+        /**
+         * Wakes up both sides, pairs in the queue are dropped.
+        */
+        void cancel();
+
+        /**
+         * Parses the line of the input.
+         * @param protocol of pairs without their own one
+         * @return false, when it's not a pair (comments and empty lines are skipped by the caller)
+        */
+        static bool parse(const std::string& line, CONNECTION_TYPE protocol, target& t);
+    };
+}
+
+#endif //PORTSCAN_TARGETQUEUE_H
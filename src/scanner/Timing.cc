@@ -0,0 +1,145 @@
+/**
+ * Timing.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "Timing.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+
+namespace scanner {
+
+    static const timingProfile profiles[] = {
+        // name        in flight  timeout  min   max    retries  udp   delay   rate
+        {"paranoid",   1,         5000,    1000, 10000, 9,       0,    300000, 0},
+        {"sneaky",     1,         5000,    1000, 10000, 9,       0,    15000,  0},
+        {"polite",     10,        1000,    100,  10000, 9,       0,    400,    0},
+        {"normal",     0,         500,     500,  500,   4,       1000, 0,      0}, // fixed, as without a profile
+        {"aggressive", 0,         500,     100,  1250,  2,       0,    0,      0},
+        {"insane",     0,         250,     50,   300,   1,       0,    0,      0},
+    };
+
+    timeval retryPolicy::wait(int attempt) const {
+        int64_t us = static_cast<int64_t>(timeout.tv_sec) * 1000000 + timeout.tv_usec;
+        int64_t max_us = static_cast<int64_t>(max_timeout.tv_sec) * 1000000 + max_timeout.tv_usec;
+
+        for (int i = 0; i < attempt && us < max_us; i++)
+            us *= 2;
+        us = std::max<int64_t>(std::min(us, max_us), 1000);
+
+        return {static_cast<time_t>(us / 1000000), static_cast<suseconds_t>(us % 1000000)};
+    }
+
+    const timingProfile& Timing::get(int level) {
+        return profiles[std::clamp(level, 0, 5)];
+    }
+
+    timingProfile Timing::load(const std::string& filename) {
+        std::ifstream f(filename, std::ios::in);
+        timingProfile profile = get(3);
+        std::string line, key, value;
+        int line_number = 0;
+        bool has_min = false;
+
+        if (!f.is_open()) {
+            throw std::runtime_error("ERROR: Cannot open timing file `" + filename + "`");
+        }
+        profile.name = filename;
+
+        while (std::getline(f, line)) {
+            std::istringstream ss(line);
+            char* end = nullptr;
+
+            line_number++;
+            if (!(ss >> key) || key[0] == '#')
+                continue;
+            if (!(ss >> value)) {
+                throw std::runtime_error("ERROR: Missing value of `" + key + "` in line "
+                                         + std::to_string(line_number) + " of the timing file");
+            }
+            if (key == "name") {
+                profile.name = value;
+                continue;
+            }
+
+            long n = std::strtol(value.c_str(), &end, 10);
+            if (*end != '\0' || n < 0 || n > 1000000000) {
+                throw std::runtime_error("ERROR: Invalid value of `" + key + "` in line "
+                                         + std::to_string(line_number) + " of the timing file");
+            }
+
+            if (key == "concurrency") {
+                profile.concurrency = static_cast<int>(n);
+            } else if (key == "timeout") {
+                profile.timeout_ms = static_cast<int>(n);
+            } else if (key == "min-timeout") {
+                profile.min_timeout_ms = static_cast<int>(n);
+                has_min = true;
+            } else if (key == "max-timeout") {
+                profile.max_timeout_ms = static_cast<int>(n);
+            } else if (key == "retries") {
+                profile.retries = static_cast<int>(n);
+            } else if (key == "udp-timeout") {
+                profile.udp_timeout_ms = static_cast<int>(n);
+            } else if (key == "delay") {
+                profile.delay_ms = static_cast<int>(n);
+            } else if (key == "rate") {
+                profile.rate = static_cast<int>(n);
+            } else {
+                throw std::runtime_error("ERROR: Unknown key `" + key + "` in line "
+                                         + std::to_string(line_number) + " of the timing file");
+            }
+        }
+
+        if (!has_min) {
+            profile.min_timeout_ms = std::min(profile.min_timeout_ms, profile.max_timeout_ms); // normal one is fixed
+        }
+        if (profile.min_timeout_ms > profile.max_timeout_ms) {
+            throw std::runtime_error("ERROR: min-timeout is bigger than max-timeout in the timing file");
+        }
+        return profile;
+    }
+
+    void AdaptiveTimeout::setBounds(timeval initial_timeout, timeval min_timeout, timeval max_timeout) {
+        initial = static_cast<int64_t>(initial_timeout.tv_sec) * 1000000 + initial_timeout.tv_usec;
+        min = static_cast<int64_t>(min_timeout.tv_sec) * 1000000 + min_timeout.tv_usec;
+        max = static_cast<int64_t>(max_timeout.tv_sec) * 1000000 + max_timeout.tv_usec;
+        srtt = 0;
+        rttvar = 0;
+    }
+
+    void AdaptiveTimeout::observe(std::chrono::steady_clock::duration rtt) {
+        int64_t r = std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(rtt).count(), 1);
+        int64_t s = srtt.load(std::memory_order_relaxed);
+        int64_t v = rttvar.load(std::memory_order_relaxed);
+
+        if (min >= max) {
+            return; // fixed timeout
+        }
+
+        if (s == 0) {
+            s = r;
+            v = r / 2;
+        } else {
+            v += (std::abs(s - r) - v) / 4;
+            s += (r - s) / 8;
+        }
+        rttvar.store(v, std::memory_order_relaxed);
+        srtt.store(std::max<int64_t>(s, 1), std::memory_order_relaxed);
+    }
+
+    timeval AdaptiveTimeout::current() const {
+        int64_t s = srtt.load(std::memory_order_relaxed);
+        int64_t us = s == 0 ? initial : std::clamp(s + 4 * rttvar.load(std::memory_order_relaxed), min, max);
+
+        return {static_cast<time_t>(us / 1000000), static_cast<suseconds_t>(us % 1000000)};
+    }
+}
@@ -0,0 +1,95 @@
+/**
+ * Timing.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Timing templates (-T0 paranoid .. -T5 insane) and profile files.
+ * A profile sets everything, which decides how fast and how loud
+ * the scan is, at once: probes in flight, timeouts, retries of UDP
+ * probes, the delay between probes and their rate.
+ *
+ * Timeouts adapt to the network: every answered TCP probe is a sample
+ * of the round trip time, and the timeout follows srtt + 4 * rttvar
+ * (as in TCP itself, RFC 6298), kept between the minimum and maximum
+ * of the profile. Until the first answer the initial one is used.
+ * The estimate is one for the whole scan, so the normal profile doesn't
+ * adapt: 500ms for TCP and 1s for each UDP try, as without a profile.
+*/
+
+#ifndef PORTSCAN_TIMING_H
+#define PORTSCAN_TIMING_H
+
+#include "../net/IpAddress.h"
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace scanner {
+    struct timingProfile {
+        std::string name;
+        int concurrency = 0; // probes in flight at most, 0 = what the mode allows
+        int timeout_ms = 500; // initial
+        int min_timeout_ms = 100;
+        int max_timeout_ms = 1000;
+        int retries = 4; // UDP probes without an answer are sent again
+        int udp_timeout_ms = 0; // the first wait of a UDP probe, 0 = the current TCP timeout
+        int delay_ms = 0; // between two probes of the scan
+        int rate = 0; // probes per second, 0 = no limit
+    };
+
+    /**
+     * How long a UDP probe waits for the answer - the wait
+     * doubles with every retry, up to the max_timeout.
+    */
+    struct retryPolicy {
+        timeval timeout = {1, 0};
+        timeval max_timeout = {1, 0};
+        int retries = 4;
+
+        timeval wait(int attempt) const;
+    };
+
+    class Timing {
+    public:
+        /**
+         * @param level 0 (paranoid) - 5 (insane), 3 is the default
+        */
+        static const timingProfile& get(int level);
+
+        /**
+         * Reads `<key> <value>` lines (keys as in timingProfile, `-` instead of `_`,
+         * times in ms), missing keys are taken from the normal profile.
+         * Throws, if the file can't be read or has unknown keys.
+        */
+        static timingProfile load(const std::string& filename);
+
+        static timeval toTimeval(int ms) { return {ms / 1000, (ms % 1000) * 1000}; }
+        static int toMs(timeval t) { return static_cast<int>(t.tv_sec * 1000 + t.tv_usec / 1000); }
+    };
+
+    /**
+     * Round trip time estimator, shared by all probes of the scan.
+     * Updates from many threads may overwrite each other - it's only
+     * an estimate, so they are not serialized.
+    */
+    class AdaptiveTimeout {
+        std::atomic<int64_t> srtt{0}; // in us, 0 = no sample yet
+        std::atomic<int64_t> rttvar{0};
+        int64_t initial = 500000;
+        int64_t min = 100000;
+        int64_t max = 1000000;
+    public:
+        void setBounds(timeval initial, timeval min, timeval max);
+
+        void observe(std::chrono::steady_clock::duration rtt);
+
+        timeval current() const;
+    };
+}
+
+#endif //PORTSCAN_TIMING_H
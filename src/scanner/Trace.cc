@@ -0,0 +1,96 @@
+/**
+ * Trace.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "Trace.h"
+
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+
+namespace scanner {
+
+    namespace {
+        struct ring {
+            uint32_t thread = 0;
+            std::atomic<uint64_t> head{0}; // records written so far
+            Trace::record records[TRACE_RING_SIZE];
+        };
+
+        // rings outlive their threads - pool threads may be gone before the dump
+        std::vector<std::unique_ptr<ring>> rings;
+        std::mutex rings_mutex;
+        std::chrono::steady_clock::time_point started;
+    }
+
+    std::atomic<bool> Trace::enabled{false};
+
+    void Trace::start() {
+        started = std::chrono::steady_clock::now();
+        enabled.store(true);
+    }
+
+    void Trace::write(event e, ipv4 ip, uint16_t port, CONNECTION_TYPE protocol) {
+        thread_local ring* local = nullptr;
+
+        if (local == nullptr) {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+
+            rings.push_back(std::make_unique<ring>());
+            local = rings.back().get();
+            local->thread = static_cast<uint32_t>(rings.size() - 1);
+        }
+
+        uint64_t i = local->head.load(std::memory_order_relaxed);
+        record& r = local->records[i & (TRACE_RING_SIZE - 1)];
+
+        r.time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+        r.ip = ip;
+        r.port = port;
+        r.event = e;
+        r.protocol = static_cast<uint8_t>(protocol);
+
+        local->head.store(i + 1, std::memory_order_release);
+    }
+
+    bool Trace::dump(const std::string& filename) {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        std::ofstream f(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+        auto count = static_cast<uint32_t>(rings.size());
+
+        if (!f.good()) {
+            return false;
+        }
+
+        f.write(TRACE_MAGIC, sizeof(TRACE_MAGIC) - 1);
+        f.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+        for (auto& r : rings) {
+            uint64_t head = r->head.load(std::memory_order_acquire);
+            uint64_t n = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+
+            f.write(reinterpret_cast<const char*>(&r->thread), sizeof(r->thread));
+            f.write(reinterpret_cast<const char*>(&n), sizeof(n));
+
+            // oldest first - the ring may have wrapped around
+            for (uint64_t i = head - n; i < head; i++) {
+                f.write(reinterpret_cast<const char*>(&r->records[i & (TRACE_RING_SIZE - 1)]), sizeof(record));
+            }
+        }
+
+        return f.good();
+    }
+
+    const char* Trace::eventName(uint8_t e) {
+        static const char* names[EVENTS] = {"enqueue", "dequeue", "socket", "connect", "result", "print"};
+
+        return e < EVENTS ? names[e] : "unknown";
+    }
+}
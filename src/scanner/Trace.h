@@ -0,0 +1,84 @@
+/**
+ * Trace.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Timeline of every probe, for offline analysis of slow scans.
+ *
+ * Each thread appends 16 byte records to its own ring buffer
+ * (no locks, the oldest records are overwritten), and the rings are
+ * dumped to a binary file at the end of the scan. trace2json turns
+ * the file into Chrome trace JSON (chrome://tracing, Perfetto).
+ * When tracing is off, every trace point is one relaxed load and a branch.
+ *
+ * File format (little endian):
+ *
+ *      "PSTRACE1"
+ *      uint32 number of rings
+ *      for every ring:
+ *          uint32 thread number
+ *          uint64 number of records
+ *          record[...] - oldest first
+*/
+
+#ifndef PORTSCAN_TRACE_H
+#define PORTSCAN_TRACE_H
+
+#include "../net/IpAddress.h"
+#include "../net/ServicesDictionary.h"
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+
+#define TRACE_MAGIC "PSTRACE1"
+#define TRACE_RING_SIZE (1 << 16) // records per thread, must be a power of two
+
+namespace scanner {
+    using namespace net;
+
+    class Trace {
+    public:
+        enum event : uint8_t {
+            ENQUEUE, // pushed to the thread pool (or spawned as a coroutine)
+            DEQUEUE, // taken by a worker
+            SOCKET_CREATED, // socket created (SOCKET is taken by the macro)
+            CONNECT, // connect / wait for the answer has finished
+            RESULT, // result is known, before the print mutex
+            PRINT, // row printed
+            EVENTS
+        };
+
+        struct record {
+            uint64_t time; // ns since the start of the trace
+            ipv4 ip; // network order, as in IpAddress
+            uint16_t port;
+            uint8_t event;
+            uint8_t protocol; // CONNECTION_TYPE
+        };
+        static_assert(sizeof(record) == 16, "records are dumped as they are");
+    private:
+        static std::atomic<bool> enabled;
+
+        static void write(event e, ipv4 ip, uint16_t port, CONNECTION_TYPE protocol);
+    public:
+        static void start();
+
+        static void add(event e, const IpAddress& ip, uint16_t port, CONNECTION_TYPE protocol) {
+            if (enabled.load(std::memory_order_relaxed))
+                write(e, ip.getAsAddr().num, port, protocol);
+        }
+
+        /**
+         * Write all rings to the file. Threads should be idle by now.
+        */
+        static bool dump(const std::string& filename);
+
+        static const char* eventName(uint8_t e);
+    };
+}
+
+#endif //PORTSCAN_TRACE_H
@@ -11,91 +11,65 @@
 */
 
 #include "PortScanner.h"
+#include "../net/Headers.h"
 #include <iostream>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
 
 namespace scanner {
 
-    struct ipHeader {
-        // there is possility of default initialization of bit fields, but it requires C++20 standard,
-        // so we have to remember to initialize the bit fields manually (with zeros)
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-        uint8_t ihl:4;
-        uint8_t version:4;
-#elif __BYTE_ORDER == __BIG_ENDIAN
-        uint8_t version:4;
-        uint8_t ihl:4;
-#endif
-        uint8_t tos = 16; // small delay
-        uint16_t len = 0; // pkg size
-        uint16_t id = htons(54321);
-        uint16_t flag_off = 0;
-        uint8_t ttl = 64; // time to live
-        uint8_t protocol = 17; // UDP (diagram protocol)
-        uint16_t checksum = 0;
-        uint32_t sourceIp = 0;
-        uint32_t destination = 0;
-    };
-
-    struct udpHeader {
-        uint16_t sourcePort = 0;
-        uint16_t destinationPort = 0;
-        uint16_t len = 0;
-        uint16_t checksum = 0;
-    };
-
-    struct icmpHeader {
-        uint8_t type; // msg type
-        uint8_t code;
-        uint16_t checksum;
-        // based on linux kernel implementation:
-        union {
-            struct {
-                uint16_t id;
-                uint16_t sequence;
-            } echo;
-            uint32_t gateway;
-            struct {
-                uint16_t unused;
-                uint16_t mtu;
-            } frag;
-        } unused;
-    };
-
-    // RFC checksum algorithm
-    unsigned short calcCheckSum(uint16_t *addr, int_fast32_t count) {
-        uint32_t sum = 0;
-
-        for(; count > 0; count--)
-            sum += *addr++;
-
-        sum = (sum >> 16) + (sum & 0xffff);
-        sum += (sum >> 16);
-
-        return (unsigned short)(~sum);
+    // Every probe is sent from its own source port,
+    // so a reply can be matched with the probe (and thread), that sent it.
+    static std::atomic<uint16_t> next_source_port{0};
+
+    static uint16_t get_source_port() {
+        return static_cast<uint16_t>(40000 + next_source_port.fetch_add(1, std::memory_order_relaxed) % 20000);
+    }
+
+    PORT_STATE PortScanner::udp_connect(IpAddress ip, port in_port, timeval timeout) {
+        PacketTemplate probe(PacketTemplate::sourceFor(ip.getAsAddr().num), nullptr, 0);
+
+        return udp_connect(ip, in_port, {timeout, timeout, 4}, probe);
     }
 
-    bool PortScanner::udp_connect(IpAddress ip, port in_port, timeval timeout) {
+    PORT_STATE PortScanner::udp_connect(IpAddress ip, port in_port, const retryPolicy& policy, const PacketTemplate& probe,
+                                        IcmpRateLimit* limit, Capture* capture) {
         struct sockaddr_in addr{0}; // connection struct
+        struct sockaddr_in from{0}; // sender of the received packet - addr stays for the retries
     #ifndef WIN32
         unsigned int i_addrSize = sizeof(addr);
+        unsigned int i_fromSize = sizeof(from);
     #else
         int i_addrSize = sizeof(addr);
+        int i_fromSize = sizeof(from);
     #endif
 
-        char buff[PACKET_SIZE] = {0}; // pkg to send request
-        char rcBuff[PACKET_SIZE] = {0}; // ppkg to receive response
+        uint8_t buff[PACKET_SIZE]; // pkg to send request (built from the template)
+        char rcBuff[PACKET_SIZE]; // ppkg to receive response
         struct ipHeader *iph = (struct ipHeader *)buff, *rcIph = nullptr;
         struct udpHeader *udh = (struct udpHeader *)(buff + sizeof(ipHeader)), *rcUdh = nullptr;
         struct icmpHeader *rcIch = nullptr;
 
-        SOCKET S_socket = 1;
+        SOCKET S_socket = 1; // sends probes and receives UDP replies
+        SOCKET S_icmp = 1; // receives ICMP errors
         long res = 0;
-        bool reply_flag = false;
-        bool close_flag = false;
+        long received = 0;
+        bool reply_flag = false; // the service has answered
+        bool close_flag = false; // ICMP unreachable has been received
+        uint8_t close_code = 0; // 3 = port unreachable, the rest come from firewalls
 
         u_long u_mode = 1;
         fd_set fd{}; // struct needed for selecting socket
-        timeval udpTimeout = {1, 0}; // time to speed up socket connection
+        timeval udpTimeout{}; // time to wait for the reply, for every try
+
+        size_t packet_size = 0;
+        bool captured = capture != nullptr && capture->isSampled(ip.getAsAddr().num, in_port);
+
+        if (probe.size() > PACKET_SIZE) {
+            std::cerr << "ERROR: UDP probe is too big.." << std::endl;
+            return FILTERED;
+        }
 
     #ifdef _WIN32
         // Windows needs to enable socket before using it.
@@ -116,129 +90,122 @@ namespace scanner {
     #ifdef _WIN32
             WSACleanup();
     #endif
-            closesocket(S_socket);
-            return false;
+            return FILTERED;
+        }
+
+        // inform socket, that we are providing ip header
+    #ifndef WIN32
+        res = setsockopt(S_socket, IPPROTO_IP, IP_HDRINCL, &u_mode, sizeof(u_mode));
+    #else
+        res = setsockopt(S_socket, IPPROTO_IP, IP_HDRINCL, (const char*)(&u_mode), sizeof(u_mode));
+    #endif
+        if(res == SOCKET_ERROR) {
+            std::cerr << "WARNING: Cannot set IP_HDRINCL..." << std::endl;
         }
 
+        // if there is any ICMP unreachable - the port is closed
+        S_icmp = socket(PF_INET, SOCK_RAW, IPPROTO_ICMP);
+        if(S_icmp == INVALID_SOCKET) {
+            std::cerr << "WARNING: Cannot create ICMP socket.." << std::endl;
+        }
+
+        Trace::add(Trace::SOCKET_CREATED, ip, in_port, UDP);
+
         addr.sin_addr.s_addr = ip.getAsAddr().num;
         addr.sin_port = htons(in_port);
         addr.sin_family = AF_INET; // ipv4
 
-        // header to send:
-        iph->version = 4; // 0100 0101
-        iph->ihl = 5;
-        iph->tos = 16; // short interval
-        iph->len = sizeof(struct ipHeader) + sizeof(udpHeader); // pkg size (it's only header in my case)
-        iph->id = htons(54321);
-        iph->flag_off = 0;
-        iph->ttl = 255; // time to live
-        iph->protocol = IPPROTO_UDP; // UDP (diagram protocol)
-        iph->sourceIp = 666; // let's fake ip - It's an attack anyway
-        iph->destination = ip.getAsNetNumber();
-        iph->checksum = calcCheckSum((unsigned short *)buff, sizeof(struct ipHeader) + sizeof(struct udpHeader));
-        // extend header for UDP
-        udh->sourcePort = htons(9); // port doesn't matter
-        udh->destinationPort = htons(in_port);
-        udh->len = htons(sizeof(struct udpHeader));
-        udh->checksum = 0; // optional field if anyone care about data integrity
+        // the packet is built once - retries send the same bytes
+        packet_size = probe.build(buff, ip.getAsAddr().num, in_port, get_source_port());
 
         // ok, so the idea is as follow:
-        // 1. send a few messages
+        // 1. send a request (real one, if we know the protocol)
         // 2. wait for response
-        // 3. no response = open or close
-        // 4. if UDP will answer with the same address, on which I've send pkg = the port is open
-        for(int i = 0; i < 5; i++) { // czas wykonywania min = 5s
-            res = sendto(S_socket, buff, iph->len, 0, (struct sockaddr *) &addr, i_addrSize); // return number of bites or SOCKET_ERROR
+        // 3. UDP reply from the port = the port is open
+        // 4. ICMP port unreachable for our datagram = the port is closed (other codes = filtered)
+        // 5. no response = open or filtered
+        for(int i = 0; i <= policy.retries && !reply_flag && !close_flag; i++) {
+            if (limit != nullptr)
+                limit->wait(); // as fast as the host sends ICMP back
+
+            res = sendto(S_socket, (const char*) buff, packet_size, 0, (struct sockaddr *) &addr, i_addrSize); // return number of bites or SOCKET_ERROR
 
             if(res == SOCKET_ERROR)
                 break;
+            if (captured)
+                capture->add(buff, packet_size);
 
-            FD_ZERO(&fd);
-            FD_SET(S_socket, &fd);
+            udpTimeout = policy.wait(i); // Linux select() decreases it
+            while(!reply_flag && !close_flag) {
+                SOCKET max_socket = S_socket;
 
-            while(select(S_socket + 1, &fd, nullptr, nullptr, &udpTimeout) > 0) {
-                if(recvfrom(S_socket, rcBuff, PACKET_SIZE, 0, (struct sockaddr *) &addr, &i_addrSize) > 0) {
-                    rcIph = (struct ipHeader*) rcBuff;
-                    rcUdh = (struct udpHeader*)(rcBuff + sizeof(struct ipHeader));
-                    rcIch = (struct icmpHeader*)(rcBuff + sizeof(struct ipHeader));
-
-                    reply_flag = true;
-
-                    rcIph->sourceIp = htonl(rcIph->sourceIp);
-
-                    if(rcIph->protocol == IPPROTO_UDP) {
-                        if(rcIph->sourceIp == iph->destination) { // port might be open or closed
-                            i = 10;
-                            close_flag = false;
-                            break;
-                        } else if(rcUdh->sourcePort == udh->sourcePort && rcIch->type == 0) { // redirection to local net?
-                            // port is open of course
-                            i = 10;
-                            close_flag = false;
-                            break;
-                        }
-                    }
-                }
-            }
-        }
-        shutdown(S_socket, SD_RECEIVE);
-        closesocket(S_socket);
-
-        // now we have to check for ICMP response
-        // if there is any - the port is closed
-        S_socket = socket(PF_INET, SOCK_RAW, IPPROTO_ICMP);
-        if(S_socket == SOCKET_ERROR) {
-            std::cerr << "ERROR: Cannot create ICMP socket.." << std::endl;
-    #ifdef _WIN32
-            WSACleanup();
-    #endif
-            closesocket(S_socket);
-            return false;
-        }
-
-        // inform socket, that we are providing ip header
-    #ifndef WIN32
-        res = setsockopt(S_socket, IPPROTO_IP, IP_HDRINCL, &u_mode, sizeof(u_mode));
-    #else
-        res = setsockopt(S_socket, IPPROTO_IP, IP_HDRINCL, (const char*)(&u_mode), sizeof(u_mode));
-    #endif
-        if(res == SOCKET_ERROR) {
-            std::cerr << "WARNING: Cannot set IP_HDRINCL..." << std::endl;
-        }
-
-        for(int i = 0; i < 3; i++) {
-            if (sendto(S_socket, buff, iph->len, 0, (struct sockaddr *) &addr, i_addrSize) > 0) {
-
-                // extend time limit, becouse eg. linux (kernel) slower response for about 1s
-                udpTimeout = {2, 0};
                 FD_ZERO(&fd);
                 FD_SET(S_socket, &fd);
+                if (S_icmp != INVALID_SOCKET) {
+                    FD_SET(S_icmp, &fd);
+                    max_socket = std::max(S_socket, S_icmp);
+                }
 
-                if (select(S_socket + 1, &fd, nullptr, nullptr, &udpTimeout) > 0) {
-                    while (recvfrom(S_socket, rcBuff, PACKET_SIZE, 0, (struct sockaddr *) &addr, &i_addrSize) > 0) {
-                        rcIph = (struct ipHeader *) rcBuff;
-                        rcIch = (struct icmpHeader *) (rcBuff + sizeof(struct ipHeader));
+                if (select(max_socket + 1, &fd, nullptr, nullptr, &udpTimeout) <= 0)
+                    break; // no more answers for this try
 
-                        if (rcIch->type == 3) { // I AM CLOSED - thats what he said
-                            close_flag = true;
-                            i = 3;
-                            break;
-                        }
+                if(FD_ISSET(S_socket, &fd)
+                    && (received = recvfrom(S_socket, rcBuff, PACKET_SIZE, 0, (struct sockaddr *) &from, &i_fromSize)) > 0) {
+                    rcIph = (struct ipHeader*) rcBuff;
+                    rcUdh = (struct udpHeader*)(rcBuff + rcIph->ihl * 4);
+
+                    // raw socket receives every UDP datagram - find the one for our probe
+                    if(received >= rcIph->ihl * 4 + (long) sizeof(udpHeader) && rcIph->protocol == IPPROTO_UDP && rcIph->sourceIp == iph->destination
+                        && rcUdh->sourcePort == udh->destinationPort && rcUdh->destinationPort == udh->sourcePort) {
+                        reply_flag = true; // the service has answered - it's open
+                        if (captured)
+                            capture->add((const uint8_t*) rcBuff, received);
                     }
                 }
+
+                if(S_icmp != INVALID_SOCKET && FD_ISSET(S_icmp, &fd)
+                    && (received = recvfrom(S_icmp, rcBuff, PACKET_SIZE, 0, (struct sockaddr *) &from, &i_fromSize)) > 0) {
+                    rcIph = (struct ipHeader *) rcBuff;
+                    rcIch = (struct icmpHeader *) (rcBuff + rcIph->ihl * 4);
+
+                    // ICMP error carries the header of our datagram
+                    auto* orgIph = (struct ipHeader *) ((char*) rcIch + sizeof(struct icmpHeader));
+                    auto* orgUdh = (struct udpHeader *) ((char*) orgIph + orgIph->ihl * 4);
+
+                    if (received >= (char*) orgUdh - rcBuff + (long) sizeof(udpHeader) && rcIch->type == 3 && orgIph->destination == iph->destination
+                        && orgUdh->destinationPort == udh->destinationPort && orgUdh->sourcePort == udh->sourcePort) {
+                        close_flag = true; // I AM CLOSED - thats what he said (or filtered for codes != 3)
+                        close_code = rcIch->code;
+                        if (captured)
+                            capture->add((const uint8_t*) rcBuff, received);
+                    }
+                }
+            }
+
+            if (limit != nullptr && close_flag) {
+                limit->unreachable(i > 0);
+            } else if (limit != nullptr && !reply_flag) {
+                limit->silent();
             }
         }
 
+        Trace::add(Trace::CONNECT, ip, in_port, UDP);
+
         shutdown(S_socket, SD_RECEIVE);
         closesocket(S_socket);
+        if (S_icmp != INVALID_SOCKET) {
+            shutdown(S_icmp, SD_RECEIVE);
+            closesocket(S_icmp);
+        }
+
+        if (reply_flag)
+            return OPEN;
 
-        // If port is responding with ICMP
-        // or something other than UDP, then
-        // the port is closed
-        if(close_flag || (!close_flag && reply_flag))
-            return false;
+        // If port is responding with ICMP, then the port is closed
+        if (close_flag)
+            return close_code == 3 ? CLOSED : FILTERED;
 
-        return true;
+        return OPEN_FILTERED;
     }
 
 }
\ No newline at end of file
@@ -0,0 +1,171 @@
+/**
+ * UdpBatchScanner.cc
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+*/
+
+#include "UdpBatchScanner.h"
+#include "../net/Headers.h"
+
+#include <atomic>
+#include <poll.h>
+
+namespace scanner {
+
+    // every host is scanned from another source port, so late replies
+    // for the previous host are never taken for replies of the current one
+    // (udp_connect uses 40000 - 59999)
+    static std::atomic<uint16_t> next_source_port{0};
+
+    UdpBatchScanner::UdpBatchScanner(std::unique_ptr<RawTransport> transport, template_source templates,
+                                     IcmpRateLimit* limit, Capture* capture, int retries, std::chrono::milliseconds wait)
+            : transport(std::move(transport)), templates(std::move(templates)), limit(limit), capture(capture),
+              retries(retries > 0 ? retries : 1), wait(wait), state(65536, PENDING), wanted(65536, 0) {}
+
+    void UdpBatchScanner::onPacket(const uint8_t* packet, size_t size) {
+        auto* iph = reinterpret_cast<const ipHeader*>(packet);
+
+        if (size < sizeof(ipHeader))
+            return;
+
+        if (iph->protocol == IPPROTO_UDP)
+            onUdp(packet, size);
+        else if (iph->protocol == IPPROTO_ICMP)
+            onIcmp(packet, size);
+    }
+
+    void UdpBatchScanner::onUdp(const uint8_t* packet, size_t size) {
+        auto* iph = reinterpret_cast<const ipHeader*>(packet);
+
+        if (size < sizeof(ipHeader) || iph->protocol != IPPROTO_UDP || iph->sourceIp != destination)
+            return;
+        if (size < iph->ihl * 4u + sizeof(udpHeader))
+            return;
+
+        auto* udh = reinterpret_cast<const udpHeader*>(packet + iph->ihl * 4);
+        uint16_t port = ntohs(udh->sourcePort);
+
+        if (ntohs(udh->destinationPort) == source_port && wanted[port] && state[port] == PENDING) {
+            state[port] = ANSWERED;
+            remaining--;
+            if (capture != nullptr && capture->isSampled(destination, port))
+                capture->add(packet, size);
+        }
+    }
+
+    void UdpBatchScanner::onIcmp(const uint8_t* packet, size_t size) {
+        auto* iph = reinterpret_cast<const ipHeader*>(packet);
+
+        if (size < sizeof(ipHeader) + sizeof(icmpHeader) + sizeof(ipHeader))
+            return;
+
+        auto* ich = reinterpret_cast<const icmpHeader*>(packet + iph->ihl * 4);
+        auto* org_iph = reinterpret_cast<const ipHeader*>(reinterpret_cast<const uint8_t*>(ich) + sizeof(icmpHeader));
+        auto* org_udh = reinterpret_cast<const udpHeader*>(reinterpret_cast<const uint8_t*>(org_iph) + org_iph->ihl * 4);
+
+        if (size < static_cast<size_t>(reinterpret_cast<const uint8_t*>(org_udh) - packet) + sizeof(udpHeader))
+            return;
+        if (ich->type != 3 || org_iph->protocol != IPPROTO_UDP || org_iph->destination != destination
+            || ntohs(org_udh->sourcePort) != source_port)
+            return;
+
+        uint16_t port = ntohs(org_udh->destinationPort);
+        if (wanted[port] && state[port] == PENDING) {
+            state[port] = ich->code == 3 ? UNREACHABLE : PROHIBITED; // closed for code 3, filtered for the rest
+            remaining--;
+            if (capture != nullptr && capture->isSampled(destination, port))
+                capture->add(packet, size);
+            if (limit != nullptr)
+                limit->unreachable(round > 0); // silent in the previous rounds
+        }
+    }
+
+    void UdpBatchScanner::drain() {
+        transport->receive([this](const uint8_t* p, size_t n) { onPacket(p, n); });
+    }
+
+    void UdpBatchScanner::waitForReplies(std::chrono::steady_clock::time_point deadline) {
+        std::vector<pollfd> fds;
+
+        while (remaining > 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0)
+                break;
+
+            fds.clear();
+            transport->getPollFds(fds);
+            if (poll(fds.data(), fds.size(), static_cast<int>(left.count())) <= 0)
+                break;
+
+            drain();
+        }
+        drain();
+    }
+
+    void UdpBatchScanner::scan(const IpAddress& ip, const std::vector<uint16_t>& ports, const callback& on_result) {
+        destination = ip.getAsAddr().num;
+        remaining = ports.size();
+        round = 0;
+
+        for (auto p : ports) {
+            state[p] = PENDING;
+            wanted[p] = 1;
+        }
+
+        // not one of the scanned ports, if there is such - on loopback our own probes
+        // come in as well, and a probe to port == source_port would look like its answer
+        // (only a scan of all 65535 ports of the local host can't avoid it)
+        source_port = static_cast<uint16_t>(60000 + next_source_port.fetch_add(1) % 5000);
+        for (uint32_t i = 0; i < 65535 && wanted[source_port]; i++) {
+            source_port = static_cast<uint16_t>(source_port % 65535 + 1); // 1 - 65535
+        }
+
+        for (round = 0; round < retries && remaining > 0; round++) {
+            size_t queued = 0;
+
+            for (auto p : ports) {
+                if (state[p] != PENDING)
+                    continue;
+
+                const PacketTemplate& probe = templates(p);
+                if (probe.size() > BATCH_SLOT_SIZE)
+                    continue;
+
+                if (limit != nullptr) {
+                    auto turn = limit->reserve();
+
+                    // the host drops ICMP - one probe per turn, reading replies meanwhile
+                    if (turn > std::chrono::steady_clock::now()) {
+                        transport->flush();
+                        waitForReplies(turn);
+                    }
+                }
+
+                uint8_t* packet = transport->next();
+                size_t size = probe.build(packet, destination, p, source_port);
+
+                if (capture != nullptr && capture->isSampled(destination, p))
+                    capture->add(packet, size); // before the ring may take it away
+                transport->commit(size, destination);
+
+                // read replies between batches, so the receive buffer never overflows
+                if (++queued % BATCH_SIZE == 0)
+                    drain();
+            }
+            transport->flush();
+
+            waitForReplies(std::chrono::steady_clock::now() + wait);
+            if (limit != nullptr)
+                limit->silent(remaining); // the rest of the round got nothing
+        }
+
+        for (auto p : ports) {
+            on_result(p, state[p] == ANSWERED ? OPEN : state[p] == UNREACHABLE ? CLOSED
+                         : state[p] == PROHIBITED ? FILTERED : OPEN_FILTERED);
+            wanted[p] = 0;
+        }
+    }
+}
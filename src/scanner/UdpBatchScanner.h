@@ -0,0 +1,74 @@
+/**
+ * UdpBatchScanner.h
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * UDP scan of all ports of a host at once, from one thread.
+ * Instead of a pair of raw sockets, a select() and a sendto()
+ * per port (udp_connect), probes are written into a RawTransport
+ * (raw sockets with sendmmsg, or AF_PACKET rings) and sent together,
+ * and all replies are read in batches as well. Ports, which
+ * didn't answer, are retried in the next round.
+*/
+
+#ifndef PORTSCAN_UDPBATCHSCANNER_H
+#define PORTSCAN_UDPBATCHSCANNER_H
+
+#include "../net/IpAddress.h"
+#include "../net/PacketTemplate.h"
+#include "../net/RawTransport.h"
+#include "IcmpRateLimit.h"
+#include "Capture.h"
+#include "PortState.h"
+
+#include <cstdint>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+namespace scanner {
+    using namespace net;
+
+    class UdpBatchScanner {
+    public:
+        typedef std::function<const PacketTemplate&(uint16_t port)> template_source;
+        typedef std::function<void(uint16_t port, PORT_STATE state)> callback;
+    private:
+        enum portState : uint8_t { PENDING, ANSWERED, UNREACHABLE, PROHIBITED };
+
+        std::unique_ptr<RawTransport> transport;
+        template_source templates;
+        IcmpRateLimit* limit; // nullptr = probes of a round are sent at once
+        Capture* capture; // nullptr = no pcap
+        int retries;
+        std::chrono::milliseconds wait;
+
+        // state of the ports of the current host, indexed by port
+        std::vector<uint8_t> state;
+        std::vector<uint8_t> wanted;
+        size_t remaining = 0;
+        int round = 0; // ports still pending got nothing in the earlier rounds
+
+        uint32_t destination = 0;
+        uint16_t source_port = 0;
+
+        void onPacket(const uint8_t* packet, size_t size);
+        void onUdp(const uint8_t* packet, size_t size);
+        void onIcmp(const uint8_t* packet, size_t size);
+        void drain();
+        void waitForReplies(std::chrono::steady_clock::time_point deadline);
+    public:
+        UdpBatchScanner(std::unique_ptr<RawTransport> transport, template_source templates, IcmpRateLimit* limit,
+                        Capture* capture, int retries, std::chrono::milliseconds wait);
+
+        bool isOpen() const { return transport != nullptr && transport->isOpen(); }
+
+        void scan(const IpAddress& ip, const std::vector<uint16_t>& ports, const callback& on_result);
+    };
+}
+
+#endif //PORTSCAN_UDPBATCHSCANNER_H
@@ -0,0 +1,263 @@
+/**
+ * daemon-test
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Checks of the --daemon socket protocol, run by ctest: jobs against
+ * listeners of the test on 127.0.0.1, errors, CANCEL sent together
+ * with other requests, and a client, which doesn't read its results
+ * (it must not hold back the jobs of other clients).
+ *
+ * Must run in the directory with the `services` and `payloads` files.
+ *
+ * usage: daemon-test [listeners]
+*/
+
+#include "../scanner/Daemon.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define TEST_SOCKET "/tmp/portscan-daemon-test.sock"
+#define TEST_TIMEOUT_MS 60000 // of one line
+#define TEST_FIRST_PORT 20000 // listeners of the slow client, below the ephemeral ports
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+/**
+ * Returns -1, if the port is taken.
+*/
+static int listen_on(uint16_t port) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    int one = 1;
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 16) != 0) {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+static uint16_t port_of(int s) {
+    sockaddr_in addr{};
+    socklen_t size = sizeof(addr);
+
+    getsockname(s, (sockaddr*)&addr, &size);
+    return ntohs(addr.sin_port);
+}
+
+class client {
+private:
+    int s = -1;
+    std::string buffer;
+public:
+    client() {
+        sockaddr_un addr{};
+
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, TEST_SOCKET, sizeof(addr.sun_path) - 1);
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(s, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            close(s);
+            s = -1;
+        }
+    }
+
+    ~client() {
+        if (s >= 0)
+            close(s);
+    }
+
+    bool connected() const {
+        return s >= 0;
+    }
+
+    void send_all(const std::string& data) {
+        send(s, data.data(), data.size(), MSG_NOSIGNAL);
+    }
+
+    /**
+     * Returns an empty string on timeout or when the daemon has closed the connection.
+    */
+    std::string line() {
+        char chunk[4096];
+
+        while (true) {
+            size_t eol = buffer.find('\n');
+
+            if (eol != std::string::npos) {
+                std::string l = buffer.substr(0, eol);
+                buffer.erase(0, eol + 1);
+                return l;
+            }
+
+            pollfd pfd{s, POLLIN, 0};
+            if (poll(&pfd, 1, TEST_TIMEOUT_MS) <= 0)
+                return {};
+
+            ssize_t n = recv(s, chunk, sizeof(chunk), 0);
+            if (n <= 0)
+                return {};
+            buffer.append(chunk, n);
+        }
+    }
+
+    /**
+     * Reads the lines of one job, returns the summary, results are counted.
+    */
+    std::string job(size_t& results) {
+        std::string l = line();
+
+        results = 0;
+        if (l.rfind("# job ", 0) != 0 || l.find(" started") == std::string::npos)
+            return "unexpected `" + l + "`";
+
+        while (!(l = line()).empty() && l[0] != '#')
+            results++;
+        return l;
+    }
+};
+
+static bool contains(const std::string& s, const std::string& what) {
+    return s.find(what) != std::string::npos;
+}
+
+/**
+ * One job, one open port.
+*/
+static void one_job(uint16_t port) {
+    client c;
+    std::string request = "127.0.0.1/32 -p " + std::to_string(port) + " " + std::to_string(port) + " -TCP -T4\n";
+
+    check(c.connected(), "cannot connect to the daemon");
+    c.send_all(request);
+
+    check(contains(c.line(), " started"), "job has not started");
+    std::string result = c.line();
+    check(result.rfind("127.0.0.1 " + std::to_string(port) + "/tcp open", 0) == 0, "unexpected result `" + result + "`");
+    std::string summary = c.line();
+    check(contains(summary, " done, 1 open ports"), "unexpected summary `" + summary + "`");
+}
+
+static void invalid_request() {
+    client c;
+
+    c.send_all("127.0.0.1/32 --no-such-option\n");
+    std::string l = c.line();
+    check(l.rfind("# ERROR: ", 0) == 0, "no error for an invalid request, got `" + l + "`");
+}
+
+/**
+ * CANCEL comes in the same write as the next request, behind it.
+*/
+static void pipelined_cancel(uint16_t port) {
+    client c;
+    size_t results;
+    std::string p = std::to_string(port);
+
+    c.send_all("127.0.0.1/32 -p 1 65535 -TCP -T1\n127.0.0.1/32 -p " + p + " " + p + " -TCP -T4\nCANCEL\n");
+
+    std::string summary = c.job(results);
+    check(contains(summary, " cancelled, "), "first job not cancelled, got `" + summary + "`");
+    summary = c.job(results);
+    check(contains(summary, " done, 1 open ports") && results == 1, "second job, got `" + summary + "`");
+}
+
+/**
+ * The first client reads its results only after the job of the second one
+ * is done - it has more of them than the socket and the queue of the job take.
+*/
+static void slow_client(uint16_t port, size_t count) {
+    std::vector<int> listeners;
+    uint16_t last = TEST_FIRST_PORT;
+    client slow, fast;
+    size_t results;
+    std::string p = std::to_string(port);
+
+    for (uint16_t i = TEST_FIRST_PORT; listeners.size() < count && i < TEST_FIRST_PORT + 2 * count; i++) {
+        int s = listen_on(i);
+
+        if (s >= 0) {
+            listeners.push_back(s);
+            last = i;
+        }
+    }
+
+    slow.send_all("127.0.0.1/32 -p " + std::to_string(TEST_FIRST_PORT) + " " + std::to_string(last) + " -TCP -T4\n");
+    std::this_thread::sleep_for(std::chrono::seconds(1)); // results pile up
+
+    auto started = std::chrono::steady_clock::now();
+    fast.send_all("127.0.0.1/32 -p " + p + " " + p + " -TCP -T4\n");
+    std::string summary = fast.job(results);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+
+    check(contains(summary, " done, 1 open ports"), "job next to a slow client, got `" + summary + "`");
+    check(ms < 10000, "job next to a slow client took " + std::to_string(ms) + " ms");
+
+    summary = slow.job(results);
+    check(contains(summary, " done, " + std::to_string(listeners.size()) + " open ports") && results == listeners.size(),
+          "slow client got " + std::to_string(results) + " of " + std::to_string(listeners.size()) + " results, `" + summary + "`");
+
+    for (int s : listeners)
+        close(s);
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 16000;
+    scanner::flags f{};
+
+    f.i_max_probes = 256; // sockets of the probes and the listeners are in one process
+    int s = listen_on(0);
+    uint16_t port = port_of(s);
+
+    unlink(TEST_SOCKET);
+    try {
+        scanner::Daemon daemon(TEST_SOCKET, f);
+        std::thread runner(&scanner::Daemon::run, &daemon);
+
+        one_job(port);
+        invalid_request();
+        pipelined_cancel(port);
+        slow_client(port, count);
+
+        daemon.stop();
+        runner.join();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        failures++;
+    }
+    close(s);
+    unlink(TEST_SOCKET);
+
+    if (failures > 0) {
+        return 1;
+    }
+    std::cout << "daemon: ok" << std::endl;
+    return 0;
+}
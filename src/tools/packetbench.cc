@@ -0,0 +1,181 @@
+/**
+ * packetbench
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Compares UDP probes built from a PacketTemplate (destination and ports
+ * patched in, checksums updated incrementally) with probes built from
+ * scratch for every destination (what udp_connect has done before):
+ * headers filled in, payload copied, both checksums summed again.
+ * Both ways must give the same bytes - the benchmark checks it first.
+ *
+ * The full build sums with checksumAdd (SSE2/AVX2 from 64 bytes on),
+ * so it's measured once more with a plain word by word sum as well.
+ *
+ * usage: packetbench [probes] [payload size]
+*/
+
+#include "../net/PacketTemplate.h"
+#include "../net/Checksum.h"
+#include "../net/Headers.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+using namespace scanner::net;
+typedef std::chrono::steady_clock bench_clock;
+
+#define BENCH_SOURCE 0x0100000a // 10.0.0.1, as stored in IpAddress
+#define BENCH_SOURCE_PORT 60000
+#define BENCH_MAX_PAYLOAD 1400
+
+struct probe {
+    uint32_t destination;
+    uint16_t port;
+};
+
+typedef uint32_t (*sum_function)(const void* data, size_t len, uint32_t sum);
+
+/**
+ * The compiler must assume, that the memory behind p is read here,
+ * so the stores of the build can't be dropped.
+*/
+static inline void do_not_optimize(const void* p) {
+    asm volatile("" : : "g"(p) : "memory");
+}
+
+// the same sum as checksumAdd, without SIMD
+static uint32_t checksum_add_scalar(const void* data, size_t len, uint32_t sum) {
+    auto* p = static_cast<const uint8_t*>(data);
+    uint64_t sum64 = sum;
+    uint16_t word = 0;
+
+    for (; len >= 2; len -= 2, p += 2) {
+        memcpy(&word, p, 2);
+        sum64 += word;
+    }
+    if (len) {
+        word = 0;
+        memcpy(&word, p, 1);
+        sum64 += word;
+    }
+
+    while (sum64 >> 32)
+        sum64 = (sum64 & 0xffffffff) + (sum64 >> 32);
+    return static_cast<uint32_t>(sum64);
+}
+
+template<sum_function sum_add>
+static size_t build_full(uint8_t* out, const uint8_t* payload, size_t payload_size, uint32_t destination,
+                         uint16_t destination_port, uint16_t source_port) {
+    auto* iph = reinterpret_cast<ipHeader*>(out);
+    auto* udh = reinterpret_cast<udpHeader*>(out + sizeof(ipHeader));
+    size_t size = sizeof(ipHeader) + sizeof(udpHeader) + payload_size;
+
+    memset(out, 0, sizeof(ipHeader) + sizeof(udpHeader));
+    iph->version = 4;
+    iph->ihl = 5;
+    iph->tos = 16;
+    iph->len = htons(static_cast<uint16_t>(size));
+    iph->id = htons(54321);
+    iph->ttl = 255;
+    iph->protocol = IPPROTO_UDP;
+    iph->sourceIp = BENCH_SOURCE;
+    iph->destination = destination;
+    iph->checksum = checksumFinish(sum_add(iph, sizeof(ipHeader), 0));
+
+    udh->sourcePort = htons(source_port);
+    udh->destinationPort = htons(destination_port);
+    udh->len = htons(static_cast<uint16_t>(sizeof(udpHeader) + payload_size));
+    memcpy(out + sizeof(ipHeader) + sizeof(udpHeader), payload, payload_size);
+
+    // pseudo header: source, destination, zero + protocol, UDP length
+    uint16_t pseudo[2] = {htons(IPPROTO_UDP), udh->len};
+    uint32_t sum = sum_add(&iph->sourceIp, sizeof(uint32_t) * 2, 0);
+
+    sum = sum_add(pseudo, sizeof(pseudo), sum);
+    sum = sum_add(udh, sizeof(udpHeader) + payload_size, sum);
+    uint16_t check = checksumFinish(sum);
+    udh->checksum = check == 0 ? 0xffff : check;
+
+    return size;
+}
+
+static double mpps(bench_clock::time_point started, size_t n) {
+    double seconds = std::chrono::duration<double>(bench_clock::now() - started).count();
+    return seconds > 0 ? static_cast<double>(n) / seconds / 1000000 : 0;
+}
+
+template<typename F>
+static void bench(const char* name, const std::vector<probe>& probes, size_t count, uint8_t* out, F build) {
+    auto t = bench_clock::now();
+
+    for (size_t i = 0; i < count; i++) {
+        const probe& p = probes[i & (probes.size() - 1)];
+        build(out, p);
+        do_not_optimize(out);
+    }
+    std::cout << std::left << std::setw(12) << name << std::right << std::setw(12) << mpps(t, count) << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    size_t payload_size = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 48; // eg. DNS query
+    std::vector<uint8_t> payload;
+    std::vector<probe> probes(1 << 16);
+    std::mt19937_64 random(42);
+    uint8_t template_out[sizeof(ipHeader) + sizeof(udpHeader) + BENCH_MAX_PAYLOAD];
+    uint8_t full_out[sizeof(ipHeader) + sizeof(udpHeader) + BENCH_MAX_PAYLOAD];
+    uint8_t scalar_out[sizeof(ipHeader) + sizeof(udpHeader) + BENCH_MAX_PAYLOAD];
+
+    if (payload_size > BENCH_MAX_PAYLOAD) {
+        std::cerr << "ERROR: Payload is bigger than " << BENCH_MAX_PAYLOAD << " bytes" << std::endl;
+        return 1;
+    }
+    for (size_t i = 0; i < payload_size; i++)
+        payload.push_back(static_cast<uint8_t>(random()));
+    for (auto& p : probes)
+        p = {static_cast<uint32_t>(random()), static_cast<uint16_t>(random())};
+
+    PacketTemplate probe_template(BENCH_SOURCE, payload.data(), payload.size());
+
+    for (auto& p : probes) {
+        size_t a = probe_template.build(template_out, p.destination, p.port, BENCH_SOURCE_PORT);
+        size_t b = build_full<checksumAdd>(full_out, payload.data(), payload.size(), p.destination, p.port, BENCH_SOURCE_PORT);
+        size_t c = build_full<checksum_add_scalar>(scalar_out, payload.data(), payload.size(), p.destination, p.port,
+                                                   BENCH_SOURCE_PORT);
+
+        if (a != b || memcmp(template_out, full_out, a) != 0) {
+            std::cerr << "ERROR: Template build differs from the full build" << std::endl;
+            return 1;
+        }
+        if (b != c || memcmp(full_out, scalar_out, b) != 0) {
+            std::cerr << "ERROR: Scalar checksum differs from checksumAdd" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << count << " probes, " << payload_size << " bytes of payload\n"
+              << std::fixed << std::setprecision(1)
+              << std::left << std::setw(12) << "build" << std::right << std::setw(12) << "Mpps" << std::endl;
+
+    bench("template", probes, count, template_out, [&](uint8_t* out, const probe& p) {
+        probe_template.build(out, p.destination, p.port, BENCH_SOURCE_PORT);
+    });
+    bench("full", probes, count, full_out, [&](uint8_t* out, const probe& p) {
+        build_full<checksumAdd>(out, payload.data(), payload.size(), p.destination, p.port, BENCH_SOURCE_PORT);
+    });
+    bench("full scalar", probes, count, scalar_out, [&](uint8_t* out, const probe& p) {
+        build_full<checksum_add_scalar>(out, payload.data(), payload.size(), p.destination, p.port, BENCH_SOURCE_PORT);
+    });
+
+    return 0;
+}
@@ -0,0 +1,358 @@
+/**
+ * portscan-query
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Filters, aggregates and exports binary journals of portscan (--journal).
+ * Journals are read block by block - only one block is in memory at a time,
+ * and blocks, which can't match the filters (by their index header),
+ * are skipped without reading their records.
+ *
+ * usage: portscan-query [filters] [--count | --group-by <key>] [--csv] <journal>...
+*/
+
+#include "../scanner/Journal.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <string>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+
+using namespace scanner;
+
+enum groupKey { NONE, BY_IP, BY_PORT, BY_PROTOCOL, BY_STATE, BY_RUN };
+
+struct query {
+    uint32_t ip_from = 0; // host order
+    uint32_t ip_to = UINT32_MAX;
+    uint16_t port_from = 0;
+    uint16_t port_to = 65535;
+    uint8_t protocols = 0xff; // bit per CONNECTION_TYPE
+    uint8_t states = 0xff; // bit per PORT_STATE
+    uint64_t since = 0; // unix time in ms
+    uint64_t until = UINT64_MAX;
+    uint64_t run = 0; // 0 = all runs
+
+    bool count = false;
+    groupKey group = NONE;
+    bool csv = false;
+};
+
+struct aggregate {
+    uint64_t records = 0;
+    uint64_t states[PORT_STATES]{};
+    uint64_t rtt_sum = 0; // of records with a known round trip
+    uint64_t rtt_count = 0;
+};
+
+struct totals {
+    uint64_t blocks = 0;
+    uint64_t skipped = 0; // blocks, which couldn't match
+    uint64_t matched = 0;
+};
+
+static void print_help() {
+    std::cerr
+        << "usage: portscan-query [filters] [--count | --group-by <key>] [--csv] <journal>...\n\n"
+        << "filters:\n"
+        << "\t--ip <ip>[/<bits>] | <ip>-<ip>\n"
+        << "\t--port <port>[-<port>]\n"
+        << "\t--proto <tcp|udp>\n"
+        << "\t--state <open|closed|filtered|open|filtered>[,...]\n"
+        << "\t--since <unix time>, --until <unix time> (in seconds)\n"
+        << "\t--run <run> (as printed by --group-by run)\n"
+        << "output (one line per probe by default):\n"
+        << "\t--count\t\t\tnumber of matching probes\n"
+        << "\t--group-by <key>\tprobes by state and average round trip per ip, port, proto, state or run\n"
+        << "\t--csv\t\t\tcomma separated, with a header\n";
+}
+
+static bool to_number(const std::string& s, uint64_t& value) {
+    if (s.empty() || s.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    value = std::strtoull(s.c_str(), nullptr, 10);
+    return true;
+}
+
+static bool to_host(const std::string& s, uint32_t& host) {
+    addr_ipv4 addr{};
+
+    if (::inet_pton(AF_INET, s.c_str(), &addr) != 1)
+        return false;
+    host = IpAddress(addr.num).getAsNetNumber();
+    return true;
+}
+
+static bool parse_ip(const std::string& s, query& q) {
+    auto slash = s.find('/');
+    auto dash = s.find('-');
+    uint64_t bits = 32;
+
+    if (dash != std::string::npos) {
+        return to_host(s.substr(0, dash), q.ip_from) && to_host(s.substr(dash + 1), q.ip_to);
+    }
+    if (!to_host(s.substr(0, slash), q.ip_from)
+        || (slash != std::string::npos && (!to_number(s.substr(slash + 1), bits) || bits > 32))) {
+        return false;
+    }
+
+    uint32_t mask = bits == 0 ? 0 : ~static_cast<uint32_t>(0) << (32 - bits);
+    q.ip_from &= mask;
+    q.ip_to = q.ip_from | ~mask;
+    return true;
+}
+
+static bool parse_states(const std::string& s, query& q) {
+    std::istringstream ss(s);
+    std::string name;
+
+    q.states = 0;
+    while (std::getline(ss, name, ',')) {
+        int state = 0;
+
+        while (state < PORT_STATES && name != state_name(static_cast<PORT_STATE>(state)))
+            state++;
+        if (state == PORT_STATES)
+            return false;
+        q.states |= static_cast<uint8_t>(1 << state);
+    }
+    return q.states != 0;
+}
+
+static bool parse_args(int argc, char** argv, query& q, std::vector<std::string>& files) {
+    for (int i = 1; i < argc; i++) {
+        std::string opt = argv[i];
+        bool has_value = i + 1 < argc;
+        uint64_t a = 0, b = 0;
+
+        if (opt == "--ip" && has_value) {
+            if (!parse_ip(argv[++i], q))
+                return false;
+        } else if (opt == "--port" && has_value) {
+            std::string v = argv[++i];
+            auto dash = v.find('-');
+
+            if (!to_number(v.substr(0, dash), a) || a > 65535)
+                return false;
+            b = a;
+            if (dash != std::string::npos && (!to_number(v.substr(dash + 1), b) || b > 65535 || b < a))
+                return false;
+            q.port_from = static_cast<uint16_t>(a);
+            q.port_to = static_cast<uint16_t>(b);
+        } else if (opt == "--proto" && has_value) {
+            std::string v = argv[++i];
+
+            if (v != "tcp" && v != "udp")
+                return false;
+            q.protocols = static_cast<uint8_t>(1 << (v == "tcp" ? net::TCP : net::UDP));
+        } else if (opt == "--state" && has_value) {
+            if (!parse_states(argv[++i], q))
+                return false;
+        } else if ((opt == "--since" || opt == "--until" || opt == "--run") && has_value) {
+            if (!to_number(argv[++i], a))
+                return false;
+            (opt == "--since" ? q.since : opt == "--until" ? q.until : q.run) = opt == "--run" ? a : a * 1000;
+        } else if (opt == "--count") {
+            q.count = true;
+        } else if (opt == "--group-by" && has_value) {
+            std::string v = argv[++i];
+
+            q.group = v == "ip" ? BY_IP : v == "port" ? BY_PORT : v == "proto" ? BY_PROTOCOL
+                      : v == "state" ? BY_STATE : v == "run" ? BY_RUN : NONE;
+            if (q.group == NONE)
+                return false;
+        } else if (opt == "--csv") {
+            q.csv = true;
+        } else if (opt.rfind("--", 0) == 0) {
+            return false;
+        } else {
+            files.push_back(opt);
+        }
+    }
+    return !files.empty();
+}
+
+/**
+ * The index of the block says, that none of its records can match.
+*/
+static bool can_skip(const journalBlock& b, const query& q) {
+    uint8_t states = 0;
+
+    for (int s = 0; s < PORT_STATES; s++) {
+        if (b.states[s] > 0)
+            states |= static_cast<uint8_t>(1 << s);
+    }
+
+    return b.ip_max < q.ip_from || b.ip_min > q.ip_to
+        || b.last_time < q.since || b.first_time > q.until
+        || (q.run != 0 && b.run != q.run)
+        || (b.protocols & q.protocols) == 0
+        || (states & q.states) == 0;
+}
+
+static bool matches(const journalBlock& b, const journalRecord& r, const query& q) {
+    uint32_t host = IpAddress(r.ip).getAsNetNumber();
+    uint64_t time = b.first_time + r.time;
+
+    return host >= q.ip_from && host <= q.ip_to
+        && r.port >= q.port_from && r.port <= q.port_to
+        && (q.protocols & (1 << r.protocol)) != 0
+        && r.state < PORT_STATES && (q.states & (1 << r.state)) != 0
+        && time >= q.since && time <= q.until;
+}
+
+static std::string format_time(uint64_t ms) {
+    std::ostringstream ss;
+    auto seconds = static_cast<time_t>(ms / 1000);
+    std::tm* t = std::gmtime(&seconds);
+    char buffer[32];
+
+    strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", t);
+    ss << buffer << "." << std::setw(3) << std::setfill('0') << ms % 1000 << "Z";
+    return ss.str();
+}
+
+static const char* protocol_name(uint8_t protocol) {
+    return protocol == net::TCP ? "tcp" : "udp";
+}
+
+static void print_record(const journalBlock& b, const journalRecord& r, const query& q) {
+    std::string time = format_time(b.first_time + r.time);
+    std::string ip = IpAddress(r.ip).getAsString();
+    const char* state = state_name(static_cast<PORT_STATE>(r.state));
+
+    if (q.csv) {
+        std::cout << time << "," << ip << "," << r.port << "," << protocol_name(r.protocol) << ","
+                  << state << "," << r.rtt << "," << b.run << "\n";
+    } else {
+        std::cout << time << " " << ip << " " << r.port << "/" << protocol_name(r.protocol) << " "
+                  << state << " " << r.rtt << "us\n";
+    }
+}
+
+static uint64_t group_of(const journalBlock& b, const journalRecord& r, groupKey group) {
+    switch (group) {
+        case BY_IP: return IpAddress(r.ip).getAsNetNumber(); // in address order
+        case BY_PORT: return r.port;
+        case BY_PROTOCOL: return r.protocol;
+        case BY_STATE: return r.state;
+        default: return b.run;
+    }
+}
+
+static std::string group_name(uint64_t key, groupKey group) {
+    switch (group) {
+        case BY_IP: return IpAddress(htonl(static_cast<uint32_t>(key))).getAsString();
+        case BY_PORT: return std::to_string(key);
+        case BY_PROTOCOL: return protocol_name(static_cast<uint8_t>(key));
+        case BY_STATE: return state_name(static_cast<PORT_STATE>(key));
+        default: return std::to_string(key) + (key > 0 ? " (" + format_time(key) + ")" : "");
+    }
+}
+
+static bool read_journal(const std::string& filename, const query& q, std::map<uint64_t, aggregate>& groups, totals& t) {
+    std::ifstream f(filename, std::ios::in | std::ios::binary);
+    char magic[sizeof(JOURNAL_MAGIC) - 1];
+    uint32_t sizes[2] = {0, 0};
+    std::vector<journalRecord> records;
+    journalBlock b{};
+
+    if (!f.read(magic, sizeof(magic)) || memcmp(magic, JOURNAL_MAGIC, sizeof(magic)) != 0
+        || !f.read(reinterpret_cast<char*>(sizes), sizeof(sizes))
+        || sizes[0] != sizeof(journalBlock) || sizes[1] != sizeof(journalRecord)) {
+        std::cerr << "ERROR: `" << filename << "` is not a portscan journal\n";
+        return false;
+    }
+
+    while (f.read(reinterpret_cast<char*>(&b), sizeof(b))) {
+        if (memcmp(b.magic, JOURNAL_BLOCK_MAGIC, sizeof(b.magic)) != 0 || b.count > JOURNAL_BLOCK_RECORDS) {
+            std::cerr << "WARNING: `" << filename << "` is damaged after " << t.blocks << " blocks\n";
+            return true;
+        }
+        t.blocks++;
+
+        if (can_skip(b, q)) {
+            t.skipped++;
+            f.seekg(static_cast<std::streamoff>(b.count * sizeof(journalRecord)), std::ios::cur);
+            continue;
+        }
+
+        records.resize(b.count);
+        if (!f.read(reinterpret_cast<char*>(records.data()), static_cast<std::streamsize>(b.count * sizeof(journalRecord)))) {
+            std::cerr << "WARNING: The last block of `" << filename << "` is incomplete\n"; // the scan was killed
+            return true;
+        }
+
+        for (auto& r : records) {
+            if (!matches(b, r, q))
+                continue;
+            t.matched++;
+
+            if (q.group != NONE) {
+                aggregate& a = groups[group_of(b, r, q.group)];
+
+                a.records++;
+                a.states[r.state]++;
+                if (r.rtt > 0) {
+                    a.rtt_sum += r.rtt;
+                    a.rtt_count++;
+                }
+            } else if (!q.count) {
+                print_record(b, r, q);
+            }
+        }
+    }
+    return true;
+}
+
+static void print_groups(const std::map<uint64_t, aggregate>& groups, const query& q) {
+    const char* separator = q.csv ? "," : " ";
+
+    if (q.csv) {
+        std::cout << "key,probes,open,closed,filtered,open|filtered,avg_rtt_us\n";
+    }
+
+    for (auto& [key, a] : groups) {
+        std::cout << group_name(key, q.group) << separator << a.records << separator << a.states[OPEN] << separator
+                  << a.states[CLOSED] << separator << a.states[FILTERED] << separator << a.states[OPEN_FILTERED]
+                  << separator << (a.rtt_count > 0 ? a.rtt_sum / a.rtt_count : 0) << (q.csv ? "\n" : "us\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    query q;
+    std::vector<std::string> files;
+    std::map<uint64_t, aggregate> groups;
+    totals t;
+
+    if (!parse_args(argc, argv, q, files)) {
+        print_help();
+        return 1;
+    }
+
+    if (q.csv && q.group == NONE && !q.count) {
+        std::cout << "time,ip,port,protocol,state,rtt_us,run\n";
+    }
+
+    for (auto& file : files) {
+        if (!read_journal(file, q, groups, t))
+            return 1;
+    }
+
+    if (q.group != NONE) {
+        print_groups(groups, q);
+    } else if (q.count) {
+        std::cout << t.matched << "\n";
+    }
+
+    std::cerr << t.matched << " probes matched, " << t.blocks - t.skipped << " of " << t.blocks << " blocks read\n";
+    return 0;
+}
@@ -0,0 +1,170 @@
+/**
+ * timerbench
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Compares the timer wheel of the event loops with a binary heap
+ * (std::priority_queue - cancelled timers are dropped, when they come up)
+ * and std::multimap (what the event loops have used before),
+ * on the pattern of a scan: all timers are armed, most of them are
+ * cancelled (the port has answered), the rest expire.
+ *
+ * usage: timerbench [timers] [cancelled %]
+*/
+
+#include "../async/TimerWheel.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <queue>
+#include <map>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <cstdlib>
+
+using scanner::async::TimerWheel;
+typedef std::chrono::steady_clock bench_clock;
+
+#define BENCH_SPAN 10000 // deadlines within 10s (in ms ticks)
+
+struct results {
+    double arm = 0, cancel = 0, expire = 0; // ns per timer
+    size_t expired = 0;
+};
+
+static double ns_per(bench_clock::time_point started, size_t n) {
+    return n == 0 ? 0 : static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - started).count()) / n;
+}
+
+static results bench_wheel(const std::vector<uint64_t>& deadlines, const std::vector<bool>& cancelled) {
+    std::vector<TimerWheel::timer> timers(deadlines.size());
+    auto wheel = std::make_unique<TimerWheel>(0);
+    results r;
+    size_t n_cancelled = 0;
+
+    auto t = bench_clock::now();
+    for (size_t i = 0; i < deadlines.size(); i++)
+        wheel->arm(timers[i], deadlines[i]);
+    r.arm = ns_per(t, deadlines.size());
+
+    t = bench_clock::now();
+    for (size_t i = 0; i < deadlines.size(); i++) {
+        if (cancelled[i]) {
+            wheel->cancel(timers[i]);
+            n_cancelled++;
+        }
+    }
+    r.cancel = ns_per(t, n_cancelled);
+
+    t = bench_clock::now();
+    for (uint64_t now = 1; now <= BENCH_SPAN + 1; now++) {
+        wheel->advance(now, [&r](TimerWheel::timer&) { r.expired++; });
+    }
+    r.expire = ns_per(t, r.expired);
+
+    return r;
+}
+
+static results bench_heap(const std::vector<uint64_t>& deadlines, const std::vector<bool>& cancelled) {
+    typedef std::pair<uint64_t, size_t> entry;
+    std::priority_queue<entry, std::vector<entry>, std::greater<>> heap;
+    std::vector<bool> dead(deadlines.size(), false);
+    results r;
+    size_t n_cancelled = 0;
+
+    auto t = bench_clock::now();
+    for (size_t i = 0; i < deadlines.size(); i++)
+        heap.emplace(deadlines[i], i);
+    r.arm = ns_per(t, deadlines.size());
+
+    // a heap can't remove from the middle - the entry stays until it comes up
+    t = bench_clock::now();
+    for (size_t i = 0; i < deadlines.size(); i++) {
+        if (cancelled[i]) {
+            dead[i] = true;
+            n_cancelled++;
+        }
+    }
+    r.cancel = ns_per(t, n_cancelled);
+
+    t = bench_clock::now();
+    for (uint64_t now = 1; now <= BENCH_SPAN + 1; now++) {
+        while (!heap.empty() && heap.top().first <= now) {
+            if (!dead[heap.top().second])
+                r.expired++;
+            heap.pop();
+        }
+    }
+    r.expire = ns_per(t, r.expired);
+
+    return r;
+}
+
+static results bench_multimap(const std::vector<uint64_t>& deadlines, const std::vector<bool>& cancelled) {
+    std::multimap<uint64_t, size_t> timers;
+    std::vector<std::multimap<uint64_t, size_t>::iterator> handles(deadlines.size());
+    results r;
+    size_t n_cancelled = 0;
+
+    auto t = bench_clock::now();
+    for (size_t i = 0; i < deadlines.size(); i++)
+        handles[i] = timers.emplace(deadlines[i], i);
+    r.arm = ns_per(t, deadlines.size());
+
+    t = bench_clock::now();
+    for (size_t i = 0; i < deadlines.size(); i++) {
+        if (cancelled[i]) {
+            timers.erase(handles[i]);
+            n_cancelled++;
+        }
+    }
+    r.cancel = ns_per(t, n_cancelled);
+
+    t = bench_clock::now();
+    for (uint64_t now = 1; now <= BENCH_SPAN + 1; now++) {
+        while (!timers.empty() && timers.begin()->first <= now) {
+            timers.erase(timers.begin());
+            r.expired++;
+        }
+    }
+    r.expire = ns_per(t, r.expired);
+
+    return r;
+}
+
+static void print_row(const char* name, const results& r) {
+    std::cout << std::left << std::setw(12) << name << std::right
+              << std::setw(12) << r.arm << std::setw(12) << r.cancel << std::setw(12) << r.expire
+              << std::setw(12) << r.expired << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    int cancelled_percent = argc > 2 ? std::atoi(argv[2]) : 90;
+    std::vector<uint64_t> deadlines(count);
+    std::vector<bool> cancelled(count);
+    std::mt19937_64 random(42);
+
+    for (size_t i = 0; i < count; i++) {
+        deadlines[i] = 1 + random() % BENCH_SPAN;
+        cancelled[i] = static_cast<int>(random() % 100) < cancelled_percent;
+    }
+
+    std::cout << count << " timers within " << BENCH_SPAN << "ms, " << cancelled_percent << "% cancelled\n"
+              << std::fixed << std::setprecision(1)
+              << std::left << std::setw(12) << "ns/timer" << std::right
+              << std::setw(12) << "arm" << std::setw(12) << "cancel" << std::setw(12) << "expire"
+              << std::setw(12) << "expired" << std::endl;
+
+    print_row("wheel", bench_wheel(deadlines, cancelled));
+    print_row("heap", bench_heap(deadlines, cancelled));
+    print_row("multimap", bench_multimap(deadlines, cancelled));
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * timerwheel-test
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Checks of the timer wheel, run by ctest: every timer expires exactly
+ * at its tick, and nextTick() is never later than the first expiry
+ * or cascade (event loops sleep until it).
+ *
+ * usage: timerwheel-test [seed]
+*/
+
+#include "../async/TimerWheel.h"
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <cstdlib>
+
+using scanner::async::TimerWheel;
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+/**
+ * An upper level cascades before the next slot of level 0, which wraps around.
+*/
+static void upper_level_first() {
+    TimerWheel wheel(0);
+    TimerWheel::timer a, b;
+    std::vector<TimerWheel::timer*> expired;
+
+    wheel.arm(a, 260); // level 1
+    wheel.advance(250, [&](TimerWheel::timer& t) { expired.push_back(&t); });
+    wheel.arm(b, 300); // level 0, slot 44 - before the current one
+
+    check(wheel.nextTick() <= 256, "nextTick() " + std::to_string(wheel.nextTick()) + " skips the cascade at 256");
+
+    wheel.advance(260, [&](TimerWheel::timer& t) { expired.push_back(&t); });
+    check(expired.size() == 1 && expired[0] == &a, "a has not expired at 260");
+}
+
+/**
+ * Sleeps from one nextTick() to the other, as the event loops do.
+*/
+static void random_timers(unsigned seed) {
+    std::mt19937_64 random(seed);
+    std::uniform_int_distribution<uint64_t> distance(1, 70000); // up to level 2
+    std::vector<TimerWheel::timer> timers(20000);
+    std::vector<uint64_t> expires(timers.size());
+    TimerWheel wheel(random() % 100000);
+    size_t armed = 0, done = 0;
+    bool early = false, wrong = false;
+
+    for (size_t i = 0; i < timers.size() / 2; i++) {
+        timers[i].data = reinterpret_cast<void*>(i);
+        expires[i] = wheel.now() + distance(random);
+        wheel.arm(timers[i], expires[i]);
+        armed++;
+    }
+
+    while (wheel.size() > 0) {
+        uint64_t next = wheel.nextTick();
+
+        if (next <= wheel.now()) {
+            check(false, "nextTick() is not after now");
+            break;
+        }
+
+        wheel.advance(next - 1, [&](TimerWheel::timer&) { early = true; });
+        wheel.advance(next, [&](TimerWheel::timer& t) {
+            auto i = reinterpret_cast<size_t>(t.data);
+
+            wrong = wrong || expires[i] != next;
+            done++;
+
+            // new timers meanwhile, as probes are started
+            if (armed < timers.size()) {
+                timers[armed].data = reinterpret_cast<void*>(armed);
+                expires[armed] = next + distance(random);
+                wheel.arm(timers[armed], expires[armed]);
+                armed++;
+            }
+        });
+    }
+
+    check(!early, "a timer expired before nextTick() (seed " + std::to_string(seed) + ")");
+    check(!wrong, "a timer expired at a wrong tick (seed " + std::to_string(seed) + ")");
+    check(done == armed, "not all timers have expired (seed " + std::to_string(seed) + ")");
+}
+
+int main(int argc, char** argv) {
+    unsigned seed = argc > 1 ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 1;
+
+    upper_level_first();
+    random_timers(seed);
+
+    if (failures > 0) {
+        return 1;
+    }
+    std::cout << "timer wheel: ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,141 @@
+/**
+ * trace2json
+ *
+ *  Copyright (c) 2023, Tymoteusz Wenerski. All rights reserved.
+ *
+ *  Use of this source code is governed by a MIT license
+ *  that can be found in the License file.
+ *
+ * Converts the binary trace of portscan (--trace) into Chrome trace JSON.
+ * Every probe becomes a chain of spans on the threads, which ran it:
+ * queue (enqueue -> dequeue), socket, connect, result, print.
+ *
+ * usage: trace2json <trace file> [json file]
+*/
+
+#include "../scanner/Trace.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+
+using scanner::Trace;
+
+struct entry {
+    Trace::record r;
+    uint32_t thread;
+};
+
+static bool read_trace(const char* filename, std::vector<entry>& entries) {
+    std::ifstream f(filename, std::ios::in | std::ios::binary);
+    char magic[sizeof(TRACE_MAGIC) - 1];
+    uint32_t rings = 0;
+
+    if (!f.read(magic, sizeof(magic)) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0
+        || !f.read(reinterpret_cast<char*>(&rings), sizeof(rings))) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < rings; i++) {
+        uint32_t thread = 0;
+        uint64_t count = 0;
+
+        if (!f.read(reinterpret_cast<char*>(&thread), sizeof(thread))
+            || !f.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+            return false;
+        }
+
+        for (uint64_t j = 0; j < count; j++) {
+            entry e{};
+            if (!f.read(reinterpret_cast<char*>(&e.r), sizeof(e.r)))
+                return false;
+            e.thread = thread;
+            entries.push_back(e);
+        }
+    }
+    return true;
+}
+
+// name of the span, which ends with the event
+static const char* span_name(uint8_t event) {
+    switch (event) {
+        case Trace::DEQUEUE: return "queue";
+        case Trace::SOCKET_CREATED: return "socket";
+        case Trace::CONNECT: return "connect";
+        case Trace::RESULT: return "result";
+        case Trace::PRINT: return "print";
+        default: return Trace::eventName(event);
+    }
+}
+
+static std::string probe_name(const Trace::record& r) {
+    scanner::net::IpAddress ip(r.ip);
+    const char* proto = r.protocol == scanner::net::TCP ? "/tcp" : r.protocol == scanner::net::UDP ? "/udp" : "";
+
+    return ip.getAsString() + ":" + std::to_string(r.port) + proto;
+}
+
+int main(int argc, char** argv) {
+    std::vector<entry> entries;
+    std::unordered_map<uint64_t, entry> last; // by probe (ip, port, protocol) - -ALL probes both at once
+    std::ofstream file;
+    bool first = true;
+
+    if (argc < 2) {
+        std::cerr << "usage: trace2json <trace file> [json file]\n";
+        return 1;
+    }
+
+    if (!read_trace(argv[1], entries)) {
+        std::cerr << "ERROR: `" << argv[1] << "` is not a portscan trace\n";
+        return 1;
+    }
+
+    if (argc > 2) {
+        file.open(argv[2], std::ios::out | std::ios::trunc);
+        if (!file.good()) {
+            std::cerr << "ERROR: Cannot write `" << argv[2] << "`\n";
+            return 1;
+        }
+    }
+    std::ostream& out = argc > 2 ? file : std::cout;
+
+    std::stable_sort(entries.begin(), entries.end(), [](const entry& a, const entry& b) {
+        return a.r.time < b.r.time;
+    });
+
+    out << std::fixed << std::setprecision(3); // microseconds with ns precision
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (auto& e : entries) {
+        uint64_t key = (static_cast<uint64_t>(e.r.ip) << 24) | (static_cast<uint64_t>(e.r.port) << 8) | e.r.protocol;
+        auto it = last.find(key);
+
+        out << (first ? "" : ",\n");
+        first = false;
+
+        if (it == last.end() || e.r.event == Trace::ENQUEUE) {
+            // beginning of the probe (or the ring has lost its start)
+            out << "{\"name\":\"" << Trace::eventName(e.r.event) << "\",\"ph\":\"i\",\"s\":\"t\""
+                << ",\"ts\":" << static_cast<double>(e.r.time) / 1000.0
+                << ",\"pid\":1,\"tid\":" << e.thread
+                << ",\"args\":{\"probe\":\"" << probe_name(e.r) << "\"}}";
+        } else {
+            const entry& p = it->second;
+
+            out << "{\"name\":\"" << span_name(e.r.event) << "\",\"ph\":\"X\""
+                << ",\"ts\":" << static_cast<double>(p.r.time) / 1000.0
+                << ",\"dur\":" << static_cast<double>(e.r.time - p.r.time) / 1000.0
+                << ",\"pid\":1,\"tid\":" << e.thread
+                << ",\"args\":{\"probe\":\"" << probe_name(e.r) << "\"}}";
+        }
+
+        last[key] = e;
+    }
+    out << "\n]}\n";
+
+    return 0;
+}